@@ -9,11 +9,86 @@ struct AnimFrame {
 struct AnimTrack {
 	int nKeyFrames;
 	std::vector<AnimFrame> Frames;
-	void getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float t, int sf, int ef, bool loop);
-	glm::mat4 Sample(float t, int sf, int ef, bool loop);
-	glm::mat4 Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B = nullptr);
+	// cursor, if given, is the keyframe found by the previous call with the same
+	// caller: when time moves forward it is usually the same one or the next, and
+	// the binary search is needed only after seeks and loops
+	void getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float t, int sf, int ef, bool loop, int *cursor = nullptr);
+	glm::mat4 Sample(float t, int sf, int ef, bool loop, int *cursor = nullptr);
+	glm::mat4 Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B = nullptr,
+					int *cursorA = nullptr, int *cursorB = nullptr);
 };
 
+// local pose of the joints of a skeleton, as a structure of arrays: component c of
+// joint j is at data[c * stride + j], with stride a multiple of 4
+enum AnimPoseComponent {
+	APC_TX, APC_TY, APC_TZ,
+	APC_QX, APC_QY, APC_QZ, APC_QW,
+	APC_SX, APC_SY, APC_SZ,
+	APC_COUNT
+};
+
+// components of a compressed keyframe: 16 bits for each translation and scale
+// component, and 48 bits for the rotation (smallest three)
+enum AnimQuantComponent {
+	AQC_TX, AQC_TY, AQC_TZ,
+	AQC_Q0, AQC_Q1, AQC_Q2,
+	AQC_SX, AQC_SY, AQC_SZ,
+	AQC_COUNT
+};
+
+struct AnimPose {
+	int nJoints = 0;
+	int stride = 0;
+	std::vector<float> data;
+	// keyframes decoded from a compressed clip: the last two kept ones are reused while
+	// the time stays between them
+	std::vector<float> scratch;
+	const struct AnimClip *scratchClip = nullptr;
+	int scratchKept = -1;
+	void resize(int n);
+	glm::mat4 getMatrix(int j) const;
+};
+
+// the tracks of all the animated joints of one animation, that share their keyframe
+// times: each keyframe is stored as a pose, so sampling reads two contiguous blocks
+struct AnimClip {
+	int nJoints = 0;
+	int nKeyFrames = 0;
+	int stride = 0;
+	std::vector<float> times;
+	std::vector<float> data;	// nKeyFrames poses of APC_COUNT * stride floats
+
+	// compressed form, that replaces data: only the kept keyframes are stored, and the
+	// others are interpolated from the closest kept ones
+	bool compressed = false;
+	std::vector<uint16_t> qData;	// kept keyframes, AQC_COUNT * stride values each
+	std::vector<float> qRange;		// offset and scale of each translation and scale component
+	std::vector<int> keyRef;		// for each keyframe, the last kept one at or before it
+	std::vector<int> keptKeys;		// keyframe of each kept one
+
+	// false if the tracks do not have the same keyframes
+	bool init(const std::vector<AnimTrack *> &tracks);
+	void Sample(AnimPose &out, float t, int sf, int ef, int *cursor = nullptr) const;
+
+	// quantizes all the keyframes, then keeps only those with keep[k] set, and frees data
+	void quantize();
+	void dropKeyFrames(const std::vector<bool> &keep);
+	// keyframe k as a pose, in out; tmp is another pose sized buffer
+	void decodeKeyFrame(int k, float *out, float *tmp) const;
+	void decodeKept(int kk, float *out) const;
+	size_t getMemorySize() const;
+};
+
+// out = a * (1 - w) + b * w, with the rotations normalized (nlerp), on poses of the
+// given stride; out can be a or b
+void AnimPoseMix(const float *a, const float *b, float w, float *out, int stride);
+// the same, with a weight for each joint
+void AnimPoseMixWeights(const float *a, const float *b, const float *w, float *out, int stride);
+// out = base plus the difference of layer from ref (the identity if ref is nullptr),
+// scaled by the weight w[j] of each joint; out can be base
+void AnimPoseAdd(const float *base, const float *layer, const float *ref, const float *w, float *out, int stride);
+glm::mat4 AnimPoseMatrix(const float *pose, int stride, int j);
+
 struct AnimBlendSegment {
 	int st;
 	int en;
@@ -29,12 +104,68 @@ struct AnimBlender {
 	int prev;
 	float blendTime;
 	float blendPos;
+
+	// last keyframe of each track slot in each segment
+	std::vector<int> cursors;
+	int *getCursor(int slot, int seg);
 	
 	void init(std::vector<AnimBlendSegment> seg);
 	void Advance(float dt);
 	void Start(int seg, float blendT);
-	glm::mat4 Sample(AnimTrack *AT, AnimTrack *AT2 = nullptr);
-	glm::mat4 Sample(std::vector<AnimTrack *> *AT);
+	// slot identifies the track (e.g. the joint) to cache its keyframe cursors, -1 for none
+	glm::mat4 Sample(AnimTrack *AT, AnimTrack *AT2 = nullptr, int slot = -1);
+	glm::mat4 Sample(std::vector<AnimTrack *> *AT, int slot = -1);
+};
+
+// Blend graph: the leaves sample clips, and the other nodes combine the poses of their
+// children. All the poses are allocated by init(), and Evaluate() does not allocate.
+// Children with zero weight are not evaluated (their clips keep advancing anyway).
+enum AnimBlendNodeType {
+	ABN_CLIP,		// clip, from keyframe st to en, at time t
+	ABN_BLEND,		// weighted average of the children
+	ABN_ADDITIVE	// children[0] plus weights[0] times (children[1] - children[2]), or
+					// children[1] alone if it has no third child
+};
+
+struct AnimBlendNode {
+	AnimBlendNodeType type;
+	int clip = 0;
+	int st = 0;
+	int en = -1;
+	float t = 0.0f;
+	float speed = 1.0f;
+	int cursor = -1;
+
+	std::vector<int> children;
+	std::vector<float> weights;
+	std::vector<float> mask;	// weight of each joint, empty for all 1
+
+	AnimPose pose;
+	std::vector<float> laneW;	// weights of the joints being combined
+	std::vector<float> laneSum;	// sum of the weights already combined, for each joint
+};
+
+class AnimBlendGraph {
+  public:
+	std::vector<AnimBlendNode> nodes;
+	int root = 0;
+
+	int addClip(int clip, int st = 0, int en = -1, float speed = 1.0f);
+	int addBlend(std::vector<int> children, std::vector<float> weights);
+	int addAdditive(int base, int layer, int reference = -1, float weight = 1.0f);
+	void setWeight(int node, int child, float w) {nodes[node].weights[child] = w;}
+	// mask: a weight for each animated joint of the skeleton, e.g. from
+	// SkeletalAnimation::getSubtreeMask(); empty to remove it
+	void setMask(int node, const std::vector<float> &mask);
+
+	void init(int nJoints);
+	void Advance(float dt);
+	const AnimPose &Evaluate(const std::vector<AnimClip> &clips);
+
+  private:
+	int nJoints = 0;
+	void evaluateNode(int n, const std::vector<AnimClip> &clips);
+	const float *laneWeights(AnimBlendNode &N, float w);
 };
 
 class SkeletalAnimation;
@@ -47,11 +178,85 @@ class Animations {
 	std::unordered_map<std::string, AnimTrack *> GLTFanims;
 
 	public:
-	void init(AssetFile &A);
+	// with JS, the animations of the file are converted in parallel
+	void init(AssetFile &A, JobSystem *JS = nullptr);
 	void cleanup();
 	AnimTrack *getAnim(std::string N);
 };
 
+// Rigid objects moved by a node track (rotating rings, spinning rotors...). All the
+// bound objects are sampled together, each in a lane of the same SoA poses, and their
+// matrices are written where they are used, e.g. in the Wm of a Scene instance
+struct RigidAnimBinding {
+	AnimTrack *AT;
+	glm::mat4 *out;		// receives base times the transform of the track
+	glm::mat4 base;
+	float t;
+	float speed;
+	int cursor;
+};
+
+class RigidAnimations {
+  public:
+	int add(AnimTrack *AT, glm::mat4 *out, glm::mat4 base, float t = 0.0f, float speed = 1.0f);
+	void Advance(float dt);
+	// samples all the tracks, and writes the matrices
+	void Update();
+	// removes all the bindings, before the matrices they write go away
+	void clear() {bindings.clear();}
+	int size() {return bindings.size();}
+
+  private:
+	std::vector<RigidAnimBinding> bindings;
+	AnimPose keyA, keyB, pose;
+	std::vector<float> alpha;
+};
+
+// one animated character: its skeleton, and the blender that drives it
+struct SkeletalInstance {
+	SkeletalAnimation *SA;
+	AnimBlender *AB;
+	int firstMatrix;	// set by SkeletalAnimation::SampleAll(), -1 if not visible
+
+	float distance = 0.0f;	// from the camera, set by the caller for AnimLOD
+	bool visible = true;	// the culled ones are not sampled, and get no matrices
+	// set by AnimLOD: the skeleton is sampled once every period frames, and its matrices
+	// are interpolated in between; joints deeper than maxDepth (-1 for none) follow
+	// their ancestor at that depth
+	int period = 1;
+	int maxDepth = -1;
+	int age = -1;		// frames since the last sample, -1 if it must be sampled again
+};
+
+// Animation LOD: the far instances are sampled less often, and with fewer joints.
+// If a budget is given, the periods are doubled, starting from the farthest instances,
+// until the time expected for SampleAll() fits in it.
+struct AnimLODLevel {
+	float distance;		// the level is used from this distance on
+	int period;
+	int maxDepth;
+};
+
+class AnimLOD {
+  public:
+	std::vector<AnimLODLevel> levels;	// by increasing distance
+	float budget = 0.0f;	// ms per frame for SampleAll(), 0 for no limit
+	int maxPeriod = 16;
+
+	// sets period and maxDepth of the instances
+	void update(std::vector<SkeletalInstance> &instances);
+	// the time taken by SampleAll(), for the work it had to do
+	void measure(float ms, float work);
+	// work of an instance in the frames it is sampled, and in the ones it is interpolated
+	static float sampleWork(int nJoints) {return nJoints;}
+	static float interpolateWork(int nJoints) {return nJoints * 0.2f;}
+
+  private:
+	float msPerWork = 0.0f;
+	std::vector<int> order;
+	float expectedWork(SkeletalInstance &I);
+};
+
 class SkeletalAnimation {
 	
 	Animations *anims;
@@ -65,17 +270,62 @@ class SkeletalAnimation {
 	int NTMs;
 	std::vector<glm::mat4> oTMs;
 	std::vector<glm::mat4> TMs;
+	std::vector<glm::mat4> prevTMs;		// TMs of the previous sample
 	std::vector<glm::mat4> BaseTMs;
 	std::vector<glm::mat4> IBMs;
 	std::unordered_map<int,int> NidDec;
 
+	// the matrices are stored with the joints sorted parents first: parents[p] is where
+	// the parent of the joint in position p is (-1 for the roots), jointOf[p] its index
+	// in the skin, and ATsPos[i] the position of the joint of the tracks ATs[i]
+	std::vector<int> parents;
+	std::vector<int> jointOf;
+	std::vector<int> ATsPos;
+	// depth[p] is the number of ancestors of the joint in position p, and cut[p] the
+	// ancestor it follows when the joints are limited to a depth
+	std::vector<int> depth;
+	std::vector<int> cut;
+
+	// the tracks of each animation packed together, empty if they cannot be
+	std::vector<AnimClip> clips;
+	AnimPose poseA, poseB;
+
 
 	public:
 	void init(Animations *_anims, int _NAnims, std::string BaseTrackName, int SkinId = 0);
 	void cleanup();
 	std::vector<glm::mat4> *getTransformMatrices();
-	void Sample(AnimBlender &AB);
+	// maxDepth: only the joints up to this depth are computed, the deeper ones are
+	// skinned with the matrix of their ancestor at that depth (-1 for all)
+	void Sample(AnimBlender &AB, int maxDepth = -1);
+	// the pose of a blend graph over the clips of this skeleton
+	void Sample(AnimBlendGraph &G, int maxDepth = -1);
+	int getNAnimatedJoints() {return NATs;}
+	// 1 for the animated joints in the subtree of the glTF node, 0 for the others
+	std::vector<float> getSubtreeMask(int node);
+	// the matrices of getTransformMatrices(), written in out
+	void getTransformMatrices(glm::mat4 *out);
+	// the same, interpolated between the previous sample (alpha = 0) and the last one
+	void getTransformMatrices(glm::mat4 *out, float alpha);
+	// makes the previous sample equal to the last one
+	void resetInterpolation() {prevTMs = TMs;}
 	int getNTMs();
+	// samples all the instances on the jobs of JS, and packs their matrices in out, one
+	// skeleton after the other, ready to be copied to a buffer: the first of each is in
+	// firstMatrix. Each skeleton and each blender must be in only one instance
+	// If LOD is given, it sets the period and the joints of each instance first
+	static void SampleAll(JobSystem &JS, std::vector<SkeletalInstance> &instances, std::vector<glm::mat4> &out, AnimLOD *LOD = nullptr);
+	// compresses the clips: the keyframes are dropped while no joint moves more than
+	// tolerance (in the space of the skeleton root) from where the full clip puts it
+	void compress(float tolerance = 0.001f);
+
+	private:
+	// fills parents and jointOf, and returns the position of each joint of the skin
+	std::vector<int> sortJoints(GLTFModel *model);
+	// multiplies the local matrices M (sorted as the joints) along the hierarchy
+	void propagate(std::vector<glm::mat4> &M);
+	// TMs from the local matrices in BaseTMs, with the joints up to maxDepth
+	void buildMatrices(int maxDepth);
 };
 
 
@@ -83,54 +333,65 @@ class SkeletalAnimation {
 
 AnimTrack *Animations::getAnim(std::string N) {return GLTFanims[N];}
 
-void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float tin, int sf, int ef, bool loop) {
-	glm::vec3 T0, T1;
-	glm::quat Q0, Q1;
-	glm::vec3 S0, S1;
-
+// keyframes fi0 and fi1 around time tin, with the animation looping from sf to ef
+// (ef < 0 counts from the end), and the position alpha between them
+template <class TimeOf>
+static void AnimLocate(TimeOf time, int nKeyFrames, float tin, int sf, int ef, int *cursor,
+					   int &fi0, int &fi1, float &alpha) {
 	if(ef < 0) {
 		ef = ef + nKeyFrames + 1;
 	}
 	ef = ((ef < nKeyFrames) ? ef : nKeyFrames);
 	
-	float firstT = Frames[sf].time;
-	float lastT = (ef >= nKeyFrames) ? 2 * Frames[nKeyFrames-1].time - Frames[nKeyFrames-2].time : Frames[ef].time;
+	float firstT = time(sf);
+	float lastT = (ef >= nKeyFrames) ? 2 * time(nKeyFrames-1) - time(nKeyFrames-2) : time(ef);
 	float interT = lastT - firstT;
 	
 	float t = fmod(tin, interT) + firstT;
 	int srcl = sf, srcr = ef;
+	if((cursor != nullptr) && (*cursor >= sf) && (*cursor < ef) && (t >= time(*cursor))) {
+		// the cached keyframe, or one of the next two
+		for(int c = *cursor; (c < ef) && (c < *cursor + 3); c++) {
+			if(t <= ((c + 1 < ef) ? time(c + 1) : lastT)) {
+				srcl = srcr = c;
+				break;
+			}
+		}
+	}
 	while(srcl + 1 < srcr) {
 		int srctst = (srcr + srcl) >> 1;
-//std::cout << srcl << " " << srctst << " " << srcr << "\n";
-		if(t < Frames[srctst].time) {srcr = srctst;}
-		else if(t > ((srctst + 1 < ef) ? Frames[srctst + 1].time : lastT)) {srcl = srctst + 1;}
+		if(t < time(srctst)) {srcr = srctst;}
+		else if(t > ((srctst + 1 < ef) ? time(srctst + 1) : lastT)) {srcl = srctst + 1;}
 		else {srcl = srcr = srctst;}
 	}
-//std::cout << "Found: " << srcl << " " << srcr << " " << Frames[srcl].time << " " << t << " " << ((srcl + 1 < ef) ? Frames[srcl + 1].time : lastT) << "\n";
-	
+	if(cursor != nullptr) {
+		*cursor = srcl;
+	}
 
-	int fi0 = srcl;
-	int fi1 = (srcl + 1 < ef) ? (srcl + 1) : sf;
-	
-	AnimFrame F0 = Frames[fi0]; T0 = F0.T; Q0 = F0.Q; S0 = F0.S;
-	AnimFrame F1 = Frames[fi1]; T1 = F1.T; Q1 = F1.Q; S1 = F1.S;
-	float alpha = (t - F0.time) / (((fi0 + 1 < ef) ? F1.time : lastT) - F0.time);
-	
-//	std::cout << "alpha: " << alpha << "\n";
+	fi0 = srcl;
+	fi1 = (srcl + 1 < ef) ? (srcl + 1) : sf;
+	alpha = (t - time(fi0)) / (((fi0 + 1 < ef) ? time(fi1) : lastT) - time(fi0));
+}
 
-	T = T0 * (1.0f - alpha) + T1 * alpha;
-	Q = slerp(Q0, Q1, alpha);
-	S = S0 * (1.0f - alpha) + S1 * alpha;
-	
+void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float tin, int sf, int ef, bool loop, int *cursor) {
+	int fi0, fi1;
+	float alpha;
+	AnimLocate([this](int i) {return Frames[i].time;}, nKeyFrames, tin, sf, ef, cursor, fi0, fi1, alpha);
+
+	const AnimFrame &F0 = Frames[fi0];
+	const AnimFrame &F1 = Frames[fi1];
+	T = F0.T * (1.0f - alpha) + F1.T * alpha;
+	Q = slerp(F0.Q, F1.Q, alpha);
+	S = F0.S * (1.0f - alpha) + F1.S * alpha;
 }
 
-glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false) {
+glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false, int *cursor) {
 	glm::mat4 out = glm::mat4(1);
 	glm::vec3 T;
 	glm::quat Q;
 	glm::vec3 S;
 
-	getSampleTransforms(T, Q, S, tin, sf, ef, loop);
+	getSampleTransforms(T, Q, S, tin, sf, ef, loop, cursor);
 	
 
 //	std::cout << T.x << ", " << T.y << ", " << T.z << " || "
@@ -145,7 +406,8 @@ glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false) {
 	return out;
 }
 
-glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B) {
+glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B,
+						   int *cursorA, int *cursorB) {
 	if(B == nullptr) {
 		B = this;
 	}
@@ -154,8 +416,8 @@ glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, i
 	glm::quat Q, QA, QB;
 	glm::vec3 S, SA, SB;
 
-	getSampleTransforms(TA, QA, SA, tinA, sfA, efA, true);
-	B->getSampleTransforms(TB, QB, SB, tinB, sfB, efB, true);
+	getSampleTransforms(TA, QA, SA, tinA, sfA, efA, true, cursorA);
+	B->getSampleTransforms(TB, QB, SB, tinB, sfB, efB, true, cursorB);
 
 	T = TA * (1.0f - bf) + TB * bf;
 	Q = slerp(QA, QB, bf);
@@ -168,12 +430,419 @@ glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, i
 	return out;
 }
 
+void AnimPose::resize(int n) {
+	nJoints = n;
+	stride = (n + 3) & ~3;
+	data.assign(APC_COUNT * stride, 0.0f);
+	scratchClip = nullptr;
+}
+
+glm::mat4 AnimPose::getMatrix(int j) const {
+	return AnimPoseMatrix(data.data(), stride, j);
+}
+
+glm::mat4 AnimPoseMatrix(const float *pose, int stride, int j) {
+	const float *c = &pose[j];
+	glm::quat Q(c[APC_QW * stride], c[APC_QX * stride], c[APC_QY * stride], c[APC_QZ * stride]);
+	glm::mat3 R = glm::mat3_cast(Q);
+	glm::mat4 out;
+	out[0] = glm::vec4(R[0] * c[APC_SX * stride], 0.0f);
+	out[1] = glm::vec4(R[1] * c[APC_SY * stride], 0.0f);
+	out[2] = glm::vec4(R[2] * c[APC_SZ * stride], 0.0f);
+	out[3] = glm::vec4(c[APC_TX * stride], c[APC_TY * stride], c[APC_TZ * stride], 1.0f);
+	return out;
+}
+
+bool AnimClip::init(const std::vector<AnimTrack *> &tracks) {
+	if(tracks.empty()) {
+		return false;
+	}
+	nJoints = tracks.size();
+	nKeyFrames = tracks[0]->nKeyFrames;
+	for(AnimTrack *AT : tracks) {
+		if(AT->nKeyFrames != nKeyFrames) {
+			return false;
+		}
+		for(int k = 0; k < nKeyFrames; k++) {
+			if(AT->Frames[k].time != tracks[0]->Frames[k].time) {
+				return false;
+			}
+		}
+	}
+
+	stride = (nJoints + 3) & ~3;
+	times.resize(nKeyFrames);
+	// the padding lanes hold an identity transform, so they never divide by zero
+	data.assign((size_t)nKeyFrames * APC_COUNT * stride, 0.0f);
+	for(int k = 0; k < nKeyFrames; k++) {
+		times[k] = tracks[0]->Frames[k].time;
+		float *P = &data[(size_t)k * APC_COUNT * stride];
+		for(int j = 0; j < stride; j++) {
+			AnimFrame F = {0.0f, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f)};
+			if(j < nJoints) {
+				F = tracks[j]->Frames[k];
+			}
+			P[APC_TX * stride + j] = F.T.x;
+			P[APC_TY * stride + j] = F.T.y;
+			P[APC_TZ * stride + j] = F.T.z;
+			P[APC_QX * stride + j] = F.Q.x;
+			P[APC_QY * stride + j] = F.Q.y;
+			P[APC_QZ * stride + j] = F.Q.z;
+			P[APC_QW * stride + j] = F.Q.w;
+			P[APC_SX * stride + j] = F.S.x;
+			P[APC_SY * stride + j] = F.S.y;
+			P[APC_SZ * stride + j] = F.S.z;
+		}
+	}
+	return true;
+}
+
+void AnimClip::Sample(AnimPose &out, float t, int sf, int ef, int *cursor) const {
+	int fi0, fi1;
+	float alpha;
+	AnimLocate([this](int i) {return times[i];}, nKeyFrames, t, sf, ef, cursor, fi0, fi1, alpha);
+
+	if(out.nJoints != nJoints) {
+		out.resize(nJoints);
+	}
+	const size_t poseSize = (size_t)APC_COUNT * stride;
+	if(!compressed) {
+		AnimPoseMix(&data[fi0 * poseSize], &data[fi1 * poseSize], alpha, out.data.data(), stride);
+		return;
+	}
+
+	out.scratch.resize(4 * poseSize);
+	float *K0 = &out.scratch[0], *K1 = &out.scratch[poseSize], *tmp = &out.scratch[2 * poseSize];
+	int kk = keyRef[fi0];
+	if((fi1 == fi0 + 1) && (kk + 1 < (int)keptKeys.size()) && (keptKeys[kk + 1] >= fi1)) {
+		// both between the same two kept keyframes: interpolated from them directly
+		int k0 = keptKeys[kk], k1 = keptKeys[kk + 1];
+		float tk = times[fi0] + alpha * (times[fi1] - times[fi0]);
+		if((out.scratchClip != this) || (out.scratchKept != kk)) {
+			decodeKept(kk, K0);
+			decodeKept(kk + 1, K1);
+			out.scratchClip = this;
+			out.scratchKept = kk;
+		}
+		AnimPoseMix(K0, K1, (tk - times[k0]) / (times[k1] - times[k0]), out.data.data(), stride);
+	} else {
+		decodeKeyFrame(fi0, K0, tmp);
+		decodeKeyFrame(fi1, K1, tmp);
+		out.scratchClip = nullptr;
+		AnimPoseMix(K0, K1, alpha, out.data.data(), stride);
+	}
+}
+
+// smallest three: the largest component is dropped (and made positive, since q and -q
+// are the same rotation), and the others, in [-1/sqrt(2), 1/sqrt(2)], get 15 bits each;
+// the index of the dropped one is in the top bits of the first two
+static void AnimQuatEncode(glm::quat Q, uint16_t *out, int stride) {
+	float c[4] = {Q.x, Q.y, Q.z, Q.w};
+	int m = 0;
+	for(int i = 1; i < 4; i++) {
+		if(std::abs(c[i]) > std::abs(c[m])) m = i;
+	}
+	float sign = (c[m] < 0.0f) ? -1.0f : 1.0f;
+	for(int i = 0, o = 0; i < 4; i++) {
+		if(i == m) continue;
+		float v = (c[i] * sign * 0.70710678f + 0.5f) * 32767.0f + 0.5f;
+		out[o * stride] = (uint16_t)std::max(0.0f, std::min(v, 32767.0f));
+		o++;
+	}
+	out[0] |= (m & 1) << 15;
+	out[stride] |= (m >> 1) << 15;
+}
+
+void AnimClip::quantize() {
+	if(compressed) {
+		return;
+	}
+	// per joint range of each translation and scale component
+	const int tsComp[6] = {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ};
+	const int tsQuant[6] = {AQC_TX, AQC_TY, AQC_TZ, AQC_SX, AQC_SY, AQC_SZ};
+	const size_t poseSize = (size_t)APC_COUNT * stride;
+	qRange.assign(12 * stride, 0.0f);
+	for(int c = 0; c < 6; c++) {
+		for(int j = 0; j < stride; j++) {
+			float minV = data[tsComp[c] * stride + j], maxV = minV;
+			for(int k = 1; k < nKeyFrames; k++) {
+				float v = data[k * poseSize + tsComp[c] * stride + j];
+				minV = std::min(minV, v);
+				maxV = std::max(maxV, v);
+			}
+			qRange[(2 * c) * stride + j] = minV;
+			qRange[(2 * c + 1) * stride + j] = (maxV - minV) / 65535.0f;
+		}
+	}
+
+	qData.resize((size_t)nKeyFrames * AQC_COUNT * stride);
+	for(int k = 0; k < nKeyFrames; k++) {
+		const float *P = &data[k * poseSize];
+		uint16_t *Q = &qData[(size_t)k * AQC_COUNT * stride];
+		for(int c = 0; c < 6; c++) {
+			for(int j = 0; j < stride; j++) {
+				float scale = qRange[(2 * c + 1) * stride + j];
+				float v = (scale > 0.0f) ? (P[tsComp[c] * stride + j] - qRange[(2 * c) * stride + j]) / scale : 0.0f;
+				Q[tsQuant[c] * stride + j] = (uint16_t)std::max(0.0f, std::min(v + 0.5f, 65535.0f));
+			}
+		}
+		for(int j = 0; j < stride; j++) {
+			glm::quat q(P[APC_QW * stride + j], P[APC_QX * stride + j], P[APC_QY * stride + j], P[APC_QZ * stride + j]);
+			AnimQuatEncode(q, &Q[AQC_Q0 * stride + j], stride);
+		}
+	}
+	keyRef.resize(nKeyFrames);
+	keptKeys.resize(nKeyFrames);
+	for(int k = 0; k < nKeyFrames; k++) {
+		keyRef[k] = keptKeys[k] = k;
+	}
+	compressed = true;
+}
+
+void AnimClip::dropKeyFrames(const std::vector<bool> &keep) {
+	const size_t qSize = (size_t)AQC_COUNT * stride;
+	std::vector<int> kept;
+	for(int k = 0; k < nKeyFrames; k++) {
+		// the first one is always kept, so that each keyframe has one before
+		if(keep[k] || (k == 0)) {
+			int kk = keyRef[k];
+			std::copy(qData.begin() + kk * qSize, qData.begin() + (kk + 1) * qSize, qData.begin() + kept.size() * qSize);
+			kept.push_back(k);
+		}
+		keyRef[k] = kept.size() - 1;
+	}
+	keptKeys = kept;
+	qData.resize(kept.size() * qSize);
+	qData.shrink_to_fit();
+	data.clear();
+	data.shrink_to_fit();
+}
+
+void AnimClip::decodeKept(int kk, float *out) const {
+	const uint16_t *Q = &qData[(size_t)kk * AQC_COUNT * stride];
+	const int tsComp[6] = {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ};
+	const int tsQuant[6] = {AQC_TX, AQC_TY, AQC_TZ, AQC_SX, AQC_SY, AQC_SZ};
+	for(int c = 0; c < 6; c++) {
+		const float *offset = &qRange[(2 * c) * stride], *scale = &qRange[(2 * c + 1) * stride];
+		const uint16_t *in = &Q[tsQuant[c] * stride];
+		float *o = &out[tsComp[c] * stride];
+		for(int j = 0; j < stride; j++) {
+			o[j] = offset[j] + scale[j] * in[j];
+		}
+	}
+	// where the three stored components go, for each dropped one
+	static const int slots[4][4] = {{1, 2, 3, 0}, {0, 2, 3, 1}, {0, 1, 3, 2}, {0, 1, 2, 3}};
+	for(int j = 0; j < stride; j++) {
+		uint16_t a = Q[AQC_Q0 * stride + j], b = Q[AQC_Q1 * stride + j], c = Q[AQC_Q2 * stride + j];
+		const int *slot = slots[(a >> 15) | ((b >> 15) << 1)];
+		float v[4];
+		v[slot[0]] = (a & 0x7fff) * (1.41421356f / 32767.0f) - 0.70710678f;
+		v[slot[1]] = (b & 0x7fff) * (1.41421356f / 32767.0f) - 0.70710678f;
+		v[slot[2]] = (c & 0x7fff) * (1.41421356f / 32767.0f) - 0.70710678f;
+		v[slot[3]] = std::sqrt(std::max(0.0f, 1.0f - v[slot[0]] * v[slot[0]] - v[slot[1]] * v[slot[1]] - v[slot[2]] * v[slot[2]]));
+		for(int i = 0; i < 4; i++) {
+			out[(APC_QX + i) * stride + j] = v[i];
+		}
+	}
+}
+
+void AnimClip::decodeKeyFrame(int k, float *out, float *tmp) const {
+	int kk = keyRef[k];
+	int k0 = keptKeys[kk];
+	decodeKept(kk, out);
+	if((k0 != k) && (kk + 1 < (int)keptKeys.size())) {
+		int k1 = keptKeys[kk + 1];
+		decodeKept(kk + 1, tmp);
+		AnimPoseMix(out, tmp, (times[k] - times[k0]) / (times[k1] - times[k0]), out, stride);
+	}
+}
+
+size_t AnimClip::getMemorySize() const {
+	return sizeof(AnimClip) + times.size() * sizeof(float) + data.size() * sizeof(float) +
+		   qData.size() * sizeof(uint16_t) + qRange.size() * sizeof(float) +
+		   (keyRef.size() + keptKeys.size()) * sizeof(int);
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ANIM_SSE2_POSE
+#endif
+
+#ifdef ANIM_SSE2_POSE
+// joints j to j + 3 of out = a * (1 - W) + b * W, with nlerp for the rotations
+static inline void AnimMix4(const float *a, const float *b, __m128 W, float *out, int stride, int j) {
+	const __m128 IW = _mm_sub_ps(_mm_set1_ps(1.0f), W);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	for(int c : {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ}) {
+		__m128 va = _mm_loadu_ps(a + c * stride + j), vb = _mm_loadu_ps(b + c * stride + j);
+		_mm_storeu_ps(out + c * stride + j, _mm_add_ps(_mm_mul_ps(va, IW), _mm_mul_ps(vb, W)));
+	}
+	__m128 qa[4], qb[4];
+	for(int i = 0; i < 4; i++) {
+		qa[i] = _mm_loadu_ps(a + (APC_QX + i) * stride + j);
+		qb[i] = _mm_loadu_ps(b + (APC_QX + i) * stride + j);
+	}
+	// b is flipped to the same hemisphere as a, for the shortest path
+	__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qa[0], qb[0]), _mm_mul_ps(qa[1], qb[1])),
+						  _mm_add_ps(_mm_mul_ps(qa[2], qb[2]), _mm_mul_ps(qa[3], qb[3])));
+	__m128 WB = _mm_xor_ps(W, _mm_and_ps(d, signBit));
+	__m128 q[4], l2 = _mm_setzero_ps();
+	for(int i = 0; i < 4; i++) {
+		q[i] = _mm_add_ps(_mm_mul_ps(qa[i], IW), _mm_mul_ps(qb[i], WB));
+		l2 = _mm_add_ps(l2, _mm_mul_ps(q[i], q[i]));
+	}
+	__m128 il = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(l2));
+	for(int i = 0; i < 4; i++) {
+		_mm_storeu_ps(out + (APC_QX + i) * stride + j, _mm_mul_ps(q[i], il));
+	}
+}
+#else
+static inline void AnimMix1(const float *a, const float *b, float w, float *out, int stride, int j) {
+	for(int c : {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ}) {
+		out[c * stride + j] = a[c * stride + j] * (1.0f - w) + b[c * stride + j] * w;
+	}
+	float d = 0.0f;
+	for(int i = APC_QX; i <= APC_QW; i++) {
+		d += a[i * stride + j] * b[i * stride + j];
+	}
+	float wb = (d < 0.0f) ? -w : w;
+	float q[4], l2 = 0.0f;
+	for(int i = 0; i < 4; i++) {
+		q[i] = a[(APC_QX + i) * stride + j] * (1.0f - w) + b[(APC_QX + i) * stride + j] * wb;
+		l2 += q[i] * q[i];
+	}
+	float il = 1.0f / std::sqrt(l2);
+	for(int i = 0; i < 4; i++) {
+		out[(APC_QX + i) * stride + j] = q[i] * il;
+	}
+}
+#endif
+
+void AnimPoseMix(const float *a, const float *b, float w, float *out, int stride) {
+#ifdef ANIM_SSE2_POSE
+	// four joints at a time
+	const __m128 W = _mm_set1_ps(w);
+	for(int j = 0; j < stride; j += 4) {
+		AnimMix4(a, b, W, out, stride, j);
+	}
+#else
+	for(int j = 0; j < stride; j++) {
+		AnimMix1(a, b, w, out, stride, j);
+	}
+#endif
+}
+
+void AnimPoseMixWeights(const float *a, const float *b, const float *w, float *out, int stride) {
+#ifdef ANIM_SSE2_POSE
+	for(int j = 0; j < stride; j += 4) {
+		AnimMix4(a, b, _mm_loadu_ps(w + j), out, stride, j);
+	}
+#else
+	for(int j = 0; j < stride; j++) {
+		AnimMix1(a, b, w[j], out, stride, j);
+	}
+#endif
+}
+
+void AnimPoseAdd(const float *base, const float *layer, const float *ref, const float *w, float *out, int stride) {
+#ifdef ANIM_SSE2_POSE
+	const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+	for(int j = 0; j < stride; j += 4) {
+		__m128 W = _mm_loadu_ps(w + j);
+		for(int c : {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ}) {
+			__m128 r = (ref != nullptr) ? _mm_loadu_ps(ref + c * stride + j) : ((c >= APC_SX) ? one : zero);
+			__m128 d = _mm_sub_ps(_mm_loadu_ps(layer + c * stride + j), r);
+			_mm_storeu_ps(out + c * stride + j, _mm_add_ps(_mm_loadu_ps(base + c * stride + j), _mm_mul_ps(d, W)));
+		}
+		// delta = conj(ref) * layer, as x, y, z, w
+		__m128 l[4], d[4];
+		for(int i = 0; i < 4; i++) {
+			l[i] = _mm_loadu_ps(layer + (APC_QX + i) * stride + j);
+		}
+		if(ref != nullptr) {
+			__m128 r[4];
+			for(int i = 0; i < 4; i++) {
+				r[i] = _mm_loadu_ps(ref + (APC_QX + i) * stride + j);
+			}
+			d[3] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[3], l[3]), _mm_mul_ps(r[0], l[0])),
+							  _mm_add_ps(_mm_mul_ps(r[1], l[1]), _mm_mul_ps(r[2], l[2])));
+			d[0] = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r[3], l[0]), _mm_mul_ps(r[2], l[1])),
+							  _mm_add_ps(_mm_mul_ps(r[0], l[3]), _mm_mul_ps(r[1], l[2])));
+			d[1] = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r[3], l[1]), _mm_mul_ps(r[0], l[2])),
+							  _mm_add_ps(_mm_mul_ps(r[1], l[3]), _mm_mul_ps(r[2], l[0])));
+			d[2] = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r[3], l[2]), _mm_mul_ps(r[1], l[0])),
+							  _mm_add_ps(_mm_mul_ps(r[2], l[3]), _mm_mul_ps(r[0], l[1])));
+		} else {
+			for(int i = 0; i < 4; i++) {
+				d[i] = l[i];
+			}
+		}
+		// nlerp from the identity to the delta, on the side of the identity
+		__m128 WD = _mm_xor_ps(W, _mm_and_ps(d[3], _mm_set1_ps(-0.0f)));
+		__m128 IW = _mm_sub_ps(one, W);
+		for(int i = 0; i < 3; i++) {
+			d[i] = _mm_mul_ps(d[i], WD);
+		}
+		d[3] = _mm_add_ps(IW, _mm_mul_ps(d[3], WD));
+		__m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])),
+							   _mm_add_ps(_mm_mul_ps(d[2], d[2]), _mm_mul_ps(d[3], d[3])));
+		__m128 il = _mm_div_ps(one, _mm_sqrt_ps(l2));
+		// out = base * delta
+		__m128 b[4];
+		for(int i = 0; i < 4; i++) {
+			b[i] = _mm_loadu_ps(base + (APC_QX + i) * stride + j);
+			d[i] = _mm_mul_ps(d[i], il);
+		}
+		__m128 q[4];
+		q[3] = _mm_sub_ps(_mm_mul_ps(b[3], d[3]), _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], d[0]), _mm_mul_ps(b[1], d[1])), _mm_mul_ps(b[2], d[2])));
+		q[0] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[3], d[0]), _mm_mul_ps(b[0], d[3])), _mm_sub_ps(_mm_mul_ps(b[1], d[2]), _mm_mul_ps(b[2], d[1])));
+		q[1] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[3], d[1]), _mm_mul_ps(b[1], d[3])), _mm_sub_ps(_mm_mul_ps(b[2], d[0]), _mm_mul_ps(b[0], d[2])));
+		q[2] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[3], d[2]), _mm_mul_ps(b[2], d[3])), _mm_sub_ps(_mm_mul_ps(b[0], d[1]), _mm_mul_ps(b[1], d[0])));
+		for(int i = 0; i < 4; i++) {
+			_mm_storeu_ps(out + (APC_QX + i) * stride + j, q[i]);
+		}
+	}
+#else
+	for(int j = 0; j < stride; j++) {
+		for(int c : {APC_TX, APC_TY, APC_TZ, APC_SX, APC_SY, APC_SZ}) {
+			float r = (ref != nullptr) ? ref[c * stride + j] : ((c >= APC_SX) ? 1.0f : 0.0f);
+			out[c * stride + j] = base[c * stride + j] + (layer[c * stride + j] - r) * w[j];
+		}
+		glm::quat L(layer[APC_QW * stride + j], layer[APC_QX * stride + j], layer[APC_QY * stride + j], layer[APC_QZ * stride + j]);
+		glm::quat B(base[APC_QW * stride + j], base[APC_QX * stride + j], base[APC_QY * stride + j], base[APC_QZ * stride + j]);
+		glm::quat D = L;
+		if(ref != nullptr) {
+			D = glm::conjugate(glm::quat(ref[APC_QW * stride + j], ref[APC_QX * stride + j], ref[APC_QY * stride + j], ref[APC_QZ * stride + j])) * L;
+		}
+		float wd = (D.w < 0.0f) ? -w[j] : w[j];
+		D = glm::normalize(glm::quat(1.0f - w[j] + D.w * wd, D.x * wd, D.y * wd, D.z * wd));
+		glm::quat Q = B * D;
+		out[APC_QX * stride + j] = Q.x;
+		out[APC_QY * stride + j] = Q.y;
+		out[APC_QZ * stride + j] = Q.z;
+		out[APC_QW * stride + j] = Q.w;
+	}
+#endif
+}
+
 void AnimBlender::init(std::vector<AnimBlendSegment> seg) {
 	segments = seg;
 	blending = false;
 	cur = 0;
 	prev = 0;
 	blendTime = 0;
+	cursors.clear();
+}
+
+int *AnimBlender::getCursor(int slot, int seg) {
+	if(slot < 0) {
+		return nullptr;
+	}
+	size_t id = (size_t)slot * segments.size() + seg;
+	if(id >= cursors.size()) {
+		cursors.resize(id + 1, -1);
+	}
+	return &cursors[id];
 }
 
 void AnimBlender::Advance(float dt) {
@@ -202,139 +871,458 @@ void AnimBlender::Start(int seg, float blendT) {
 	}
 }
 
-glm::mat4 AnimBlender::Sample(AnimTrack *AT, AnimTrack *AT2) {
+glm::mat4 AnimBlender::Sample(AnimTrack *AT, AnimTrack *AT2, int slot) {
 	if(AT2 == nullptr) {
 		AT2 = AT;
 	}
 	if(blending) {
-		return AT->Blend(1.0f - blendPos / blendTime, segments[cur].t, segments[cur].st, segments[cur].en, segments[prev].t, segments[prev].st, segments[prev].en, AT2);
+		return AT->Blend(1.0f - blendPos / blendTime, segments[cur].t, segments[cur].st, segments[cur].en, segments[prev].t, segments[prev].st, segments[prev].en, AT2,
+						 getCursor(slot, cur), getCursor(slot, prev));
 	} else {
-		return AT->Sample(segments[cur].t, segments[cur].st, segments[cur].en);
+		return AT->Sample(segments[cur].t, segments[cur].st, segments[cur].en, false, getCursor(slot, cur));
 	}
 }
 
-glm::mat4 AnimBlender::Sample(std::vector<AnimTrack *> *AT) {
-	return Sample((*AT)[segments[cur].clip], (*AT)[segments[prev].clip]);
+glm::mat4 AnimBlender::Sample(std::vector<AnimTrack *> *AT, int slot) {
+	return Sample((*AT)[segments[cur].clip], (*AT)[segments[prev].clip], slot);
+}
+
+int AnimBlendGraph::addClip(int clip, int st, int en, float speed) {
+	AnimBlendNode N;
+	N.type = ABN_CLIP;
+	N.clip = clip;
+	N.st = st;
+	N.en = en;
+	N.speed = speed;
+	nodes.push_back(N);
+	return root = nodes.size() - 1;
 }
 
+int AnimBlendGraph::addBlend(std::vector<int> children, std::vector<float> weights) {
+	AnimBlendNode N;
+	N.type = ABN_BLEND;
+	N.children = children;
+	N.weights = weights;
+	N.weights.resize(children.size(), 0.0f);
+	nodes.push_back(N);
+	return root = nodes.size() - 1;
+}
 
-void Animations::init(AssetFile &A) {
-	AF = &A;
-	
-	if(A.getType() != GLTF) {
-		std::cout << "Error: Animations supported only in GLTF assets\n";
-		exit(0);
+int AnimBlendGraph::addAdditive(int base, int layer, int reference, float weight) {
+	AnimBlendNode N;
+	N.type = ABN_ADDITIVE;
+	N.children = {base, layer};
+	if(reference >= 0) {
+		N.children.push_back(reference);
 	}
-	
-	tinygltf::Model *model = A.getGLTFmodel();
-	
-	for (const auto& anim :  model->animations) {
-		std::cout << " Anim. Name:" << anim.name << 
-		" Channels: " << anim.channels.size() << " Samplers: " << anim.samplers.size() << "\n";
-		
-		std::unordered_map<int, const float *>Trans;
-		std::unordered_map<int, const float *>Rot;
-		std::unordered_map<int, const float *>Scale;
-		const float *Time = nullptr;
-		int nKeyFrames = 0;
-		int targetNode;
-		std::unordered_map<int, bool> nodeIds;
-
-		// Find animation channels
-		for(const auto& chan: anim.channels) {
-//			std::cout << chan.target_path << " Node: " << chan.target_node << " Sampler: " << chan.sampler << " input: " << anim.samplers[chan.sampler].input << " output: " << anim.samplers[chan.sampler].output <<"\n";
-			
-			if(Time == nullptr) {			
-				const tinygltf::Accessor &inAccessor = model->accessors[anim.samplers[chan.sampler].input];
-				const tinygltf::BufferView &inView = model->bufferViews[inAccessor.bufferView];
-				const float *inVals = reinterpret_cast<const float *>(&(model->buffers[inView.buffer].data[inAccessor.byteOffset + inView.byteOffset]));
-				int cntIn = inAccessor.count;
-				
-				Time = inVals;
-				nKeyFrames = cntIn;
-//std::cout << "nKeyFrames: " << nKeyFrames << "\n";
-/*std::cout << "Read time:\n";
-for(int cct = 0; cct < nKeyFrames; cct++) {
-std::cout << Time[cct] << ",";
-}
-std::cout << "\n";*/
+	N.weights = {weight};
+	nodes.push_back(N);
+	return root = nodes.size() - 1;
+}
+
+void AnimBlendGraph::setMask(int node, const std::vector<float> &mask) {
+	AnimBlendNode &N = nodes[node];
+	N.mask = mask;
+	if(!mask.empty()) {
+		// padded to the joints of the poses, if they are already allocated
+		N.mask.resize(std::max(mask.size(), N.laneW.size()), 0.0f);
+	}
+}
+
+void AnimBlendGraph::init(int n) {
+	nJoints = n;
+	for(auto &N : nodes) {
+		N.pose.resize(n);
+		// room for the two keyframes decoded from compressed clips
+		N.pose.scratch.resize(4 * APC_COUNT * N.pose.stride);
+		N.laneW.assign(N.pose.stride, 0.0f);
+		N.laneSum.assign(N.pose.stride, 0.0f);
+		if(!N.mask.empty()) {
+			N.mask.resize(N.pose.stride, 0.0f);
+		}
+	}
+}
+
+void AnimBlendGraph::Advance(float dt) {
+	for(auto &N : nodes) {
+		N.t += dt * N.speed;
+	}
+}
+
+// weight w of the node, for each joint
+const float *AnimBlendGraph::laneWeights(AnimBlendNode &N, float w) {
+	for(size_t j = 0; j < N.laneW.size(); j++) {
+		N.laneW[j] = N.mask.empty() ? w : w * N.mask[j];
+	}
+	return N.laneW.data();
+}
+
+void AnimBlendGraph::evaluateNode(int n, const std::vector<AnimClip> &clips) {
+	AnimBlendNode &N = nodes[n];
+	float *out = N.pose.data.data();
+	int stride = N.pose.stride;
+
+	switch(N.type) {
+	  case ABN_CLIP:
+		clips[N.clip].Sample(N.pose, N.t, N.st, N.en, &N.cursor);
+		break;
+	  case ABN_BLEND: {
+		// running average: each child is mixed in with its share of the weights so far
+		bool first = true;
+		for(size_t c = 0; c < N.children.size(); c++) {
+			if((N.weights[c] <= 0.0f) && !(first && (c == N.children.size() - 1))) {
+				continue;
 			}
-			targetNode = chan.target_node;
-			nodeIds[targetNode] = true;
-
-			const tinygltf::Accessor &outAccessor = model->accessors[anim.samplers[chan.sampler].output];
-			const tinygltf::BufferView &outView = model->bufferViews[outAccessor.bufferView];
-			const float *outVals = reinterpret_cast<const float *>(&(model->buffers[outView.buffer].data[outAccessor.byteOffset + outView.byteOffset]));
-			int cntOut = outAccessor.count;
-						
-			if(chan.target_path == "translation") {
-//				std::cout << "Has translation\n";
-				if(cntOut != nKeyFrames) {
-					std::cout << "Number of Keyframes error: " << cntOut << " != " << nKeyFrames << "\n";
-					exit(0);
+			evaluateNode(N.children[c], clips);
+			const float *P = nodes[N.children[c]].pose.data.data();
+			const float *W = laneWeights(N, N.weights[c]);
+			if(first) {
+				std::copy(P, P + APC_COUNT * stride, out);
+				std::copy(W, W + stride, N.laneSum.begin());
+				first = false;
+			} else {
+				for(int j = 0; j < stride; j++) {
+					float sum = N.laneSum[j] + W[j];
+					N.laneSum[j] = sum;
+					N.laneW[j] = (sum > 0.0f) ? W[j] / sum : 0.0f;
 				}
-				Trans[targetNode] = outVals;
+				AnimPoseMixWeights(out, P, N.laneW.data(), out, stride);
 			}
+		}
+		break;
+	  }
+	  case ABN_ADDITIVE: {
+		evaluateNode(N.children[0], clips);
+		const float *B = nodes[N.children[0]].pose.data.data();
+		if(N.weights[0] <= 0.0f) {
+			std::copy(B, B + APC_COUNT * stride, out);
+			break;
+		}
+		evaluateNode(N.children[1], clips);
+		const float *R = nullptr;
+		if(N.children.size() > 2) {
+			evaluateNode(N.children[2], clips);
+			R = nodes[N.children[2]].pose.data.data();
+		}
+		AnimPoseAdd(B, nodes[N.children[1]].pose.data.data(), R, laneWeights(N, N.weights[0]), out, stride);
+		break;
+	  }
+	}
+}
 
-			if(chan.target_path == "rotation") {
-//				std::cout << "Has rotation\n";
-				if(cntOut != nKeyFrames) {
-					std::cout << "Number of Keyframes error: " << cntOut << " != " << nKeyFrames << "\n";
-					exit(0);
-				}
-				Rot[targetNode] = outVals;
+const AnimPose &AnimBlendGraph::Evaluate(const std::vector<AnimClip> &clips) {
+	if(!clips.empty() && (nJoints != clips[0].nJoints)) {
+		init(clips[0].nJoints);
+	}
+	evaluateNode(root, clips);
+	return nodes[root].pose;
+}
+
+
+enum AnimChannelPath {ACP_TRANSLATION, ACP_ROTATION, ACP_SCALE};
+
+// one channel of a glTF animation, read as floats
+struct AnimChannel {
+	int node;
+	AnimChannelPath path;
+	int comps;				// 3 for translation and scale, 4 for rotation
+	int interpolation;		// 0 linear, 1 step, 2 cubic spline
+	int nKeyFrames;
+	std::vector<float> times;
+	std::vector<float> values;	// in, value and out tangents per keyframe for splines
+};
+
+// value of channel C at time t (held before the first keyframe and after the last),
+// with cursor moving forward as t does
+static void AnimChannelValue(const AnimChannel &C, float t, int &cursor, float *out) {
+	const int n = C.nKeyFrames, comps = C.comps, step = (C.interpolation == 2) ? 3 : 1;
+	const int v = (C.interpolation == 2) ? comps : 0;	// the value, after the in tangent
+	if(cursor < 0) {
+		cursor = 0;
+	}
+	while((cursor + 1 < n) && (C.times[cursor + 1] <= t)) {
+		cursor++;
+	}
+	int k = cursor;
+	const float *V0 = &C.values[k * step * comps];
+	if((k + 1 >= n) || (t <= C.times[k]) || (C.interpolation == 1)) {
+		std::copy(V0 + v, V0 + v + comps, out);
+		return;
+	}
+	const float *V1 = &C.values[(k + 1) * step * comps];
+	float td = C.times[k + 1] - C.times[k];
+	float s = (t - C.times[k]) / td;
+
+	if(C.interpolation == 2) {
+		// Hermite, with the out tangent of k and the in tangent of k + 1
+		float s2 = s * s, s3 = s2 * s;
+		for(int c = 0; c < comps; c++) {
+			out[c] = (2 * s3 - 3 * s2 + 1) * V0[comps + c] + (s3 - 2 * s2 + s) * td * V0[2 * comps + c] +
+					 (-2 * s3 + 3 * s2) * V1[comps + c] + (s3 - s2) * td * V1[c];
+		}
+	} else if(C.path == ACP_ROTATION) {
+		glm::quat Q = glm::slerp(glm::quat(V0[3], V0[0], V0[1], V0[2]), glm::quat(V1[3], V1[0], V1[1], V1[2]), s);
+		out[0] = Q.x; out[1] = Q.y; out[2] = Q.z; out[3] = Q.w;
+		return;
+	} else {
+		for(int c = 0; c < comps; c++) {
+			out[c] = V0[c] + (V1[c] - V0[c]) * s;
+		}
+	}
+	if(C.path == ACP_ROTATION) {
+		float l = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2] + out[3] * out[3]);
+		for(int c = 0; c < 4; c++) {
+			out[c] /= l;
+		}
+	}
+}
+
+struct AnimImportJob {
+	GLTFModel *model;
+	// the tracks made from each animation, with their names
+	std::vector<std::vector<std::pair<std::string, AnimTrack *>>> tracks;
+	// messages of each animation, printed by the calling thread
+	std::vector<std::string> notes;
+};
+
+// Converts the animations from first to last - 1. Each channel can have its own
+// keyframe times: all the tracks of an animation are resampled at the union of the
+// times of its channels, so they can be packed together in an AnimClip. Tracks are
+// interpolated linearly, so the union also gets a key just before each change of a
+// STEP channel, that keeps the jump, and three keys inside each segment of a
+// CUBICSPLINE channel, that follow its curve.
+static void AnimImportRange(int first, int last, void *params) {
+	AnimImportJob *J = (AnimImportJob *)params;
+	GLTFModel *model = J->model;
+
+	for(int a = first; a < last; a++) {
+		const tinygltf::Animation &anim = model->animations[a];
+		std::vector<AnimChannel> channels;
+		std::vector<int> nodes;
+		int sharedInput = -2;
+		int stepChannels = 0, splineChannels = 0;
+		std::ostringstream notes;
+
+		for(const auto &chan : anim.channels) {
+			AnimChannel C;
+			if(chan.target_path == "translation") {
+				C.path = ACP_TRANSLATION;
+			} else if(chan.target_path == "rotation") {
+				C.path = ACP_ROTATION;
+			} else if(chan.target_path == "scale") {
+				C.path = ACP_SCALE;
+			} else {
+				// morph target weights are not supported
+				continue;
+			}
+			const tinygltf::AnimationSampler &smp = anim.samplers[chan.sampler];
+			const tinygltf::Accessor &inAccessor = model->accessors[smp.input];
+			const tinygltf::Accessor &outAccessor = model->accessors[smp.output];
+			C.node = chan.target_node;
+			C.comps = (C.path == ACP_ROTATION) ? 4 : 3;
+			C.interpolation = (smp.interpolation == "STEP") ? 1 : ((smp.interpolation == "CUBICSPLINE") ? 2 : 0);
+			C.nKeyFrames = inAccessor.count;
+			if((C.nKeyFrames == 0) || (outAccessor.count != (size_t)C.nKeyFrames * ((C.interpolation == 2) ? 3 : 1))) {
+				notes << "Number of Keyframes error in " << anim.name << ": " << outAccessor.count << " values for " << C.nKeyFrames << " times\n";
+				continue;
+			}
+
+			C.times.resize(C.nKeyFrames);
+			GLTFgatherFloat(model, inAccessor, 0, C.nKeyFrames, (unsigned char *)C.times.data(), sizeof(float), 1);
+			// rotations can be normalized integers (KHR_mesh_quantization)
+			C.values.resize(outAccessor.count * C.comps);
+			GLTFgatherFloat(model, outAccessor, 0, outAccessor.count, (unsigned char *)C.values.data(),
+							C.comps * sizeof(float), C.comps);
+
+			sharedInput = ((sharedInput == -2) || (sharedInput == smp.input)) ? smp.input : -1;
+			stepChannels += (C.interpolation == 1);
+			splineChannels += (C.interpolation == 2);
+			if(std::find(nodes.begin(), nodes.end(), C.node) == nodes.end()) {
+				nodes.push_back(C.node);
 			}
+			channels.push_back(std::move(C));
+		}
+		if(stepChannels + splineChannels > 0) {
+			notes << anim.name << ": " << stepChannels << " STEP and " << splineChannels
+				  << " CUBICSPLINE channels resampled, with linear interpolation between the new keys\n";
+			sharedInput = -1;
+		}
+		J->notes[a] = notes.str();
+		if(channels.empty()) {
+			continue;
+		}
 
-			if(chan.target_path == "scale") {
-//				std::cout << "Has scale\n";
-				if(cntOut != nKeyFrames) {
-					std::cout << "Number of Keyframes error: " << cntOut << " != " << nKeyFrames << "\n";
-					exit(0);
+		// the keyframe times of all the tracks
+		std::vector<float> times;
+		if(sharedInput >= 0) {
+			times = channels[0].times;
+		} else {
+			// before a step, the key holding the old value: far enough not to be merged below
+			const float stepEps = 1e-3f;
+			for(const AnimChannel &C : channels) {
+				times.insert(times.end(), C.times.begin(), C.times.end());
+				for(int k = 1; k < C.nKeyFrames; k++) {
+					float t0 = C.times[k - 1], t1 = C.times[k];
+					if(C.interpolation == 1) {
+						const float *V = &C.values[k * C.comps];
+						if((t1 - stepEps > t0) && !std::equal(V, V + C.comps, V - C.comps)) {
+							times.push_back(t1 - stepEps);
+						}
+					} else if(C.interpolation == 2) {
+						for(int q = 1; q < 4; q++) {
+							times.push_back(t0 + (t1 - t0) * q / 4.0f);
+						}
+					}
 				}
-				Scale[targetNode] = outVals;
 			}
+			std::sort(times.begin(), times.end());
+			// times closer than this are the same keyframe, with rounding errors
+			const float eps = 1e-4f;
+			size_t u = 0;
+			for(size_t i = 0; i < times.size(); i++) {
+				if((u == 0) || (times[i] - times[u - 1] > eps)) {
+					times[u++] = times[i];
+				}
+			}
+			times.resize(u);
 		}
-		
-		std::cout << "There are " << nodeIds.size() << " animated nodes\n";
-		for(auto tninf : nodeIds) {
-			targetNode = tninf.first;
 
+		std::sort(nodes.begin(), nodes.end());
+		for(int node : nodes) {
 			std::ostringstream trackName;
-			
-			if(nodeIds.size() > 1) {
-				trackName << anim.name << "#" << targetNode;
+			if(nodes.size() > 1) {
+				trackName << anim.name << "#" << node;
 			} else {
 				trackName << anim.name;
 			}
-//			std::cout << targetNode << ":" << trackName.str() << "\n";
-		
+
+			glm::vec3 T0, S0;
+			glm::quat Q0;
+			Model::getGLTFnodeTransforms(&model->nodes[node], T0, S0, Q0);
 			AnimTrack *AT = new AnimTrack();
-			AT->nKeyFrames = nKeyFrames;
-			// Create transform nodes
-			for(int kf = 0; kf < nKeyFrames; kf++) {
-				float kfTm = Time[kf];
-				glm::vec3 T;
-				glm::vec3 S;
-				glm::quat Q;			
-				Model::getGLTFnodeTransforms(&model->nodes[targetNode], T, S, Q);
-				if(Trans[targetNode] != nullptr) {
-					T = glm::vec3(Trans[targetNode][0],Trans[targetNode][1],Trans[targetNode][2]);
-					Trans[targetNode] += 3;
+			AT->nKeyFrames = times.size();
+			AT->Frames.resize(times.size(), {0.0f, T0, Q0, S0});
+			for(const AnimChannel &C : channels) {
+				if(C.node != node) {
+					continue;
 				}
-				if(Rot[targetNode] != nullptr) {
-					Q = glm::quat(Rot[targetNode][3],Rot[targetNode][0],Rot[targetNode][1],Rot[targetNode][2]);
-					Rot[targetNode] += 4;
+				// with the times of the track, the values are taken as they are
+				bool same = (sharedInput >= 0) && (C.interpolation != 2);
+				int cursor = -1;
+				float v[4];
+				for(size_t kf = 0; kf < times.size(); kf++) {
+					if(same) {
+						std::copy(&C.values[kf * C.comps], &C.values[(kf + 1) * C.comps], v);
+					} else {
+						AnimChannelValue(C, times[kf], cursor, v);
+					}
+					AnimFrame &F = AT->Frames[kf];
+					if(C.path == ACP_TRANSLATION) {
+						F.T = glm::vec3(v[0], v[1], v[2]);
+					} else if(C.path == ACP_ROTATION) {
+						F.Q = glm::quat(v[3], v[0], v[1], v[2]);
+					} else {
+						F.S = glm::vec3(v[0], v[1], v[2]);
+					}
 				}
-				if(Scale[targetNode] != nullptr) {
-					S = glm::vec3(Scale[targetNode][0],Scale[targetNode][0],Scale[targetNode][0]);
-					Scale[targetNode] += 3;
-				}
-				AnimFrame A = {kfTm, T, Q, S};
-				AT->Frames.push_back(A);
 			}
-			GLTFanims[trackName.str()] = AT;
+			for(size_t kf = 0; kf < times.size(); kf++) {
+				AT->Frames[kf].time = times[kf];
+			}
+			J->tracks[a].push_back({trackName.str(), AT});
+		}
+	}
+}
+
+void Animations::init(AssetFile &A, JobSystem *JS) {
+	AF = &A;
+	
+	if(A.getType() != GLTF) {
+		std::cout << "Error: Animations supported only in GLTF assets\n";
+		exit(0);
+	}
+	
+	GLTFModel *model = A.getGLTFmodel();
+	AnimImportJob J{};
+	J.model = model;
+	J.tracks.resize(model->animations.size());
+	J.notes.resize(model->animations.size());
+	if(JS != nullptr) {
+		JS->parallelFor(model->animations.size(), 1, AnimImportRange, &J);
+	} else {
+		AnimImportRange(0, model->animations.size(), &J);
+	}
+
+	for(size_t a = 0; a < model->animations.size(); a++) {
+		const auto &anim = model->animations[a];
+		std::cout << J.notes[a];
+		std::cout << " Anim. Name:" << anim.name << 
+		" Channels: " << anim.channels.size() << " Samplers: " << anim.samplers.size() << "\n";
+		std::cout << "There are " << J.tracks[a].size() << " animated nodes\n";
+		for(auto &t : J.tracks[a]) {
+			GLTFanims[t.first] = t.second;
+		}
+	}
+}
+
+int RigidAnimations::add(AnimTrack *AT, glm::mat4 *out, glm::mat4 base, float t, float speed) {
+	bindings.push_back({AT, out, base, t, speed, -1});
+	return bindings.size() - 1;
+}
+
+void RigidAnimations::Advance(float dt) {
+	for(auto &B : bindings) {
+		B.t += dt * B.speed;
+	}
+}
+
+void RigidAnimations::Update() {
+	int n = bindings.size();
+	if(pose.nJoints != n) {
+		keyA.resize(n);
+		keyB.resize(n);
+		pose.resize(n);
+		// the padding lanes mix identities
+		alpha.assign(pose.stride, 0.0f);
+		for(int j = n; j < pose.stride; j++) {
+			for(AnimPose *P : {&keyA, &keyB}) {
+				P->data[APC_QW * P->stride + j] = 1.0f;
+				P->data[APC_SX * P->stride + j] = 1.0f;
+				P->data[APC_SY * P->stride + j] = 1.0f;
+				P->data[APC_SZ * P->stride + j] = 1.0f;
+			}
 		}
 	}
+	const int stride = pose.stride;
+
+	// the two keyframes of each track, gathered in the lanes
+	for(int j = 0; j < n; j++) {
+		RigidAnimBinding &B = bindings[j];
+		int fi0 = 0, fi1 = 0;
+		alpha[j] = 0.0f;
+		if(B.AT->nKeyFrames > 1) {
+			AnimLocate([&B](int i) {return B.AT->Frames[i].time;}, B.AT->nKeyFrames, B.t, 0, -1, &B.cursor, fi0, fi1, alpha[j]);
+		}
+		float *P[2] = {keyA.data.data(), keyB.data.data()};
+		const AnimFrame *F[2] = {&B.AT->Frames[fi0], &B.AT->Frames[fi1]};
+		for(int k = 0; k < 2; k++) {
+			P[k][APC_TX * stride + j] = F[k]->T.x;
+			P[k][APC_TY * stride + j] = F[k]->T.y;
+			P[k][APC_TZ * stride + j] = F[k]->T.z;
+			P[k][APC_QX * stride + j] = F[k]->Q.x;
+			P[k][APC_QY * stride + j] = F[k]->Q.y;
+			P[k][APC_QZ * stride + j] = F[k]->Q.z;
+			P[k][APC_QW * stride + j] = F[k]->Q.w;
+			P[k][APC_SX * stride + j] = F[k]->S.x;
+			P[k][APC_SY * stride + j] = F[k]->S.y;
+			P[k][APC_SZ * stride + j] = F[k]->S.z;
+		}
+	}
+	AnimPoseMixWeights(keyA.data.data(), keyB.data.data(), alpha.data(), pose.data.data(), stride);
+
+	for(int j = 0; j < n; j++) {
+		*bindings[j].out = bindings[j].base * pose.getMatrix(j);
+	}
 }
 
 void Animations::cleanup() {
@@ -348,7 +1336,7 @@ void SkeletalAnimation::init(Animations *_anims, int _NAnims, std::string BaseTr
 	anims = _anims;
 	NAnims = _NAnims;
 	
-	tinygltf::Model *model;
+	GLTFModel *model;
 	for(int naic = 0; naic < NAnims; naic++) {
 	  model = anims[naic].AF->getGLTFmodel();
 	  if(naic == 0) {
@@ -375,15 +1363,17 @@ void SkeletalAnimation::init(Animations *_anims, int _NAnims, std::string BaseTr
 	}
 	oTMs.resize(skin->joints.size());
 	TMs.resize(skin->joints.size());
+	prevTMs.resize(skin->joints.size());
 	BaseTMs.resize(skin->joints.size());
 	IBMs.resize(skin->joints.size());
+	std::vector<int> posOf = sortJoints(anims[0].AF->getGLTFmodel());
 
 std::cout << "Base animation track name: " << BaseTrackName << "\n";
 
 	for(int naic = 0; naic < NAnims; naic++) {
 	  model = anims[naic].AF->getGLTFmodel();
 	  if(naic == 0) {
-		for(int i = 0; i < skin->joints.size(); i++) {
+		for(size_t i = 0; i < skin->joints.size(); i++) {
 			std::ostringstream trackName;
 			int targetNode;
 			targetNode = skin->joints[i];
@@ -404,20 +1394,20 @@ std::cout << "Base animation track name: " << BaseTrackName << "\n";
 				glm::vec3 S;
 				glm::quat Q;			
 				Model::getGLTFnodeTransforms(&model->nodes[targetNode], T, S, Q);
-				BaseTMs[targetNode] =
+				BaseTMs[posOf[NidDec[targetNode]]] =
 					 glm::translate(glm::mat4(1), T) *
 					 glm::mat4(Q) *
 					 glm::scale(glm::mat4(1), S);
 //	std::cout << targetNode << " is not animated \n";
 	/*for(int mi = 0; mi<16; mi++) {
-		std::cout << BaseTMs[targetNode][mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");
+		std::cout << BaseTMs[posOf[NidDec[targetNode]]][mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");
 	}*/
 			}
 	//		std::cout << trackName.str() << " " << at << "\n";
 		}
 	  } else {
 		int atsCorrI = 0;
-		for(int i = 0; i < skin->joints.size(); i++) {
+		for(size_t i = 0; i < skin->joints.size(); i++) {
 			std::ostringstream trackName;
 			int targetNode;
 			targetNode = skin->joints[i];
@@ -437,7 +1427,7 @@ std::cout << "Base animation track name: " << BaseTrackName << "\n";
 				glm::vec3 S;
 				glm::quat Q;			
 				Model::getGLTFnodeTransforms(&model->nodes[targetNode], T, S, Q);
-				BaseTMs[targetNode] =
+				BaseTMs[posOf[NidDec[targetNode]]] =
 					 glm::translate(glm::mat4(1), T) *
 					 glm::mat4(Q) *
 					 glm::scale(glm::mat4(1), S);
@@ -450,15 +1440,30 @@ std::cout << "Base animation track name: " << BaseTrackName << "\n";
 
 //	std::cout << "found: " << ATs.size() << " matching tracks\n";
 	NATs = ATs.size();
+	for(int i = 0; i < NATs; i++) {
+		ATsPos.push_back(posOf[NidDec[ATsNodeId[i]]]);
+	}
+
+	clips.resize((NATs > 0) ? NAnims : 0);
+	for(size_t naic = 0; naic < clips.size(); naic++) {
+		std::vector<AnimTrack *> tracks(NATs);
+		for(int i = 0; i < NATs; i++) {
+			tracks[i] = ATs[i][naic];
+		}
+		if(!clips[naic].init(tracks)) {
+			std::cout << "Animation " << naic << " has tracks with different keyframes: sampled joint by joint\n";
+			clips.clear();
+			break;
+		}
+	}
 	NTMs = skin->joints.size();	
 	
 	const tinygltf::Accessor &inAccessor = model->accessors[skin->inverseBindMatrices];
-	const tinygltf::BufferView &inView = model->bufferViews[inAccessor.bufferView];
-	const float *inVals = reinterpret_cast<const float *>(&(model->buffers[inView.buffer].data[inAccessor.byteOffset + inView.byteOffset]));
+	const float *inVals = reinterpret_cast<const float *>(model->accessorData(inAccessor));
 	
 	for(int mel = 0; mel < NTMs; mel++) {
 		const float *s = &inVals[mel * 16];
-		IBMs[skin->joints[mel]] = glm::mat4(
+		IBMs[posOf[mel]] = glm::mat4(
 				s[0], s[1],s[2], s[3],
 				s[4], s[5],s[6], s[7],
 				s[8], s[9],s[10],s[11],
@@ -470,15 +1475,35 @@ void SkeletalAnimation::cleanup() {
 }
 
 std::vector<glm::mat4> *SkeletalAnimation::getTransformMatrices() {
-	for(int i = 0; i < NTMs; i++) {
-		oTMs[NidDec[i]] = TMs[i];
+	for(int p = 0; p < NTMs; p++) {
+		oTMs[jointOf[p]] = TMs[p];
 	}
 	return &oTMs;
 }
 
-void SkeletalAnimation::Sample(AnimBlender &AB) {
-	for(int i = 0; i < NATs; i++) {
-		BaseTMs[ATsNodeId[i]] = AB.Sample(&ATs[i]);
+void SkeletalAnimation::Sample(AnimBlender &AB, int maxDepth) {
+	TMs.swap(prevTMs);
+	if(!clips.empty()) {
+		// all the joints at once, and the matrices only at the end
+		AnimBlendSegment &C = AB.segments[AB.cur];
+		clips[C.clip].Sample(poseA, C.t, C.st, C.en, AB.getCursor(0, AB.cur));
+		if(AB.blending) {
+			AnimBlendSegment &P = AB.segments[AB.prev];
+			clips[P.clip].Sample(poseB, P.t, P.st, P.en, AB.getCursor(0, AB.prev));
+			AnimPoseMix(poseA.data.data(), poseB.data.data(), 1.0f - AB.blendPos / AB.blendTime,
+						poseA.data.data(), poseA.stride);
+		}
+		for(int i = 0; i < NATs; i++) {
+			if((maxDepth < 0) || (depth[ATsPos[i]] <= maxDepth)) {
+				BaseTMs[ATsPos[i]] = poseA.getMatrix(i);
+			}
+		}
+	} else {
+		for(int i = 0; i < NATs; i++) {
+			if((maxDepth >= 0) && (depth[ATsPos[i]] > maxDepth)) {
+				continue;
+			}
+			BaseTMs[ATsPos[i]] = AB.Sample(&ATs[i], i);
 /*std::cout << ATs[i]->nKeyFrames << " = \n";
 std::cout << i << ": nd :" << ATsNodeId[i] << " = \n";
 for(int mi = 0; mi<16; mi++) {
@@ -502,27 +1527,39 @@ std::cout << ATT->Frames[frm].S.z << "\n";
 }
 exit(0);
 }*/
+		}
 	}
 	
-	for(int i = 0; i < NTMs; i++) {
-		TMs[i] = BaseTMs[i];
-	}
+	buildMatrices(maxDepth);
+}
 
-	tinygltf::Model *model = anims[0].AF->getGLTFmodel();
-	for(int i = 0; i < skin->joints.size(); i++) {
-		int targetNode;
-		targetNode = skin->joints[i];
-		
-/*std::cout << targetNode << " = \n";
-for(int mi = 0; mi<16; mi++) {
-std::cout << TMs[targetNode] [mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");}
-*/
-		for(int icc = 0; icc < model->nodes[targetNode].children.size(); icc++) {
-			int childNode = model->nodes[targetNode].children[icc];
-			TMs[childNode] = TMs[targetNode] * TMs[childNode];
+void SkeletalAnimation::buildMatrices(int maxDepth) {
+	if(maxDepth >= 0) {
+		// the skin matrix of a joint that keeps its bind pose relative to an ancestor is
+		// the one of the ancestor
+		for(int p = 0; p < NTMs; p++) {
+			cut[p] = (depth[p] <= maxDepth) ? p : cut[parents[p]];
+		}
+		for(int p = 0; p < NTMs; p++) {
+			if(cut[p] == p) {
+				TMs[p] = (parents[p] >= 0) ? TMs[parents[p]] * BaseTMs[p] : BaseTMs[p];
+			}
+		}
+		for(int p = 0; p < NTMs; p++) {
+			if(cut[p] == p) {
+				TMs[p] = TMs[p] * IBMs[p];
+			} else {
+				TMs[p] = TMs[cut[p]];
+			}
 		}
+		return;
 	}
 
+	for(int i = 0; i < NTMs; i++) {
+		TMs[i] = BaseTMs[i];
+	}
+	propagate(TMs);
+
 	for(int i = 0; i < NTMs; i++) {
 		TMs[i] = TMs[i] * IBMs[i];
 //std::cout << i << " <> " << model->nodes[i].name << ": " << (-IBMs[i][3][0]) << " " << (-IBMs[i][3][1]) << " " << (-IBMs[i][3][2]) << "\n";
@@ -533,6 +1570,294 @@ std::cout << IBMs[i] [mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");} */
 //	exit(0);
 }
 
+std::vector<int> SkeletalAnimation::sortJoints(GLTFModel *model) {
+	int n = skin->joints.size();
+	std::vector<int> parentJoint(n, -1);
+	for(int d = 0; d < n; d++) {
+		for(int child : model->nodes[skin->joints[d]].children) {
+			auto c = NidDec.find(child);
+			if(c != NidDec.end()) {
+				parentJoint[c->second] = d;
+			}
+		}
+	}
+
+	// each joint after its parent, otherwise in the order of the skin
+	std::vector<int> posOf(n, -1);
+	jointOf.clear();
+	parents.clear();
+	depth.clear();
+	for(int d = 0; d < n; d++) {
+		std::vector<int> chain;
+		for(int j = d; (j >= 0) && (posOf[j] < 0); j = parentJoint[j]) {
+			chain.push_back(j);
+		}
+		for(int k = chain.size() - 1; k >= 0; k--) {
+			int j = chain[k];
+			posOf[j] = jointOf.size();
+			jointOf.push_back(j);
+			parents.push_back((parentJoint[j] >= 0) ? posOf[parentJoint[j]] : -1);
+			depth.push_back((parents.back() >= 0) ? depth[parents.back()] + 1 : 0);
+		}
+	}
+	cut.resize(n);
+	return posOf;
+}
+
+void SkeletalAnimation::propagate(std::vector<glm::mat4> &M) {
+	for(int p = 0; p < NTMs; p++) {
+		if(parents[p] >= 0) {
+			M[p] = M[parents[p]] * M[p];
+		}
+	}
+}
+
+void SkeletalAnimation::compress(float tolerance) {
+	std::vector<glm::mat4> M(NTMs);
+	// positions of the joints, in the space of the root, for the pose P
+	auto jointPositions = [&](const float *P, int stride, std::vector<glm::vec3> &out) {
+		M = BaseTMs;
+		for(int i = 0; i < NATs; i++) {
+			M[ATsPos[i]] = AnimPoseMatrix(P, stride, i);
+		}
+		propagate(M);
+		out.resize(NTMs);
+		for(int i = 0; i < NTMs; i++) {
+			out[i] = glm::vec3(M[i][3]);
+		}
+	};
+	auto maxDistance = [](const std::vector<glm::vec3> &a, const std::vector<glm::vec3> &b) {
+		float d = 0.0f;
+		for(size_t i = 0; i < a.size(); i++) {
+			d = std::max(d, glm::length(a[i] - b[i]));
+		}
+		return d;
+	};
+
+	for(size_t c = 0; c < clips.size(); c++) {
+		AnimClip &C = clips[c];
+		if(C.compressed) {
+			continue;
+		}
+		size_t before = C.getMemorySize();
+		const size_t poseSize = (size_t)APC_COUNT * C.stride;
+		std::vector<std::vector<glm::vec3>> ref(C.nKeyFrames);
+		for(int k = 0; k < C.nKeyFrames; k++) {
+			jointPositions(&C.data[k * poseSize], C.stride, ref[k]);
+		}
+		C.quantize();
+
+		// greedy: from each kept keyframe, the next one is the farthest that still
+		// interpolates all those in between within the tolerance
+		std::vector<float> A(poseSize), B(poseSize), P(poseSize);
+		std::vector<glm::vec3> pos;
+		std::vector<bool> keep(C.nKeyFrames, false);
+		float maxErr = 0.0f;
+		int a = 0;
+		keep[0] = keep[C.nKeyFrames - 1] = true;
+		C.decodeKept(0, A.data());
+		jointPositions(A.data(), C.stride, pos);
+		maxErr = maxDistance(pos, ref[0]);
+		while(a < C.nKeyFrames - 1) {
+			int b = a + 1;
+			float bErr = 0.0f;
+			for(int cand = a + 2; cand < C.nKeyFrames; cand++) {
+				C.decodeKept(cand, B.data());
+				float err = 0.0f;
+				for(int k = a + 1; (k < cand) && (err <= tolerance); k++) {
+					float w = (C.times[k] - C.times[a]) / (C.times[cand] - C.times[a]);
+					AnimPoseMix(A.data(), B.data(), w, P.data(), C.stride);
+					jointPositions(P.data(), C.stride, pos);
+					err = std::max(err, maxDistance(pos, ref[k]));
+				}
+				if(err > tolerance) {
+					break;
+				}
+				b = cand;
+				bErr = err;
+			}
+			C.decodeKept(b, A.data());
+			jointPositions(A.data(), C.stride, pos);
+			maxErr = std::max(maxErr, std::max(bErr, maxDistance(pos, ref[b])));
+			keep[b] = true;
+			a = b;
+		}
+		C.dropKeyFrames(keep);
+
+		std::cout << "[Anim] clip " << c << ": " << C.keptKeys.size() << "/" << C.nKeyFrames << " keyframes, "
+				  << before / 1024 << " KB -> " << C.getMemorySize() / 1024 << " KB, max joint error " << maxErr << "\n";
+	}
+}
+
+void SkeletalAnimation::Sample(AnimBlendGraph &G, int maxDepth) {
+	if(clips.empty()) {
+		std::cout << "Error: blend graphs need the tracks of all the animations packed in clips\n";
+		return;
+	}
+	TMs.swap(prevTMs);
+	const AnimPose &P = G.Evaluate(clips);
+	for(int i = 0; i < NATs; i++) {
+		if((maxDepth < 0) || (depth[ATsPos[i]] <= maxDepth)) {
+			BaseTMs[ATsPos[i]] = P.getMatrix(i);
+		}
+	}
+	buildMatrices(maxDepth);
+}
+
+std::vector<float> SkeletalAnimation::getSubtreeMask(int node) {
+	std::vector<float> mask(NATs, 0.0f);
+	auto d = NidDec.find(node);
+	if(d == NidDec.end()) {
+		return mask;
+	}
+	int top = -1;
+	for(int p = 0; p < NTMs; p++) {
+		if(jointOf[p] == d->second) top = p;
+	}
+	for(int i = 0; i < NATs; i++) {
+		for(int p = ATsPos[i]; p >= top; p = parents[p]) {
+			if(p == top) {
+				mask[i] = 1.0f;
+				break;
+			}
+		}
+	}
+	return mask;
+}
+
+void SkeletalAnimation::getTransformMatrices(glm::mat4 *out) {
+	for(int p = 0; p < NTMs; p++) {
+		out[jointOf[p]] = TMs[p];
+	}
+}
+
+void SkeletalAnimation::getTransformMatrices(glm::mat4 *out, float alpha) {
+	// linear: the samples are close enough, for the far instances that are interpolated
+	for(int p = 0; p < NTMs; p++) {
+		out[jointOf[p]] = prevTMs[p] + (TMs[p] - prevTMs[p]) * alpha;
+	}
+}
+
+struct SkeletalSampleJob {
+	std::vector<SkeletalInstance> *instances;
+	glm::mat4 *out;
+};
+
+static bool SkeletalMustSample(SkeletalInstance &I) {
+	return (I.age < 0) || (I.age + 1 >= I.period);
+}
+
+static void SkeletalSampleRange(int first, int last, void *params) {
+	SkeletalSampleJob *J = (SkeletalSampleJob *)params;
+	for(int i = first; i < last; i++) {
+		SkeletalInstance &I = (*J->instances)[i];
+		if(!I.visible) {
+			I.age = -1;
+			continue;
+		}
+		if(!SkeletalMustSample(I)) {
+			I.age++;
+			I.SA->getTransformMatrices(J->out + I.firstMatrix, (float)I.age / I.period);
+			continue;
+		}
+		bool fresh = (I.age < 0);
+		I.SA->Sample(*I.AB, I.maxDepth);
+		if(fresh) {
+			// nothing to interpolate from; and the instances that start together are
+			// spread over the frames of their period
+			I.SA->resetInterpolation();
+			I.age = i % I.period;
+		} else {
+			I.age = 0;
+		}
+		if(I.period > 1) {
+			I.SA->getTransformMatrices(J->out + I.firstMatrix, (float)I.age / I.period);
+		} else {
+			I.SA->getTransformMatrices(J->out + I.firstMatrix);
+		}
+	}
+}
+
+void SkeletalAnimation::SampleAll(JobSystem &JS, std::vector<SkeletalInstance> &instances, std::vector<glm::mat4> &out, AnimLOD *LOD) {
+	if(LOD != nullptr) {
+		LOD->update(instances);
+	}
+	int total = 0;
+	float work = 0.0f;
+	for(auto &I : instances) {
+		if(!I.visible) {
+			I.firstMatrix = -1;
+			continue;
+		}
+		I.firstMatrix = total;
+		total += I.SA->getNTMs();
+		work += SkeletalMustSample(I) ? AnimLOD::sampleWork(I.SA->getNTMs()) : AnimLOD::interpolateWork(I.SA->getNTMs());
+	}
+	out.resize(total);
+
+	auto start = std::chrono::steady_clock::now();
+	SkeletalSampleJob J = {&instances, out.data()};
+	JS.parallelFor(instances.size(), 0, SkeletalSampleRange, &J);
+	if(LOD != nullptr) {
+		LOD->measure(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count(), work);
+	}
+}
+
+float AnimLOD::expectedWork(SkeletalInstance &I) {
+	int n = I.SA->getNTMs();
+	return (sampleWork(n) + (I.period - 1) * interpolateWork(n)) / I.period;
+}
+
+void AnimLOD::update(std::vector<SkeletalInstance> &instances) {
+	float work = 0.0f;
+	for(auto &I : instances) {
+		if(!I.visible) {
+			continue;
+		}
+		size_t l = 0;
+		while((l + 1 < levels.size()) && (I.distance >= levels[l + 1].distance)) {
+			l++;
+		}
+		I.period = levels.empty() ? 1 : levels[l].period;
+		I.maxDepth = levels.empty() ? -1 : levels[l].maxDepth;
+		work += expectedWork(I);
+	}
+	if((budget <= 0.0f) || (msPerWork <= 0.0f) || (work * msPerWork <= budget)) {
+		return;
+	}
+
+	// over budget: the periods are doubled, the farthest instances first
+	order.resize(instances.size());
+	for(size_t i = 0; i < order.size(); i++) {
+		order[i] = (int)i;
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		return instances[a].distance > instances[b].distance;
+	});
+	for(int period = 2; period <= maxPeriod; period *= 2) {
+		for(int i : order) {
+			SkeletalInstance &I = instances[i];
+			if(!I.visible || (I.period >= period)) {
+				continue;
+			}
+			work -= expectedWork(I);
+			I.period = period;
+			work += expectedWork(I);
+			if(work * msPerWork <= budget) {
+				return;
+			}
+		}
+	}
+}
+
+void AnimLOD::measure(float ms, float work) {
+	if(work <= 0.0f) {
+		return;
+	}
+	// averaged over the last frames, to smooth out the system noise
+	msPerWork = (msPerWork > 0.0f) ? msPerWork * 0.9f + (ms / work) * 0.1f : ms / work;
+}
+
 int SkeletalAnimation::getNTMs() {
 	return NTMs;
 }
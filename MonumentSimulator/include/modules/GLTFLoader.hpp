@@ -0,0 +1,523 @@
+// glTF and glb loading, without copying the buffers
+//
+// tinygltf copies every buffer in tinygltf::Buffer::data: the BIN chunk of .glb files,
+// and external .bin files after reading them. Here the "buffers" array is hidden from
+// tinygltf, and each buffer is referenced where its bytes already are: inside the
+// file read by the VFS (a view into a mapped bundle, for stored entries), or inside
+// the external file read once by the VFS. Accessors must then be reached with
+// GLTFModel::accessorData(), and not through buffers[].data, that stays empty.
+//
+// Files with data URIs, or with images stored in buffer views, are left to tinygltf.
+// The gather functions convert accessors, with any stride and component type, into
+// the interleaved vertices of a VertexDescriptor.
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include <cfloat>
+
+// requires VFS.hpp and tiny_gltf.h, included by Starter.hpp
+
+struct GLTFModel : public tinygltf::Model {
+	std::vector<const unsigned char *> bufferData;	// first byte of each buffer
+	std::vector<size_t> bufferSize;
+	std::vector<VFSFile> storage;	// files that bufferData points into
+
+	// first element of the accessor, or nullptr if it has no buffer view
+	const unsigned char *accessorData(const tinygltf::Accessor &A) const;
+	// distance between the elements of the accessor, packed when the view has no stride
+	int accessorStride(const tinygltf::Accessor &A) const;
+	void clearBuffers();
+};
+
+// Copies the elements [first, first + count) of an accessor, or the ones it has, into
+// interleaved vertices: dst is the component in the vertex of element first, and
+// dstStride the size of a vertex. Any component type, normalized or not
+// (KHR_mesh_quantization), is converted to float, or to uint for integer attributes as
+// joint indices. Up to dstComps components are written.
+void GLTFgatherFloat(const GLTFModel *M, const tinygltf::Accessor &A, size_t first, size_t count,
+					 unsigned char *dst, int dstStride, int dstComps);
+void GLTFgatherUint(const GLTFModel *M, const tinygltf::Accessor &A, size_t first, size_t count,
+					unsigned char *dst, int dstStride, int dstComps);
+// bounding box of the first three components of an accessor, from its min and max
+// when they are given as floats, or from its elements
+void GLTFaccessorBounds(const GLTFModel *M, const tinygltf::Accessor &A, float minV[3], float maxV[3]);
+// appends the indices of an accessor, moved by base
+void GLTFgatherIndices(const GLTFModel *M, const tinygltf::Accessor &A, uint32_t base, std::vector<uint32_t> &out);
+
+// Loads a .gltf or .glb file already read in F; baseDir is where external buffers are
+// looked up. F is moved into the model when its memory is referenced by the buffers.
+bool GLTFLoadFromFile(GLTFModel *model, std::string *warn, std::string *err,
+					  VFSFile &F, const std::string &baseDir);
+
+
+#ifdef GLTFLOADER_IMPLEMENTATION
+
+static const uint32_t GLB_MAGIC = 0x46546C67;		// "glTF"
+static const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+static const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+const unsigned char *GLTFModel::accessorData(const tinygltf::Accessor &A) const {
+	if(A.bufferView < 0) {
+		return nullptr;
+	}
+	const tinygltf::BufferView &V = bufferViews[A.bufferView];
+	return bufferData[V.buffer] + V.byteOffset + A.byteOffset;
+}
+
+int GLTFModel::accessorStride(const tinygltf::Accessor &A) const {
+	return A.ByteStride(bufferViews[A.bufferView]);
+}
+
+void GLTFModel::clearBuffers() {
+	bufferData.clear();
+	bufferSize.clear();
+	storage.clear();
+}
+
+static uint32_t GLTFget32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// position of the quote closing the string that starts at s; memchr is much faster
+// than a loop on the characters, on the base64 strings of embedded data
+static size_t GLTFstringEnd(const char *json, size_t n, size_t s) {
+	for(;;) {
+		const char *q = (const char *)memchr(json + s, '"', n - s);
+		if(q == nullptr) {
+			return n;
+		}
+		size_t e = q - json;
+		size_t bs = 0;
+		while((e - bs > s) && (json[e - bs - 1] == '\\')) bs++;
+		if(bs % 2 == 0) {
+			return e;
+		}
+		s = e + 1;
+	}
+}
+
+// Finds a member of the root object of a JSON text, without parsing it: returns the
+// position of the key name, and the range of its value.
+static bool GLTFfindMember(const char *json, size_t n, const char *key,
+						   size_t &keyAt, size_t &valueAt, size_t &valueEnd) {
+	size_t keyLen = strlen(key);
+	int depth = 0;
+	char last = 0;
+	for(size_t i = 0; i < n; i++) {
+		char c = json[i];
+		if(c == '"') {
+			size_t s = i + 1;
+			i = GLTFstringEnd(json, n, s);
+			if((depth == 1) && ((last == '{') || (last == ',')) &&
+			   (i - s == keyLen) && (memcmp(json + s, key, keyLen) == 0)) {
+				size_t v = i + 1;
+				while((v < n) && ((json[v] == ':') || isspace((unsigned char)json[v]))) v++;
+				size_t e = v;
+				int d = 0;
+				for(; e < n; e++) {
+					char ch = json[e];
+					if(ch == '"') {
+						e = GLTFstringEnd(json, n, e + 1);
+					} else if((ch == '[') || (ch == '{')) {
+						d++;
+					} else if((ch == ']') || (ch == '}')) {
+						if(d == 0) break;
+						if(--d == 0) {e++; break;}
+					} else if((ch == ',') && (d == 0)) {
+						break;
+					}
+				}
+				keyAt = s;
+				valueAt = v;
+				valueEnd = e;
+				return true;
+			}
+			last = '"';
+		} else if((c == '{') || (c == '[')) {
+			depth++;
+			last = c;
+		} else if((c == '}') || (c == ']')) {
+			depth--;
+			last = c;
+		} else if(!isspace((unsigned char)c)) {
+			last = c;
+		}
+	}
+	return false;
+}
+
+// a buffer as listed in the "buffers" array
+struct GLTFbufferSource {
+	std::string uri;
+	size_t byteLength;
+};
+
+// Loads with tinygltf, that copies the buffers: the model still gets its bufferData
+static bool GLTFloadCopying(GLTFModel *model, std::string *warn, std::string *err,
+							const VFSFile &F, const std::string &baseDir, bool binary) {
+	tinygltf::TinyGLTF loader;
+	loader.SetFsCallbacks(VFSgltfCallbacks());
+	bool ok = binary ? loader.LoadBinaryFromMemory(model, err, warn, F.data, (unsigned int)F.size, baseDir) :
+					   loader.LoadASCIIFromString(model, err, warn, (const char *)F.data, (unsigned int)F.size, baseDir);
+	if(!ok) {
+		return false;
+	}
+	model->clearBuffers();
+	for(auto &B : model->buffers) {
+		model->bufferData.push_back(B.data.data());
+		model->bufferSize.push_back(B.data.size());
+	}
+	return true;
+}
+
+bool GLTFLoadFromFile(GLTFModel *model, std::string *warn, std::string *err,
+					  VFSFile &F, const std::string &baseDir) {
+	model->clearBuffers();
+
+	// splits .glb files in their chunks
+	bool binary = (F.size >= 20) && (GLTFget32(F.data) == GLB_MAGIC);
+	const char *json = (const char *)F.data;
+	size_t jsonSize = F.size;
+	const unsigned char *bin = nullptr;
+	size_t binSize = 0;
+	if(binary) {
+		uint32_t length = GLTFget32(F.data + 8);
+		jsonSize = GLTFget32(F.data + 12);
+		if((GLTFget32(F.data + 4) != 2) || (length > F.size) || (20 + (uint64_t)jsonSize > length) ||
+		   (GLTFget32(F.data + 16) != GLB_CHUNK_JSON)) {
+			(*err) += "Invalid glb header\n";
+			return false;
+		}
+		json = (const char *)F.data + 20;
+		size_t binAt = (20 + jsonSize + 3) & ~(size_t)3;
+		if((binAt + 8 <= length) && (GLTFget32(F.data + binAt + 4) == GLB_CHUNK_BIN)) {
+			binSize = GLTFget32(F.data + binAt);
+			bin = F.data + binAt + 8;
+			if(binAt + 8 + (uint64_t)binSize > length) {
+				(*err) += "Invalid glb BIN chunk size\n";
+				return false;
+			}
+		}
+	}
+
+	size_t keyAt, valueAt, valueEnd;
+	if(!GLTFfindMember(json, jsonSize, "buffers", keyAt, valueAt, valueEnd)) {
+		return GLTFloadCopying(model, warn, err, F, baseDir, binary);
+	}
+
+	// data URIs are left to tinygltf, that decodes them
+	const char *dataURI = "\"data:";
+	if(std::search(json + valueAt, json + valueEnd, dataURI, dataURI + 6) != json + valueEnd) {
+		return GLTFloadCopying(model, warn, err, F, baseDir, binary);
+	}
+	size_t imgKey, imgAt, imgEnd;
+	if(GLTFfindMember(json, jsonSize, "images", imgKey, imgAt, imgEnd) &&
+	   (std::string(json + imgAt, imgEnd - imgAt).find("\"bufferView\"") != std::string::npos)) {
+		return GLTFloadCopying(model, warn, err, F, baseDir, binary);
+	}
+	std::vector<GLTFbufferSource> sources;
+	nlohmann::json B = nlohmann::json::parse(json + valueAt, json + valueEnd, nullptr, false);
+	if(!B.is_array()) {
+		(*err) += "Invalid \"buffers\" array\n";
+		return false;
+	}
+	for(auto &b : B) {
+		GLTFbufferSource S;
+		S.uri = b.value("uri", "");
+		S.byteLength = b.value("byteLength", (size_t)0);
+		// percent encoded names are unescaped by tinygltf
+		if(S.uri.find('%') != std::string::npos) {
+			return GLTFloadCopying(model, warn, err, F, baseDir, binary);
+		}
+		sources.push_back(S);
+	}
+
+	// the key is renamed to one tinygltf ignores, in a copy of the JSON text only
+	std::string text(json, jsonSize);
+	memcpy(&text[keyAt], "skipped", 7);
+	tinygltf::TinyGLTF loader;
+	loader.SetFsCallbacks(VFSgltfCallbacks());
+	if(!loader.LoadASCIIFromString(model, err, warn, text.data(), (unsigned int)text.size(), baseDir)) {
+		return false;
+	}
+
+	bool usesFile = false;
+	model->buffers.resize(sources.size());
+	for(size_t i = 0; i < sources.size(); i++) {
+		const GLTFbufferSource &S = sources[i];
+		model->buffers[i].uri = S.uri;
+		const unsigned char *p;
+		size_t n;
+		if(S.uri.empty()) {
+			if(bin == nullptr) {
+				(*err) += "Buffer " + std::to_string(i) + " has no uri, and there is no glb BIN chunk\n";
+				return false;
+			}
+			p = bin;
+			n = binSize;
+			usesFile = true;
+		} else {
+			std::string path = baseDir.empty() ? S.uri : baseDir + "/" + S.uri;
+			model->storage.emplace_back();
+			VFSFile &E = model->storage.back();
+			if(!VFSRead(path, E)) {
+				(*err) += "Buffer file not found: " + path + "\n";
+				return false;
+			}
+			p = E.data;
+			n = E.size;
+		}
+		if(n < S.byteLength) {
+			(*err) += "Buffer " + std::to_string(i) + " is shorter than its byteLength\n";
+			return false;
+		}
+		model->bufferData.push_back(p);
+		model->bufferSize.push_back(S.byteLength);
+	}
+
+	for(auto &V : model->bufferViews) {
+		if((V.buffer < 0) || ((size_t)V.buffer >= sources.size()) ||
+		   (V.byteOffset + V.byteLength > model->bufferSize[V.buffer])) {
+			(*err) += "Buffer view \"" + V.name + "\" outside of its buffer\n";
+			return false;
+		}
+	}
+	if(usesFile) {
+		// moving the vector keeps its memory where bufferData points
+		model->storage.push_back(std::move(F));
+	}
+	return true;
+}
+
+// element first of an accessor, and its stride, after checking that the accessor fits
+// in its buffer view; count is reduced to the elements available
+static const unsigned char *GLTFaccessorRange(const GLTFModel *M, const tinygltf::Accessor &A, size_t first,
+											  size_t &count, int &stride) {
+	if((A.bufferView < 0) || A.sparse.isSparse) {
+		std::cout << "Accessor " << A.name << ": sparse accessors, or accessors without a view, are not supported\n";
+		throw std::runtime_error("Error loading GLTF component");
+	}
+	const tinygltf::BufferView &V = M->bufferViews[A.bufferView];
+	stride = M->accessorStride(A);
+	size_t elementSize = tinygltf::GetComponentSizeInBytes(A.componentType) * tinygltf::GetNumComponentsInType(A.type);
+	if((stride <= 0) || ((A.count > 0) && (A.byteOffset + (A.count - 1) * stride + elementSize > V.byteLength))) {
+		std::cout << "Accessor " << A.name << " does not fit in its buffer view\n";
+		throw std::runtime_error("Error loading GLTF component");
+	}
+	count = (first < A.count) ? std::min(count, A.count - first) : 0;
+	return M->accessorData(A) + first * stride;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GLTF_SSE2_GATHER
+
+// One element per iteration, widened to four 32 bit integers and converted with a single
+// multiply. Each element is read with a 4 (8 bit types) or 8 (16 bit types) bytes load,
+// that can go past the end of the buffer only on the last element, left to the caller.
+template<typename T, int N, bool Clamp>
+static size_t GLTFconvertSSE2(unsigned char *dst, int dstStride, const unsigned char *src, int srcStride,
+							  size_t count, float scale) {
+	const bool isSigned = std::is_signed<T>::value;
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 1 < count; i++) {
+		__m128i v;
+		if(sizeof(T) == 1) {
+			int32_t w;
+			memcpy(&w, src + i * srcStride, 4);
+			v = _mm_cvtsi32_si128(w);
+			v = isSigned ? _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8) : _mm_unpacklo_epi8(v, zero);
+		} else {
+			v = _mm_loadl_epi64((const __m128i *)(src + i * srcStride));
+		}
+		v = isSigned ? _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16) : _mm_unpacklo_epi16(v, zero);
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(v), s);
+		if(Clamp) {
+			f = _mm_max_ps(f, minusOne);
+		}
+		float *d = (float *)(dst + i * dstStride);
+		if(N == 4) {
+			_mm_storeu_ps(d, f);
+		} else {
+			_mm_storel_pi((__m64 *)d, f);
+			if(N == 3) {
+				_mm_store_ss(d + 2, _mm_movehl_ps(f, f));
+			}
+		}
+	}
+	return i;
+}
+#endif
+
+// N components of type T per element, multiplied by scale, and clamped to -1 for signed
+// normalized types; with N known at compile time the inner loop is fully unrolled
+template<typename T, int N, bool Clamp>
+static void GLTFconvert(unsigned char *dst, int dstStride, const unsigned char *src, int srcStride,
+						size_t count, float scale) {
+	size_t i = 0;
+#ifdef GLTF_SSE2_GATHER
+	if(N >= 2) {
+		i = GLTFconvertSSE2<T, N, Clamp>(dst, dstStride, src, srcStride, count, scale);
+	}
+#endif
+	for(; i < count; i++) {
+		const T *s = (const T *)(src + i * srcStride);
+		float *d = (float *)(dst + i * dstStride);
+		for(int c = 0; c < N; c++) {
+			float v = (float)s[c] * scale;
+			d[c] = Clamp ? std::max(v, -1.0f) : v;
+		}
+	}
+}
+
+template<int N>
+static void GLTFcopyFloat(unsigned char *dst, int dstStride, const unsigned char *src, int srcStride, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		memcpy(dst + i * dstStride, src + i * srcStride, N * sizeof(float));
+	}
+}
+
+template<typename T, bool Clamp>
+static void GLTFconvertN(int n, unsigned char *dst, int dstStride, const unsigned char *src, int srcStride,
+						 size_t count, float scale) {
+	switch(n) {
+	  case 1: GLTFconvert<T, 1, Clamp>(dst, dstStride, src, srcStride, count, scale); break;
+	  case 2: GLTFconvert<T, 2, Clamp>(dst, dstStride, src, srcStride, count, scale); break;
+	  case 3: GLTFconvert<T, 3, Clamp>(dst, dstStride, src, srcStride, count, scale); break;
+	  case 4: GLTFconvert<T, 4, Clamp>(dst, dstStride, src, srcStride, count, scale); break;
+	}
+}
+
+void GLTFgatherFloat(const GLTFModel *M, const tinygltf::Accessor &A, size_t first, size_t count,
+					 unsigned char *dst, int dstStride, int dstComps) {
+	int stride;
+	const unsigned char *src = GLTFaccessorRange(M, A, first, count, stride);
+	int n = std::min(dstComps, (int)tinygltf::GetNumComponentsInType(A.type));
+	bool norm = A.normalized;
+
+	switch(A.componentType) {
+	  case TINYGLTF_COMPONENT_TYPE_FLOAT:
+		switch(n) {
+		  case 1: GLTFcopyFloat<1>(dst, dstStride, src, stride, count); break;
+		  case 2: GLTFcopyFloat<2>(dst, dstStride, src, stride, count); break;
+		  case 3: GLTFcopyFloat<3>(dst, dstStride, src, stride, count); break;
+		  case 4: GLTFcopyFloat<4>(dst, dstStride, src, stride, count); break;
+		}
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_BYTE:
+		if(norm) GLTFconvertN<int8_t, true>(n, dst, dstStride, src, stride, count, 1.0f / 127.0f);
+		else GLTFconvertN<int8_t, false>(n, dst, dstStride, src, stride, count, 1.0f);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		GLTFconvertN<uint8_t, false>(n, dst, dstStride, src, stride, count, norm ? 1.0f / 255.0f : 1.0f);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_SHORT:
+		if(norm) GLTFconvertN<int16_t, true>(n, dst, dstStride, src, stride, count, 1.0f / 32767.0f);
+		else GLTFconvertN<int16_t, false>(n, dst, dstStride, src, stride, count, 1.0f);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		GLTFconvertN<uint16_t, false>(n, dst, dstStride, src, stride, count, norm ? 1.0f / 65535.0f : 1.0f);
+		break;
+	  default:
+		std::cout << "Vertex component type " << A.componentType << " not supported!\n";
+		throw std::runtime_error("Error loading GLTF component");
+	}
+}
+
+void GLTFaccessorBounds(const GLTFModel *M, const tinygltf::Accessor &A, float minV[3], float maxV[3]) {
+	if((A.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) &&
+	   (A.minValues.size() >= 3) && (A.maxValues.size() >= 3)) {
+		for(int c = 0; c < 3; c++) {
+			minV[c] = (float)A.minValues[c];
+			maxV[c] = (float)A.maxValues[c];
+		}
+		return;
+	}
+	for(int c = 0; c < 3; c++) {
+		minV[c] = A.count > 0 ? FLT_MAX : 0.0f;
+		maxV[c] = A.count > 0 ? -FLT_MAX : 0.0f;
+	}
+	const size_t blockSize = 2048;
+	std::vector<float> block(blockSize * 3, 0.0f);
+	for(size_t b = 0; b < A.count; b += blockSize) {
+		size_t n = std::min(blockSize, A.count - b);
+		GLTFgatherFloat(M, A, b, n, (unsigned char *)block.data(), 3 * sizeof(float), 3);
+		for(size_t i = 0; i < n; i++) {
+			for(int c = 0; c < 3; c++) {
+				minV[c] = std::min(minV[c], block[3 * i + c]);
+				maxV[c] = std::max(maxV[c], block[3 * i + c]);
+			}
+		}
+	}
+}
+
+template<typename T>
+static void GLTFconvertUint(int n, unsigned char *dst, int dstStride, const unsigned char *src, int srcStride, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		const T *s = (const T *)(src + i * srcStride);
+		uint32_t *d = (uint32_t *)(dst + i * dstStride);
+		for(int c = 0; c < n; c++) {
+			d[c] = s[c];
+		}
+	}
+}
+
+void GLTFgatherUint(const GLTFModel *M, const tinygltf::Accessor &A, size_t first, size_t count,
+					unsigned char *dst, int dstStride, int dstComps) {
+	int stride;
+	const unsigned char *src = GLTFaccessorRange(M, A, first, count, stride);
+	int n = std::min(dstComps, (int)tinygltf::GetNumComponentsInType(A.type));
+
+	switch(A.componentType) {
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		GLTFconvertUint<uint8_t>(n, dst, dstStride, src, stride, count);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		GLTFconvertUint<uint16_t>(n, dst, dstStride, src, stride, count);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		GLTFconvertUint<uint32_t>(n, dst, dstStride, src, stride, count);
+		break;
+	  default:
+		std::cout << "Joint component type " << A.componentType << " not supported!\n";
+		throw std::runtime_error("Error loading GLTF component");
+	}
+}
+
+template<typename T>
+static void GLTFappendIndices(const unsigned char *src, int srcStride, size_t count, uint32_t base, uint32_t *out) {
+	for(size_t i = 0; i < count; i++) {
+		out[i] = base + *(const T *)(src + i * srcStride);
+	}
+}
+
+void GLTFgatherIndices(const GLTFModel *M, const tinygltf::Accessor &A, uint32_t base, std::vector<uint32_t> &out) {
+	int stride;
+	size_t count = A.count;
+	const unsigned char *src = GLTFaccessorRange(M, A, 0, count, stride);
+	size_t first = out.size();
+	out.resize(first + count);
+
+	switch(A.componentType) {
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		GLTFappendIndices<uint8_t>(src, stride, count, base, &out[first]);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		GLTFappendIndices<uint16_t>(src, stride, count, base, &out[first]);
+		break;
+	  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		GLTFappendIndices<uint32_t>(src, stride, count, base, &out[first]);
+		break;
+	  default:
+		out.resize(first);
+		std::cout << "Index component type " << A.componentType << " not supported!\n";
+		throw std::runtime_error("Error loading GLTF component");
+	}
+}
+
+#endif
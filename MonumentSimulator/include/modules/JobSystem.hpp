@@ -0,0 +1,125 @@
+// Pool of worker threads, for work split in many small jobs
+//
+// The threads are created once, by init(), and sleep between calls. parallelFor() wakes
+// them, and they (with the calling thread) take batches of items from a shared counter
+// until none is left: a slow batch does not hold the others back. It returns when all
+// the items are done. Only one parallelFor() can run at a time.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// called on the items from first to last - 1
+typedef void (* pJob)(int first, int last, void *params);
+
+class JobSystem {
+  public:
+	// threads: 0 uses all the available cores, counting the calling one
+	void init(int threads = 0);
+	void cleanup();
+	// batch: items per call of job, 0 to split them in a few batches per thread
+	void parallelFor(int count, int batch, pJob job, void *params);
+	int getThreads() {return workers.size() + 1;}
+
+	~JobSystem() {cleanup();}
+
+  private:
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	uint64_t generation = 0;
+	int busy = 0;
+	bool quit = false;
+
+	pJob job;
+	void *jobParams;
+	int jobCount;
+	int jobBatch;
+	std::atomic<int> next{0};
+
+	void workerLoop();
+	void runBatches();
+};
+
+
+#ifdef JOBSYSTEM_IMPLEMENTATION
+
+void JobSystem::init(int threads) {
+	cleanup();
+	if(threads <= 0) {
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	quit = false;
+	for(int i = 1; i < threads; i++) {
+		workers.push_back(std::thread(&JobSystem::workerLoop, this));
+	}
+}
+
+void JobSystem::cleanup() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	for(auto &t : workers) {
+		t.join();
+	}
+	workers.clear();
+}
+
+void JobSystem::runBatches() {
+	int first;
+	while((first = next.fetch_add(jobBatch)) < jobCount) {
+		job(first, std::min(first + jobBatch, jobCount), jobParams);
+	}
+}
+
+void JobSystem::workerLoop() {
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> guard(lock);
+	while(true) {
+		wake.wait(guard, [&] {return quit || (generation != seen);});
+		if(quit) {
+			return;
+		}
+		seen = generation;
+		guard.unlock();
+		runBatches();
+		guard.lock();
+		if(--busy == 0) {
+			done.notify_all();
+		}
+	}
+}
+
+void JobSystem::parallelFor(int count, int batch, pJob job, void *params) {
+	if(batch <= 0) {
+		batch = std::max(1, count / (4 * getThreads()));
+	}
+	if(workers.empty() || (count <= batch)) {
+		if(count > 0) {
+			job(0, count, params);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		this->job = job;
+		jobParams = params;
+		jobCount = count;
+		jobBatch = batch;
+		next = 0;
+		busy = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+	runBatches();
+
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [&] {return busy == 0;});
+}
+
+#endif
@@ -0,0 +1,446 @@
+// Reader of MGCG files: GLTF files compressed with deflate, and encrypted with AES in CBC mode
+//
+// Layout of the decrypted data: the size of the uncompressed content, written as
+// a decimal string in the first 16 bytes, followed by the deflate stream.
+//
+// The file is read once, and decrypted in place. Since each CBC block is decoded
+// from its own cipher text and the one before it, decryption is split among
+// threads, each one saving the last cipher block of the previous range before
+// starting. Blocks are decoded with AES-NI when the CPU supports it.
+// The content is inflated into a buffer that is kept among loads, and grown only
+// when needed: an MGCGReader can be reused to load several files, and released
+// when done.
+//
+// Bundles, written by tools/MGCGPack, pack several files with a table of contents.
+// When mounted they are mapped in memory, or read with a single sequential read on
+// systems without mmap. Entries that are neither compressed nor encrypted can then
+// be accessed in place with view(). Layout (little endian):
+//   header : "MGCB", version, number of entries, size of the table (uint32 each)
+//   table  : for each entry: offset (uint64), stored size, size, flags, name
+//            length (uint32 each), name
+//   blobs  : aligned to 16 bytes. Compressed entries are laid out like MGCG files.
+// Encrypted entries use the IV with its last four bytes xored with the entry index,
+// so that equal files do not produce equal cipher texts.
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <memory>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MGCG_MMAP
+#endif
+
+// requires plusaes.hpp and sinfl.h, included by Starter.hpp
+
+enum MGCGEntryFlags {MGCGF_COMPRESSED = 1, MGCGF_ENCRYPTED = 2};
+const uint32_t MGCG_BUNDLE_VERSION = 1;
+
+// default key (16 chars = 128 bits) and IV of MGCGReader, also used by tools/MGCGPack.
+// Files packed with others need MGCGloader.key and iv to be set before loading them
+const char MGCG_DEFAULT_KEY[] = "CG2023SkelKey128";
+const unsigned char MGCG_DEFAULT_IV[16] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+};
+
+struct MGCGEntry {
+	uint64_t offset;
+	uint32_t storedSize;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t index;
+};
+
+struct MGCGBundle {
+	std::string name;
+	const unsigned char *base = nullptr;
+	size_t length = 0;
+	bool mapped = false;
+	std::vector<unsigned char> content;		// used when the file is not mapped
+	std::unordered_map<std::string, MGCGEntry> entries;
+
+	~MGCGBundle();
+};
+
+struct MGCGReader {
+	std::vector<unsigned char> key;
+	unsigned char iv[16];
+
+	std::vector<unsigned char> file;	// encrypted, then decrypted, file content
+	std::vector<unsigned char> data;	// uncompressed content, reused among loads
+	int size = 0;
+	std::vector<std::shared_ptr<MGCGBundle>> bundles;
+
+	MGCGReader();
+	// returns a pointer to the uncompressed content, valid until the next load
+	const char *load(const std::string &name, int threads = 0);
+
+	// files in bundles mounted later hide the ones with the same name in earlier bundles
+	void mount(const std::string &bundle);
+	const MGCGEntry *find(const std::string &name, int *bundle = nullptr);
+	bool contains(const std::string &name) {return find(name) != nullptr;}
+	bool read(const std::string &name, std::vector<unsigned char> &out, int threads = 0);
+	// zero copy access to stored entries: false if missing, compressed or encrypted.
+	// owner, if given, receives the bundle, that stays mapped as long as it is held
+	bool view(const std::string &name, const unsigned char *&p, size_t &n,
+			  std::shared_ptr<const MGCGBundle> *owner = nullptr);
+
+	void decrypt(unsigned char *p, size_t n, const unsigned char blockIV[16], int threads);
+	int unpack(const unsigned char *p, size_t n, std::vector<unsigned char> &out, const std::string &name);
+	static std::string normalize(const std::string &name);
+	// frees the buffers, and unmounts all the bundles: a bundle is unmapped when
+	// the last view that holds it is released too
+	void release();
+};
+
+// shared by models and asset files
+extern MGCGReader MGCGloader;
+
+
+#ifdef MGCGREADER_IMPLEMENTATION
+
+MGCGReader MGCGloader;
+
+MGCGReader::MGCGReader() {
+	key = plusaes::key_from_string(&MGCG_DEFAULT_KEY);
+	memcpy(iv, MGCG_DEFAULT_IV, 16);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <wmmintrin.h>
+#define MGCG_AESNI
+
+// Decryption round keys for AESDEC: the encryption ones in reverse order,
+// with InvMixColumns applied to all but the first and the last
+__attribute__((target("aes,sse2")))
+static void MGCGdecKeys(const plusaes::detail::RoundKeys &rkeys, __m128i *dk) {
+	int nr = (int)rkeys.size() - 1;
+	for(int i = 0; i <= nr; i++) {
+		__m128i k = _mm_loadu_si128((const __m128i *)&rkeys[nr - i]);
+		dk[i] = ((i == 0) || (i == nr)) ? k : _mm_aesimc_si128(k);
+	}
+}
+
+__attribute__((target("aes,sse2")))
+static inline __m128i MGCGdecBlock(__m128i c, const __m128i *dk, int nr) {
+	c = _mm_xor_si128(c, dk[0]);
+	for(int r = 1; r < nr; r++) {
+		c = _mm_aesdec_si128(c, dk[r]);
+	}
+	return _mm_aesdeclast_si128(c, dk[nr]);
+}
+
+// four blocks are decoded together, to hide the latency of AESDEC
+__attribute__((target("aes,sse2")))
+static void MGCGdecryptCBC_AESNI(const plusaes::detail::RoundKeys &rkeys, unsigned char *p,
+								 size_t blocks, const unsigned char prevBlock[16]) {
+	__m128i dk[15];
+	int nr = (int)rkeys.size() - 1;
+	MGCGdecKeys(rkeys, dk);
+	__m128i prev = _mm_loadu_si128((const __m128i *)prevBlock);
+	size_t i = 0;
+	for(; i + 4 <= blocks; i += 4) {
+		__m128i *q = (__m128i *)(p + i * 16);
+		__m128i c0 = _mm_loadu_si128(q), c1 = _mm_loadu_si128(q + 1);
+		__m128i c2 = _mm_loadu_si128(q + 2), c3 = _mm_loadu_si128(q + 3);
+		__m128i d0 = _mm_xor_si128(c0, dk[0]), d1 = _mm_xor_si128(c1, dk[0]);
+		__m128i d2 = _mm_xor_si128(c2, dk[0]), d3 = _mm_xor_si128(c3, dk[0]);
+		for(int r = 1; r < nr; r++) {
+			d0 = _mm_aesdec_si128(d0, dk[r]);
+			d1 = _mm_aesdec_si128(d1, dk[r]);
+			d2 = _mm_aesdec_si128(d2, dk[r]);
+			d3 = _mm_aesdec_si128(d3, dk[r]);
+		}
+		d0 = _mm_aesdeclast_si128(d0, dk[nr]);
+		d1 = _mm_aesdeclast_si128(d1, dk[nr]);
+		d2 = _mm_aesdeclast_si128(d2, dk[nr]);
+		d3 = _mm_aesdeclast_si128(d3, dk[nr]);
+		_mm_storeu_si128(q,     _mm_xor_si128(d0, prev));
+		_mm_storeu_si128(q + 1, _mm_xor_si128(d1, c0));
+		_mm_storeu_si128(q + 2, _mm_xor_si128(d2, c1));
+		_mm_storeu_si128(q + 3, _mm_xor_si128(d3, c2));
+		prev = c3;
+	}
+	for(; i < blocks; i++) {
+		__m128i *q = (__m128i *)(p + i * 16);
+		__m128i c = _mm_loadu_si128(q);
+		_mm_storeu_si128(q, _mm_xor_si128(MGCGdecBlock(c, dk, nr), prev));
+		prev = c;
+	}
+}
+#endif
+
+// In place CBC decryption of blocks starting at p. prevBlock is the cipher
+// text that precedes them (the IV for the first block of the file).
+static void MGCGdecryptCBC(const plusaes::detail::RoundKeys &rkeys, unsigned char *p,
+						   size_t blocks, const unsigned char prevBlock[16]) {
+#ifdef MGCG_AESNI
+	static const bool hasAESNI = __builtin_cpu_supports("aes");
+	if(hasAESNI) {
+		MGCGdecryptCBC_AESNI(rkeys, p, blocks, prevBlock);
+		return;
+	}
+#endif
+	unsigned char prev[16], c[16];
+	memcpy(prev, prevBlock, 16);
+	for(size_t i = 0; i < blocks; i++) {
+		unsigned char *q = p + i * 16;
+		memcpy(c, q, 16);
+		plusaes::detail::decrypt_state(rkeys, c, q);
+		plusaes::detail::xor_data(q, prev);
+		memcpy(prev, c, 16);
+	}
+}
+
+const char *MGCGReader::load(const std::string &name, int threads) {
+	FILE *f = fopen(name.c_str(), "rb");
+	if(f == nullptr) {
+		std::cout << "Cannot open MGCG file: " << name << "\n";
+		throw std::runtime_error("failed to open file!");
+	}
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if((fileSize < 32) || (fileSize % 16 != 0)) {
+		fclose(f);
+		std::cout << "Invalid MGCG file: " << name << " size: " << fileSize << "\n";
+		throw std::runtime_error("invalid MGCG file!");
+	}
+	file.resize(fileSize);
+	size_t n = fread(file.data(), 1, fileSize, f);
+	fclose(f);
+	if(n != (size_t)fileSize) {
+		throw std::runtime_error("failed to read MGCG file!");
+	}
+
+	decrypt(file.data(), fileSize, iv, threads);
+	size = unpack(file.data(), fileSize, data, name);
+	return (const char *)data.data();
+}
+
+void MGCGReader::decrypt(unsigned char *p, size_t n, const unsigned char blockIV[16], int threads) {
+	const plusaes::detail::RoundKeys rkeys = plusaes::detail::expand_key(key.data(), (int)key.size());
+	size_t blocks = n / 16;
+	if(threads <= 0) {
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	// at least 64 KB per thread
+	int ranges = (int)std::max((size_t)1, std::min((size_t)threads, blocks / 4096));
+	if(ranges == 1) {
+		MGCGdecryptCBC(rkeys, p, blocks, blockIV);
+	} else {
+		// the cipher block before each range is copied before any thread overwrites it
+		std::vector<unsigned char> prev(ranges * 16);
+		std::vector<size_t> start(ranges + 1);
+		for(int i = 0; i <= ranges; i++) {
+			start[i] = blocks * i / ranges;
+		}
+		memcpy(&prev[0], blockIV, 16);
+		for(int i = 1; i < ranges; i++) {
+			memcpy(&prev[i * 16], p + (start[i] - 1) * 16, 16);
+		}
+		std::vector<std::thread> workers;
+		for(int i = 0; i < ranges; i++) {
+			workers.push_back(std::thread(MGCGdecryptCBC, std::cref(rkeys), p + start[i] * 16,
+										  start[i+1] - start[i], &prev[i * 16]));
+		}
+		for(auto &t : workers) {
+			t.join();
+		}
+	}
+
+}
+
+// Inflates decrypted MGCG data (size header and deflate stream) into out,
+// that is grown only when needed. Returns the uncompressed size.
+int MGCGReader::unpack(const unsigned char *p, size_t n, std::vector<unsigned char> &out, const std::string &name) {
+	char header[17];
+	memcpy(header, p, 16);
+	header[16] = '\0';
+	int len = atoi(header);
+	if(len <= 0) {
+		std::cout << "Invalid MGCG header: " << name << "\n";
+		throw std::runtime_error("invalid MGCG file!");
+	}
+	if((int)out.size() < len) {
+		out.resize(len);
+	}
+	int got = sinflate(out.data(), len, p + 16, (int)n - 16);
+	if(got != len) {
+		std::cout << "MGCG file: " << name << " expected " << len << " bytes, got " << got << "\n";
+		throw std::runtime_error("corrupted MGCG file!");
+	}
+	return len;
+}
+
+std::string MGCGReader::normalize(const std::string &name) {
+	std::string N = name;
+	std::replace(N.begin(), N.end(), '\\', '/');
+	while(N.compare(0, 2, "./") == 0) {
+		N.erase(0, 2);
+	}
+	return N;
+}
+
+static uint32_t MGCGget32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+MGCGBundle::~MGCGBundle() {
+#ifdef MGCG_MMAP
+	if(mapped) {
+		munmap((void *)base, length);
+	}
+#endif
+}
+
+void MGCGReader::mount(const std::string &bundle) {
+	std::shared_ptr<MGCGBundle> B = std::make_shared<MGCGBundle>();
+	B->name = bundle;
+	size_t n = 0;
+	long fileSize = 0;
+#ifdef MGCG_MMAP
+	int fd = open(bundle.c_str(), O_RDONLY);
+	struct stat st;
+	if((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size > 0)) {
+		void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(m != MAP_FAILED) {
+			B->base = (const unsigned char *)m;
+			B->mapped = true;
+			n = fileSize = st.st_size;
+		}
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+#endif
+	if(!B->mapped) {
+		FILE *f = fopen(bundle.c_str(), "rb");
+		if(f == nullptr) {
+			std::cout << "Cannot open MGCG bundle: " << bundle << "\n";
+			throw std::runtime_error("failed to open file!");
+		}
+		fseek(f, 0, SEEK_END);
+		fileSize = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		B->content.resize(fileSize);
+		n = fread(B->content.data(), 1, fileSize, f);
+		fclose(f);
+		B->base = B->content.data();
+	}
+	B->length = fileSize;
+
+	const unsigned char *c = B->base;
+	if((n != (size_t)fileSize) || (fileSize < 16) || (memcmp(c, "MGCB", 4) != 0) ||
+	   (MGCGget32(c + 4) != MGCG_BUNDLE_VERSION) || (16 + (uint64_t)MGCGget32(c + 12) > (uint64_t)fileSize)) {
+		std::cout << "Invalid MGCG bundle: " << bundle << "\n";
+		throw std::runtime_error("invalid MGCG bundle!");
+	}
+	uint32_t count = MGCGget32(c + 8);
+	const unsigned char *t = c + 16, *tEnd = t + MGCGget32(c + 12);
+	for(uint32_t i = 0; i < count; i++) {
+		MGCGEntry E;
+		if(t + 24 > tEnd) {
+			break;
+		}
+		E.offset = (uint64_t)MGCGget32(t) | ((uint64_t)MGCGget32(t + 4) << 32);
+		E.storedSize = MGCGget32(t + 8);
+		E.size = MGCGget32(t + 12);
+		E.flags = MGCGget32(t + 16);
+		E.index = i;
+		uint32_t nameLen = MGCGget32(t + 20);
+		t += 24;
+		if((t + nameLen > tEnd) || (E.offset + E.storedSize > (uint64_t)fileSize)) {
+			break;
+		}
+		B->entries[std::string((const char *)t, nameLen)] = E;
+		t += nameLen;
+	}
+	if(B->entries.size() != count) {
+		std::cout << "Corrupted table of contents in MGCG bundle: " << bundle << "\n";
+		throw std::runtime_error("invalid MGCG bundle!");
+	}
+	std::cout << "Mounted MGCG bundle: " << bundle << " - " << count << " files\n";
+	bundles.push_back(B);
+}
+
+const MGCGEntry *MGCGReader::find(const std::string &name, int *bundle) {
+	if(bundles.size() == 0) {
+		return nullptr;
+	}
+	std::string N = normalize(name);
+	for(int b = (int)bundles.size() - 1; b >= 0; b--) {
+		auto el = bundles[b]->entries.find(N);
+		if(el != bundles[b]->entries.end()) {
+			if(bundle != nullptr) {
+				*bundle = b;
+			}
+			return &el->second;
+		}
+	}
+	return nullptr;
+}
+
+bool MGCGReader::read(const std::string &name, std::vector<unsigned char> &out, int threads) {
+	int b;
+	const MGCGEntry *E = find(name, &b);
+	if(E == nullptr) {
+		return false;
+	}
+	const unsigned char *blob = bundles[b]->base + E->offset;
+	if(E->flags == 0) {
+		out.assign(blob, blob + E->size);
+		return true;
+	}
+
+	// the bundle is kept unchanged, so entries are decoded in the scratch buffer
+	file.assign(blob, blob + E->storedSize);
+	if(E->flags & MGCGF_ENCRYPTED) {
+		unsigned char entryIV[16];
+		memcpy(entryIV, iv, 16);
+		for(int i = 0; i < 4; i++) {
+			entryIV[12 + i] ^= (unsigned char)(E->index >> (8 * i));
+		}
+		decrypt(file.data(), file.size(), entryIV, threads);
+	}
+	if(E->flags & MGCGF_COMPRESSED) {
+		out.clear();
+		if(unpack(file.data(), file.size(), out, name) != (int)E->size) {
+			std::cout << "Size mismatch for " << name << " in MGCG bundle: " << bundles[b]->name << "\n";
+			throw std::runtime_error("invalid MGCG bundle!");
+		}
+	} else {
+		out.assign(file.begin(), file.begin() + E->size);
+	}
+	return true;
+}
+
+bool MGCGReader::view(const std::string &name, const unsigned char *&p, size_t &n,
+					  std::shared_ptr<const MGCGBundle> *owner) {
+	int b;
+	const MGCGEntry *E = find(name, &b);
+	if((E == nullptr) || (E->flags != 0)) {
+		return false;
+	}
+	p = bundles[b]->base + E->offset;
+	n = E->size;
+	if(owner != nullptr) {
+		*owner = bundles[b];
+	}
+	return true;
+}
+
+void MGCGReader::release() {
+	std::vector<unsigned char>().swap(file);
+	std::vector<unsigned char>().swap(data);
+	size = 0;
+	bundles.clear();
+}
+
+#endif
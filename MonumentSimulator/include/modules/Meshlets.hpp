@@ -0,0 +1,197 @@
+// Clusters of triangles (meshlets), and their culling on the CPU
+//
+// MeshletBuild() sorts the triangles of a mesh along a Morton curve of their centers, and
+// splits them in clusters of at most maxTriangles consecutive triangles, each in a cell of
+// the octree of the curve: the index buffer
+// is reordered so that each cluster is a single range of indices. Every cluster keeps a
+// bounding sphere, and a cone containing the normals of its triangles.
+// MeshletCull() keeps the clusters inside the view frustum (and, optionally, with at
+// least one triangle facing the camera), and merges the consecutive ones into ranges
+// that can be drawn with one vkCmdDrawIndexed each.
+
+#include <vector>
+#include <cstdint>
+
+// requires glm, included by Starter.hpp
+
+struct Meshlet {
+	glm::vec3 center;		// bounding sphere
+	float radius;
+	glm::vec3 coneAxis;		// average normal of the triangles
+	float coneCutoff;		// sine of the widest angle from the axis, > 1 if they are not all on one side
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+struct MeshletRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+void MeshletBuild(const std::vector<glm::vec3> &positions, std::vector<uint32_t> &indices,
+				  std::vector<Meshlet> &meshlets, int maxTriangles = 128);
+// mvp and eye are in the space of the positions given to MeshletBuild()
+void MeshletCull(const std::vector<Meshlet> &meshlets, const glm::mat4 &mvp, glm::vec3 eye,
+				 bool backfaces, std::vector<MeshletRange> &ranges);
+
+
+#ifdef MESHLETS_IMPLEMENTATION
+
+// interleaves the lower 10 bits of v with two zeros each
+static inline uint32_t MeshletSpread3(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static void MeshletBounds(const std::vector<glm::vec3> &positions, const uint32_t *idx, uint32_t count, Meshlet &M) {
+	glm::vec3 minP = positions[idx[0]], maxP = minP;
+	glm::vec3 sumN(0.0f);
+	for(uint32_t i = 0; i < count; i++) {
+		minP = glm::min(minP, positions[idx[i]]);
+		maxP = glm::max(maxP, positions[idx[i]]);
+	}
+	M.center = (minP + maxP) * 0.5f;
+	float r2 = 0.0f;
+	for(uint32_t i = 0; i < count; i++) {
+		glm::vec3 d = positions[idx[i]] - M.center;
+		r2 = std::max(r2, glm::dot(d, d));
+	}
+	M.radius = std::sqrt(r2);
+
+	// cone of the face normals, with the counter clockwise triangles facing out
+	std::vector<glm::vec3> normals;
+	normals.reserve(count / 3);
+	for(uint32_t i = 0; i + 2 < count; i += 3) {
+		glm::vec3 a = positions[idx[i]], b = positions[idx[i + 1]], c = positions[idx[i + 2]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float l = glm::length(n);
+		if(l > 0.0f) {
+			normals.push_back(n / l);
+			sumN += n / l;
+		}
+	}
+	float l = glm::length(sumN);
+	M.coneAxis = (l > 0.0f) ? sumN / l : glm::vec3(0.0f, 0.0f, 1.0f);
+	M.coneCutoff = 2.0f;
+	if(l > 0.0f) {
+		float minDot = 1.0f;
+		for(auto &n : normals) {
+			minDot = std::min(minDot, glm::dot(n, M.coneAxis));
+		}
+		if(minDot > 0.0f) {
+			M.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+	}
+}
+
+// splits the sorted triangles from first to last where the highest bit of their codes
+// changes, until the parts are small enough: each cluster is then a cell of an octree
+static void MeshletSplit(const std::vector<uint64_t> &keys, size_t first, size_t last, int maxTriangles,
+						 std::vector<std::pair<size_t, size_t>> &parts) {
+	if(last - first <= (size_t)maxTriangles) {
+		parts.push_back({first, last});
+		return;
+	}
+	uint32_t a = (uint32_t)(keys[first] >> 32), b = (uint32_t)(keys[last - 1] >> 32);
+	size_t mid = first + (last - first) / 2;
+	if(a != b) {
+		uint32_t bit = 1u << 31;
+		while(((a ^ b) & bit) == 0) {
+			bit >>= 1;
+		}
+		mid = std::lower_bound(keys.begin() + first, keys.begin() + last, ((uint64_t)(b & ~(bit - 1))) << 32) - keys.begin();
+	}
+	MeshletSplit(keys, first, mid, maxTriangles, parts);
+	MeshletSplit(keys, mid, last, maxTriangles, parts);
+}
+
+void MeshletBuild(const std::vector<glm::vec3> &positions, std::vector<uint32_t> &indices,
+				  std::vector<Meshlet> &meshlets, int maxTriangles) {
+	meshlets.clear();
+	size_t triCount = indices.size() / 3;
+	if(triCount == 0) {
+		return;
+	}
+
+	glm::vec3 minP = positions[indices[0]], maxP = minP;
+	for(uint32_t i : indices) {
+		minP = glm::min(minP, positions[i]);
+		maxP = glm::max(maxP, positions[i]);
+	}
+	// same scale on all the axes, or flat meshes (e.g. terrains) get clusters as long strips
+	glm::vec3 ext = maxP - minP;
+	float maxExt = std::max(ext.x, std::max(ext.y, ext.z));
+	float toGrid = (maxExt > 0.0f) ? 1023.0f / maxExt : 0.0f;
+
+	// triangles sorted by the Morton code of their centers
+	std::vector<uint64_t> keys(triCount);
+	for(size_t t = 0; t < triCount; t++) {
+		glm::vec3 c = (positions[indices[3 * t]] + positions[indices[3 * t + 1]] +
+					   positions[indices[3 * t + 2]]) * (1.0f / 3.0f);
+		glm::vec3 g = (c - minP) * toGrid;
+		uint32_t code = MeshletSpread3((uint32_t)g.x) | (MeshletSpread3((uint32_t)g.y) << 1) |
+						(MeshletSpread3((uint32_t)g.z) << 2);
+		keys[t] = ((uint64_t)code << 32) | t;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<uint32_t> sorted(triCount * 3);
+	for(size_t t = 0; t < triCount; t++) {
+		uint32_t src = (uint32_t)keys[t];
+		sorted[3 * t] = indices[3 * src];
+		sorted[3 * t + 1] = indices[3 * src + 1];
+		sorted[3 * t + 2] = indices[3 * src + 2];
+	}
+	indices.swap(sorted);
+
+	std::vector<std::pair<size_t, size_t>> parts;
+	MeshletSplit(keys, 0, triCount, maxTriangles, parts);
+	meshlets.reserve(parts.size());
+	for(auto &P : parts) {
+		Meshlet M;
+		M.firstIndex = (uint32_t)(3 * P.first);
+		M.indexCount = (uint32_t)(3 * (P.second - P.first));
+		MeshletBounds(positions, &indices[M.firstIndex], M.indexCount, M);
+		meshlets.push_back(M);
+	}
+}
+
+void MeshletCull(const std::vector<Meshlet> &meshlets, const glm::mat4 &mvp, glm::vec3 eye,
+				 bool backfaces, std::vector<MeshletRange> &ranges) {
+	// planes of the frustum, with depth in [0, 1]
+	glm::vec4 row[4];
+	for(int i = 0; i < 4; i++) {
+		row[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+	}
+	glm::vec4 planes[5] = {row[3] + row[0], row[3] - row[0], row[3] + row[1], row[3] - row[1], row[2]};
+	for(auto &p : planes) {
+		p /= glm::length(glm::vec3(p));
+	}
+
+	ranges.clear();
+	for(const Meshlet &M : meshlets) {
+		bool visible = true;
+		for(int i = 0; (i < 5) && visible; i++) {
+			visible = glm::dot(glm::vec3(planes[i]), M.center) + planes[i].w > -M.radius;
+		}
+		if(visible && backfaces) {
+			// all the triangles face away, from anywhere in the sphere
+			glm::vec3 d = M.center - eye;
+			visible = glm::dot(d, M.coneAxis) < M.coneCutoff * glm::length(d) + M.radius;
+		}
+		if(!visible) {
+			continue;
+		}
+		if(!ranges.empty() && (ranges.back().firstIndex + ranges.back().indexCount == M.firstIndex)) {
+			ranges.back().indexCount += M.indexCount;
+		} else {
+			ranges.push_back({M.firstIndex, M.indexCount});
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,374 @@
+// PNG encoder based on the sdefl compressor
+//
+// The image is split in horizontal strips, and each strip is filtered and
+// compressed by its own thread. Strips are emitted as separate IDAT chunks
+// forming a single zlib stream: all but the last one end with an empty
+// stored block, that leaves the stream byte aligned without closing it.
+// Since each strip starts with an empty dictionary, compression is slightly
+// worse than with a single thread.
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <sdefl.h>
+
+enum PNGFilter {PNGF_NONE, PNGF_SUB, PNGF_UP, PNGF_AVERAGE, PNGF_PAETH, PNGF_ADAPTIVE};
+
+// level: from SDEFL_LVL_MIN (fastest) to SDEFL_LVL_MAX (smallest)
+// threads: 0 uses all the available cores
+bool EncodePNG(std::vector<unsigned char> &out, int w, int h, int comp,
+			   const unsigned char *data, int stride,
+			   int level = 1, PNGFilter filter = PNGF_ADAPTIVE, int threads = 0);
+bool WritePNG(const char *filename, int w, int h, int comp,
+			  const unsigned char *data, int stride,
+			  int level = 1, PNGFilter filter = PNGF_ADAPTIVE, int threads = 0);
+
+
+#ifdef PNGWRITER_IMPLEMENTATION
+
+struct PNGCRCTables {
+	uint32_t t[4][256];
+	
+	PNGCRCTables() {
+		for(uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for(int k = 0; k < 8; k++) {
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			t[0][n] = c;
+		}
+		for(uint32_t n = 0; n < 256; n++) {
+			for(int i = 1; i < 4; i++) {
+				t[i][n] = (t[i-1][n] >> 8) ^ t[0][t[i-1][n] & 0xFF];
+			}
+		}
+	}
+};
+
+// built on first use: the encoders of several threads can get here together
+static const PNGCRCTables &PNGgetCRCTables() {
+	static const PNGCRCTables T;
+	return T;
+}
+
+// slice-by-4 CRC32
+static uint32_t PNGcrc(uint32_t crc, const unsigned char *p, size_t n) {
+	const uint32_t (&PNGcrcTable)[4][256] = PNGgetCRCTables().t;
+	crc = ~crc;
+	for(; n >= 4; n -= 4, p += 4) {
+		crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		crc = PNGcrcTable[3][crc & 0xFF] ^ PNGcrcTable[2][(crc >> 8) & 0xFF] ^
+			  PNGcrcTable[1][(crc >> 16) & 0xFF] ^ PNGcrcTable[0][crc >> 24];
+	}
+	for(; n > 0; n--, p++) {
+		crc = PNGcrcTable[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Adler32 of the concatenation of two blocks, the second of length len2
+static uint32_t PNGadlerCombine(uint32_t adler1, uint32_t adler2, size_t len2) {
+	const uint32_t BASE = 65521;
+	uint32_t rem = (uint32_t)(len2 % BASE);
+	uint32_t sum1 = adler1 & 0xffff;
+	uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % BASE);
+	sum1 += (adler2 & 0xffff) + BASE - 1;
+	sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + BASE - rem;
+	if(sum1 >= BASE) sum1 -= BASE;
+	if(sum1 >= BASE) sum1 -= BASE;
+	if(sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+	if(sum2 >= BASE) sum2 -= BASE;
+	return sum1 | (sum2 << 16);
+}
+
+static inline unsigned char PNGpaeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if((pa <= pb) && (pa <= pc)) return (unsigned char)a;
+	if(pb <= pc) return (unsigned char)b;
+	return (unsigned char)c;
+}
+
+// Filters one row into out[0..rowBytes], out[0] being the filter type.
+// prev is nullptr for the first row of the image.
+static void PNGfilterRow(unsigned char *out, const unsigned char *row, const unsigned char *prev,
+						 int rowBytes, int bpp, int type) {
+	out[0] = (unsigned char)type;
+	unsigned char *o = out + 1;
+	int i;
+	switch(type) {
+	  case PNGF_NONE:
+		memcpy(o, row, rowBytes);
+		break;
+	  case PNGF_SUB:
+		for(i = 0; i < bpp; i++) o[i] = row[i];
+		for(; i < rowBytes; i++) o[i] = row[i] - row[i - bpp];
+		break;
+	  case PNGF_UP:
+		if(prev == nullptr) {
+			memcpy(o, row, rowBytes);
+		} else {
+			for(i = 0; i < rowBytes; i++) o[i] = row[i] - prev[i];
+		}
+		break;
+	  case PNGF_AVERAGE:
+		if(prev == nullptr) {
+			for(i = 0; i < bpp; i++) o[i] = row[i];
+			for(; i < rowBytes; i++) o[i] = row[i] - (row[i - bpp] >> 1);
+		} else {
+			for(i = 0; i < bpp; i++) o[i] = row[i] - (prev[i] >> 1);
+			for(; i < rowBytes; i++) o[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+		}
+		break;
+	  case PNGF_PAETH:
+		if(prev == nullptr) {
+			// with an all zero previous row, Paeth is the same as Sub
+			for(i = 0; i < bpp; i++) o[i] = row[i];
+			for(; i < rowBytes; i++) o[i] = row[i] - row[i - bpp];
+		} else {
+			for(i = 0; i < bpp; i++) o[i] = row[i] - prev[i];
+			for(; i < rowBytes; i++) o[i] = row[i] - PNGpaeth(row[i - bpp], prev[i], prev[i - bpp]);
+		}
+		break;
+	}
+}
+
+// Cost used by the adaptive filter: sum of the residuals seen as signed values
+static uint32_t PNGfilterCost(const unsigned char *o, int rowBytes) {
+	uint32_t sum = 0;
+	for(int i = 0; i < rowBytes; i++) {
+		sum += (o[i] < 128) ? o[i] : 256 - o[i];
+	}
+	return sum;
+}
+
+// Same as sdefl_compr(), but the last block is marked final only when last is true.
+// Otherwise the stream is byte aligned with an empty stored block.
+// Blocks are also closed when the sequence buffer is about to fill up: sdefl sizes
+// it for matches only, and many short literal runs would overflow it.
+static int PNGdeflateStrip(struct sdefl *s, unsigned char *out, const unsigned char *in,
+						   int in_len, int lvl, bool last) {
+	unsigned char *q = out;
+	static const unsigned char pref[] = {8,10,14,24,30,48,65,96,130};
+	int max_chain = (lvl < 8) ? (1 << (lvl + 1)): (1 << 13);
+	int n, i = 0, litlen = 0;
+	s->bits = s->bitcnt = 0;
+	for(n = 0; n < SDEFL_HASH_SIZ; ++n) {
+		s->tbl[n] = SDEFL_NIL;
+	}
+	do {
+		int blk_end = ((i + SDEFL_BLK_MAX) < in_len) ? (i + SDEFL_BLK_MAX) : in_len;
+		while((i < blk_end) && (s->seq_cnt + 5 < SDEFL_SEQ_SIZ)) {
+			struct sdefl_match m{};
+			int left = blk_end - i;
+			int max_match = (left >= SDEFL_MAX_MATCH) ? SDEFL_MAX_MATCH : left;
+			int nice_match = pref[lvl] < max_match ? pref[lvl] : max_match;
+			int run = 1, inc = 1, run_inc = 0;
+			if(max_match > SDEFL_MIN_MATCH) {
+				sdefl_fnd(&m, s, max_chain, max_match, in, i);
+			}
+			if(lvl >= 5 && m.len >= SDEFL_MIN_MATCH && m.len < nice_match) {
+				struct sdefl_match m2{};
+				sdefl_fnd(&m2, s, max_chain, m.len+1, in, i+1);
+				m.len = (m2.len > m.len) ? 0 : m.len;
+			}
+			if(m.len >= SDEFL_MIN_MATCH) {
+				if(litlen) {
+					sdefl_seq(s, i - litlen, litlen);
+					litlen = 0;
+				}
+				sdefl_seq(s, -m.off, m.len);
+				sdefl_reg_match(s, m.off, m.len);
+				if(lvl < 2 && m.len >= nice_match) {
+					inc = m.len;
+				} else {
+					run = m.len;
+				}
+			} else {
+				s->freq.lit[in[i]]++;
+				litlen++;
+			}
+			run_inc = run * inc;
+			if(in_len - (i + run_inc) > SDEFL_MIN_MATCH) {
+				while(run-- > 0) {
+					unsigned h = sdefl_hash32(&in[i]);
+					s->prv[i&SDEFL_WIN_MSK] = s->tbl[h];
+					s->tbl[h] = i, i += inc;
+				}
+			} else {
+				i += run_inc;
+			}
+		}
+		if(litlen) {
+			sdefl_seq(s, i - litlen, litlen);
+			litlen = 0;
+		}
+		sdefl_flush(&q, s, last && (i == in_len), in);
+	} while(i < in_len);
+
+	if(!last) {
+		sdefl_put(&q, s, 0x00, 3);	// non final stored block
+	}
+	if(s->bitcnt) {
+		sdefl_put(&q, s, 0x00, 8 - s->bitcnt);
+	}
+	if(!last) {
+		*q++ = 0x00; *q++ = 0x00; *q++ = 0xFF; *q++ = 0xFF;
+	}
+	return (int)(q - out);
+}
+
+struct PNGstrip {
+	int y0, y1;
+	std::vector<unsigned char> chunk;	// complete IDAT chunk
+	uint32_t adler;
+	size_t rawLen;
+};
+
+static void PNGput32(unsigned char *p, uint32_t v) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void PNGencodeStrip(PNGstrip &S, int w, int comp, const unsigned char *data, int stride,
+						   int level, PNGFilter filter, bool first, bool last) {
+	int rowBytes = w * comp;
+	size_t rawLen = (size_t)(S.y1 - S.y0) * (rowBytes + 1);
+	std::vector<unsigned char> raw(rawLen);
+	std::vector<unsigned char> tmp(filter == PNGF_ADAPTIVE ? rowBytes + 1 : 0);
+
+	for(int y = S.y0; y < S.y1; y++) {
+		const unsigned char *row = data + (size_t)y * stride;
+		const unsigned char *prev = (y > 0) ? row - stride : nullptr;
+		unsigned char *out = &raw[(size_t)(y - S.y0) * (rowBytes + 1)];
+		if(filter == PNGF_ADAPTIVE) {
+			uint32_t best = 0xFFFFFFFFu;
+			for(int t = PNGF_NONE; t <= PNGF_PAETH; t++) {
+				PNGfilterRow(tmp.data(), row, prev, rowBytes, comp, t);
+				uint32_t cost = PNGfilterCost(tmp.data() + 1, rowBytes);
+				if(cost < best) {
+					best = cost;
+					memcpy(out, tmp.data(), rowBytes + 1);
+				}
+			}
+		} else {
+			PNGfilterRow(out, row, prev, rowBytes, comp, filter);
+		}
+	}
+
+	// chunk: length, "IDAT", [zlib header], deflate data, crc
+	struct sdefl *sd = (struct sdefl *)calloc(1, sizeof(struct sdefl));
+	S.chunk.resize(8 + 2 + sdefl_bound((int)rawLen) + 5 + 4);
+	unsigned char *p = &S.chunk[8];
+	if(first) {
+		*p++ = 0x78;
+		*p++ = 0x01;
+	}
+	p += PNGdeflateStrip(sd, p, raw.data(), (int)rawLen, level, last);
+	free(sd);
+
+	uint32_t len = (uint32_t)(p - &S.chunk[8]);
+	PNGput32(&S.chunk[0], len);
+	memcpy(&S.chunk[4], "IDAT", 4);
+	PNGput32(p, PNGcrc(0, &S.chunk[4], len + 4));
+	S.chunk.resize(len + 12);
+
+	S.adler = sdefl_adler32(1, raw.data(), (int)rawLen);
+	S.rawLen = rawLen;
+}
+
+static void PNGappendChunk(std::vector<unsigned char> &out, const char *type,
+						   const unsigned char *data, uint32_t len) {
+	size_t pos = out.size();
+	out.resize(pos + len + 12);
+	PNGput32(&out[pos], len);
+	memcpy(&out[pos + 4], type, 4);
+	if(len > 0) {
+		memcpy(&out[pos + 8], data, len);
+	}
+	PNGput32(&out[pos + 8 + len], PNGcrc(0, &out[pos + 4], len + 4));
+}
+
+bool EncodePNG(std::vector<unsigned char> &out, int w, int h, int comp,
+			   const unsigned char *data, int stride,
+			   int level, PNGFilter filter, int threads) {
+	static const unsigned char colorType[] = {0, 0, 4, 2, 6};
+	if((comp < 1) || (comp > 4) || (w <= 0) || (h <= 0)) {
+		return false;
+	}
+	level = std::max(SDEFL_LVL_MIN, std::min(level, SDEFL_LVL_MAX));
+
+	if(threads <= 0) {
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	// strips smaller than the deflate window would compress too badly
+	int minRows = std::max(1, (32 * 1024) / (w * comp + 1));
+	int nStrips = std::max(1, std::min(threads, h / minRows));
+
+	std::vector<PNGstrip> strips(nStrips);
+	for(int i = 0; i < nStrips; i++) {
+		strips[i].y0 = (int)((int64_t)h * i / nStrips);
+		strips[i].y1 = (int)((int64_t)h * (i + 1) / nStrips);
+	}
+	if(nStrips == 1) {
+		PNGencodeStrip(strips[0], w, comp, data, stride, level, filter, true, true);
+	} else {
+		std::vector<std::thread> workers;
+		for(int i = 0; i < nStrips; i++) {
+			workers.push_back(std::thread(PNGencodeStrip, std::ref(strips[i]), w, comp, data, stride,
+										  level, filter, i == 0, i == nStrips - 1));
+		}
+		for(auto &t : workers) {
+			t.join();
+		}
+	}
+
+	uint32_t adler = strips[0].adler;
+	for(int i = 1; i < nStrips; i++) {
+		adler = PNGadlerCombine(adler, strips[i].adler, strips[i].rawLen);
+	}
+
+	static const unsigned char sig[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	out.assign(sig, sig + 8);
+	unsigned char ihdr[13];
+	PNGput32(ihdr, w);
+	PNGput32(ihdr + 4, h);
+	ihdr[8] = 8;
+	ihdr[9] = colorType[comp];
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	PNGappendChunk(out, "IHDR", ihdr, 13);
+	for(auto &S : strips) {
+		out.insert(out.end(), S.chunk.begin(), S.chunk.end());
+	}
+	// the zlib checksum closes the stream in a chunk of its own
+	unsigned char adlerBytes[4];
+	PNGput32(adlerBytes, adler);
+	PNGappendChunk(out, "IDAT", adlerBytes, 4);
+	PNGappendChunk(out, "IEND", nullptr, 0);
+	return true;
+}
+
+bool WritePNG(const char *filename, int w, int h, int comp,
+			  const unsigned char *data, int stride,
+			  int level, PNGFilter filter, int threads) {
+	std::vector<unsigned char> png;
+	if(!EncodePNG(png, w, h, comp, data, stride, level, filter, threads)) {
+		return false;
+	}
+	FILE *f = fopen(filename, "wb");
+	if(f == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(png.data(), 1, png.size(), f) == png.size();
+	fclose(f);
+	return ok;
+}
+
+#endif
@@ -61,6 +61,10 @@ class Scene {
 	int AssetFileCount = 0;
 	AssetFile **As;
 	std::unordered_map<std::string, int> AsIds;
+	// the animations of each asset file, nullptr if it has none
+	Animations **Anims;
+	// instances moved by an animation track
+	RigidAnimations RA;
 
 	// Models
 	int ModelCount = 0;
@@ -92,6 +96,8 @@ class Scene {
 	void pipelinesAndDescriptorSetsInit();
 	void pipelinesAndDescriptorSetsCleanup();
 	void localCleanup();
+	// advances the animated instances by dt, and updates their Wm
+	void updateAnimations(float dt);
     void populateCommandBuffer(VkCommandBuffer commandBuffer, int passId, int currentImage);
 };
 
@@ -127,15 +133,14 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 
 	// Models, textures and Descriptors (values assigned to the uniforms)
 	nlohmann::json js;
-	std::ifstream ifs(file);
-	if (!ifs.is_open()) {
+	VFSFile sceneFile;
+	if (!VFSRead(file, sceneFile)) {
 	  std::cout << "Error! Scene file >" << file << "< not found!";
 	  exit(-1);
 	}
 //		try {
 		std::cout << "Parsing JSON\n";
-		ifs >> js;
-		ifs.close();
+		js = nlohmann::json::parse(sceneFile.data, sceneFile.data + sceneFile.size);
 		std::cout << "\nScene contains " << js.size() << " definitions sections\n\n";
 		
 		// ASSET FILES
@@ -144,6 +149,11 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 		std::cout << "Asset Files count: " << AssetFileCount << "\n";
 
 		As = (AssetFile **)calloc(AssetFileCount, sizeof(AssetFile *));
+		Anims = (Animations **)calloc(AssetFileCount, sizeof(Animations *));
+		// the animations of each file are imported in parallel, by threads started with
+		// the first file that has any, and stopped when the scene is loaded
+		JobSystem importJobs;
+		bool importJobsStarted = false;
 		for(int k = 0; k < AssetFileCount; k++) {
 			AsIds[afs[k]["id"]] = k;
 			std::string MT = afs[k]["format"].template get<std::string>();
@@ -152,31 +162,31 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 			As[k]->init(afs[k]["file"], (MT[0] == 'O') ? OBJ : ((MT[0] == 'G') ? GLTF : MGCG));
 			if (MT[0] == 'G') {
 				// Solo se è un GLTF
-				tinygltf::TinyGLTF loader;
-				tinygltf::Model model;
-				std::string warn, err;
+				// (uses the model just loaded by the asset file, rather than reading it again)
+				const tinygltf::Model &model = *As[k]->getGLTFmodel();
 				std::string path = afs[k]["file"];
-
-				bool ok = loader.LoadASCIIFromFile(&model, &warn, &err, path);
-				if (!ok) {
-					std::cerr << "Failed to load GLTF file for debug: " << path << "\n";
-					std::cerr << "Error: " << err << "\n";
-				} else {
-					std::cout << "\n=== DEBUG INFO FROM: " << path << " ===\n";
-					for (size_t m = 0; m < model.meshes.size(); ++m) {
-						const auto& mesh = model.meshes[m];
-						std::cout << "Mesh " << m << ": " << mesh.name << "\n";
-						for (size_t p = 0; p < mesh.primitives.size(); ++p) {
-							const auto& prim = mesh.primitives[p];
-							std::cout << "  Primitive " << p << ":\n";
-							for (const auto& attr : prim.attributes) {
-								std::cout << "    Attribute: " << attr.first << "\n";
-							}
+				std::cout << "\n=== DEBUG INFO FROM: " << path << " ===\n";
+				for (size_t m = 0; m < model.meshes.size(); ++m) {
+					const auto& mesh = model.meshes[m];
+					std::cout << "Mesh " << m << ": " << mesh.name << "\n";
+					for (size_t p = 0; p < mesh.primitives.size(); ++p) {
+						const auto& prim = mesh.primitives[p];
+						std::cout << "  Primitive " << p << ":\n";
+						for (const auto& attr : prim.attributes) {
+							std::cout << "    Attribute: " << attr.first << "\n";
 						}
 					}
-					std::cout << "Skins: " << model.skins.size() << "\n";
-					std::cout << "Animations: " << model.animations.size() << "\n";
-					std::cout << "===============================\n";
+				}
+				std::cout << "Skins: " << model.skins.size() << "\n";
+				std::cout << "Animations: " << model.animations.size() << "\n";
+				std::cout << "===============================\n";
+				if(model.animations.size() > 0) {
+					if(!importJobsStarted) {
+						importJobs.init();
+						importJobsStarted = true;
+					}
+					Anims[k] = new Animations();
+					Anims[k]->init(*As[k], &importJobs);
 				}
 			}
 
@@ -326,6 +336,24 @@ std::cout << "\n";
 					for(int h = 0; h < 16; h++) {TMj[h] = TMjson[h];}
 					TI[k].I[j].Wm = glm::mat4(TMj[0],TMj[4],TMj[8],TMj[12],TMj[1],TMj[5],TMj[9],TMj[13],TMj[2],TMj[6],TMj[10],TMj[14],TMj[3],TMj[7],TMj[11],TMj[15]);
 				}	
+				// "animation": {"asset": <asset file id>, "track": <name>, "speed": 1.0, "time": 0.0}
+				// the track transform is applied after the one above
+				nlohmann::json ANjson = is[j]["animation"];
+				if(!ANjson.is_null()) {
+					std::string AN = ANjson["asset"].template get<std::string>();
+					std::string TN = ANjson["track"].template get<std::string>();
+					auto aEl = AsIds.find(AN);
+					AnimTrack *AT = nullptr;
+					if(aEl == AsIds.end()) {
+						std::cout << "Asset file >" << AN << "< of animation track >" << TN << "< not found\n";
+					} else if((Anims[aEl->second] == nullptr) ||
+							  ((AT = Anims[aEl->second]->getAnim(TN)) == nullptr)) {
+						std::cout << "Animation track >" << TN << "< not found in >" << AN << "<\n";
+					} else {
+						RA.add(AT, &TI[k].I[j].Wm, TI[k].I[j].Wm,
+							   ANjson.value("time", 0.0f), ANjson.value("speed", 1.0f));
+					}
+				}
 				TI[k].I[j].TIp = &TI[k];
 				TI[k].I[j].D = (std::vector<DescriptorSetLayout *> **)calloc(sizeof(std::vector<DescriptorSetLayout *> *), Npasses);
 				TI[k].I[j].NDs = (int *)calloc(sizeof(int), Npasses);
@@ -340,6 +368,8 @@ std::cout << "\n";
 						for (int l = 0; l < DSLsize; l++) {
 							if(DSL->Bindings[l].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
 								BP->DPSZs.uniformBlocksInPool += 1;
+							} else if(DSL->Bindings[l].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+								BP->DPSZs.storageBlocksInPool += 1;
 							} else {
 								BP->DPSZs.texturesInPool += 1;
 							}
@@ -456,6 +486,23 @@ void Scene::localCleanup() {
 		free(TI[i].I);
 	}
 	free(TI);
+	// the bindings write into the instances just freed
+	RA.clear();
+
+	for(int i = 0; i < AssetFileCount; i++) {
+		if(Anims[i] != nullptr) {
+			Anims[i]->cleanup();
+			delete Anims[i];
+		}
+	}
+	free(Anims);
+}
+
+void Scene::updateAnimations(float dt) {
+	if(RA.size() > 0) {
+		RA.Advance(dt);
+		RA.Update();
+	}
 }
 
 void Scene::populateCommandBuffer(VkCommandBuffer commandBuffer, int passId, int currentImage) {
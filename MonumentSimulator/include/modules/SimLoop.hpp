@@ -0,0 +1,115 @@
+// Fixed timestep simulation, on its own thread
+//
+// SimLoop calls the step function at a fixed rate (120 Hz by default), with the last
+// input given by the render thread, and publishes the last two states. The render thread
+// reads them with getStates(), and interpolates with the returned factor: what is drawn
+// is one step behind the simulation, but moves smoothly at any frame rate, while the
+// simulation advances by the same time step whatever the frame rate is.
+// GLFW must be polled on the main thread: the input is read there, and passed with
+// setInput().
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+template <class State, class Input>
+class SimLoop {
+  public:
+	typedef void (* pSimStep)(State &S, const Input &I, float dt, void *params);
+
+	void start(const State &initial, pSimStep step, void *params, float rate = 120.0f);
+	void stop();
+	void setInput(const Input &I);
+	// previous and current state, and where the render time is between them (0 to 1)
+	float getStates(State &prev, State &curr);
+	uint64_t getSteps() {return steps;}
+	float getStepTime() {return dt;}
+
+	~SimLoop() {stop();}
+
+  private:
+	typedef std::chrono::steady_clock clock;
+
+	std::thread worker;
+	std::atomic<bool> running{false};
+	pSimStep stepFunc;
+	void *stepParams;
+	float dt;
+
+	std::mutex lock;
+	// double buffered: the simulation works on its own copy, and publishes it at each step
+	State published[2];
+	int current = 0;
+	clock::time_point currentTime;
+	Input input;
+	std::atomic<uint64_t> steps{0};	// also read by getSteps(), without the lock
+
+	void run(State S);
+};
+
+template <class State, class Input>
+void SimLoop<State, Input>::start(const State &initial, pSimStep step, void *params, float rate) {
+	stop();
+	stepFunc = step;
+	stepParams = params;
+	dt = 1.0f / rate;
+	published[0] = published[1] = initial;
+	current = 0;
+	currentTime = clock::now();
+	input = Input{};
+	steps = 0;
+	running = true;
+	worker = std::thread(&SimLoop::run, this, initial);
+}
+
+template <class State, class Input>
+void SimLoop<State, Input>::stop() {
+	running = false;
+	if(worker.joinable()) {
+		worker.join();
+	}
+}
+
+template <class State, class Input>
+void SimLoop<State, Input>::setInput(const Input &I) {
+	std::lock_guard<std::mutex> guard(lock);
+	input = I;
+}
+
+template <class State, class Input>
+float SimLoop<State, Input>::getStates(State &prev, State &curr) {
+	std::lock_guard<std::mutex> guard(lock);
+	prev = published[1 - current];
+	curr = published[current];
+	float alpha = std::chrono::duration<float>(clock::now() - currentTime).count() / dt;
+	return std::max(0.0f, std::min(alpha, 1.0f));
+}
+
+template <class State, class Input>
+void SimLoop<State, Input>::run(State S) {
+	const auto step = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(dt));
+	auto next = clock::now() + step;
+	while(running) {
+		std::this_thread::sleep_until(next);
+		// after a stall (e.g. a breakpoint, or the window being moved) the lost time is
+		// dropped, instead of running many steps in a row
+		if(clock::now() - next > step * 30) {
+			next = clock::now();
+		}
+
+		Input I;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			I = input;
+		}
+		stepFunc(S, I, dt, stepParams);
+
+		std::lock_guard<std::mutex> guard(lock);
+		current = 1 - current;
+		published[current] = S;
+		currentTime = next;
+		steps++;
+		next += step;
+	}
+}
@@ -0,0 +1,305 @@
+// Mesh simplification with quadric error metrics
+//
+// SimplifyMesh() reduces the triangles of an indexed mesh by collapsing vertices onto one
+// of their neighbors (Garland and Heckbert quadrics, area weighted). No vertex is created
+// or moved: the result is a new list of indices into the same vertex buffer, so all the
+// levels of detail of a model can share it.
+// Vertices are welded first by their whole content, then by position. Positions with more
+// than one welded vertex (seams of UVs or normals), and positions on the border of the
+// mesh, are never collapsed, so seams and outlines are kept.
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+
+// requires glm, included by Starter.hpp
+
+// Returns the largest error of the collapses, as a distance in the units of positions.
+// indices is a list of triangles, vertexData has a vertex every stride bytes, and
+// positions has the position of every vertex.
+float SimplifyMesh(const unsigned char *vertexData, int stride, const std::vector<glm::vec3> &positions,
+				   const uint32_t *indices, size_t indexCount, size_t targetIndexCount,
+				   std::vector<uint32_t> &out);
+
+
+#ifdef SIMPLIFY_IMPLEMENTATION
+
+// symmetric 4x4 matrix of a quadric, and the sum of the weights of its planes
+struct SimplifyQuadric {
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+	double w;
+};
+
+static void SimplifyAddPlane(SimplifyQuadric &Q, glm::vec3 n, float d, double w) {
+	Q.a00 += w * n.x * n.x; Q.a01 += w * n.x * n.y; Q.a02 += w * n.x * n.z; Q.a03 += w * n.x * d;
+	Q.a11 += w * n.y * n.y; Q.a12 += w * n.y * n.z; Q.a13 += w * n.y * d;
+	Q.a22 += w * n.z * n.z; Q.a23 += w * n.z * d;
+	Q.a33 += w * d * d;
+	Q.w += w;
+}
+
+static void SimplifyAdd(SimplifyQuadric &Q, const SimplifyQuadric &R) {
+	Q.a00 += R.a00; Q.a01 += R.a01; Q.a02 += R.a02; Q.a03 += R.a03;
+	Q.a11 += R.a11; Q.a12 += R.a12; Q.a13 += R.a13;
+	Q.a22 += R.a22; Q.a23 += R.a23;
+	Q.a33 += R.a33;
+	Q.w += R.w;
+}
+
+// mean squared distance of p from the planes
+static double SimplifyError(const SimplifyQuadric &Q, glm::vec3 p) {
+	double x = p.x, y = p.y, z = p.z;
+	double e = Q.a00 * x * x + 2 * Q.a01 * x * y + 2 * Q.a02 * x * z + 2 * Q.a03 * x
+			 + Q.a11 * y * y + 2 * Q.a12 * y * z + 2 * Q.a13 * y
+			 + Q.a22 * z * z + 2 * Q.a23 * z
+			 + Q.a33;
+	return (Q.w > 0.0) ? std::max(e, 0.0) / Q.w : 0.0;
+}
+
+// For every vertex, the first vertex with the same key (bytes, or position)
+template <class Equal, class Hash>
+static void SimplifyWeld(size_t count, const std::vector<uint8_t> &used, std::vector<uint32_t> &first,
+						 Hash hash, Equal equal) {
+	size_t size = 1;
+	while(size < count * 2) {
+		size *= 2;
+	}
+	std::vector<uint32_t> table(size, UINT32_MAX);
+	first.assign(count, UINT32_MAX);
+	for(uint32_t v = 0; v < count; v++) {
+		if(!used[v]) {
+			continue;
+		}
+		size_t h = hash(v) & (size - 1);
+		while((table[h] != UINT32_MAX) && !equal(table[h], v)) {
+			h = (h + 1) & (size - 1);
+		}
+		if(table[h] == UINT32_MAX) {
+			table[h] = v;
+		}
+		first[v] = table[h];
+	}
+}
+
+static inline uint64_t SimplifyHashBytes(const unsigned char *p, int n) {
+	uint64_t h = 14695981039346656037ull;
+	for(int i = 0; i < n; i++) {
+		h = (h ^ p[i]) * 1099511628211ull;
+	}
+	return h ^ (h >> 29);
+}
+
+float SimplifyMesh(const unsigned char *vertexData, int stride, const std::vector<glm::vec3> &positions,
+				   const uint32_t *indices, size_t indexCount, size_t targetIndexCount,
+				   std::vector<uint32_t> &out) {
+	size_t vertexCount = positions.size();
+	std::vector<uint8_t> used(vertexCount, 0);
+	for(size_t i = 0; i < indexCount; i++) {
+		used[indices[i]] = 1;
+	}
+
+	// wedges: vertices with all the same attributes; then their positions
+	std::vector<uint32_t> wedge, pos;
+	SimplifyWeld(vertexCount, used, wedge,
+				 [&](uint32_t v) { return SimplifyHashBytes(vertexData + (size_t)v * stride, stride); },
+				 [&](uint32_t a, uint32_t b) {
+					 return memcmp(vertexData + (size_t)a * stride, vertexData + (size_t)b * stride, stride) == 0;
+				 });
+	SimplifyWeld(vertexCount, used, pos,
+				 [&](uint32_t v) { return SimplifyHashBytes((const unsigned char *)&positions[v], sizeof(glm::vec3)); },
+				 [&](uint32_t a, uint32_t b) { return positions[a] == positions[b]; });
+
+	// triangles of wedges, without the degenerate ones
+	std::vector<uint32_t> tris;
+	tris.reserve(indexCount);
+	for(size_t i = 0; i + 2 < indexCount; i += 3) {
+		uint32_t a = wedge[indices[i]], b = wedge[indices[i + 1]], c = wedge[indices[i + 2]];
+		if((pos[a] != pos[b]) && (pos[b] != pos[c]) && (pos[a] != pos[c])) {
+			tris.insert(tris.end(), {a, b, c});
+		}
+	}
+
+	// locked positions: seams (more than one wedge) and borders (edges of a single triangle)
+	std::vector<uint8_t> locked(vertexCount, 0);
+	std::vector<uint32_t> wedgeOfPos(vertexCount, UINT32_MAX);
+	for(uint32_t w : tris) {
+		uint32_t p = pos[w];
+		if(wedgeOfPos[p] == UINT32_MAX) {
+			wedgeOfPos[p] = w;
+		} else if(wedgeOfPos[p] != w) {
+			locked[p] = 1;
+		}
+	}
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(tris.size());
+		for(size_t t = 0; t < tris.size(); t += 3) {
+			for(int e = 0; e < 3; e++) {
+				uint32_t a = pos[tris[t + e]], b = pos[tris[t + (e + 1) % 3]];
+				edges.push_back(((uint64_t)std::min(a, b) << 32) | std::max(a, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for(size_t i = 0; i < edges.size();) {
+			size_t j = i;
+			while((j < edges.size()) && (edges[j] == edges[i])) {
+				j++;
+			}
+			if(j - i != 2) {
+				// border, or shared by more than two triangles
+				locked[(uint32_t)(edges[i] >> 32)] = 1;
+				locked[(uint32_t)edges[i]] = 1;
+			}
+			i = j;
+		}
+	}
+
+	std::vector<SimplifyQuadric> Q(vertexCount, SimplifyQuadric{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+	for(size_t t = 0; t < tris.size(); t += 3) {
+		glm::vec3 a = positions[tris[t]], b = positions[tris[t + 1]], c = positions[tris[t + 2]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float l = glm::length(n);
+		if(l > 0.0f) {
+			n /= l;
+			for(int k = 0; k < 3; k++) {
+				SimplifyAddPlane(Q[pos[tris[t + k]]], n, -glm::dot(n, a), 0.5 * l);
+			}
+		}
+	}
+
+	std::vector<uint32_t> remap(vertexCount);
+	for(uint32_t v = 0; v < vertexCount; v++) {
+		remap[v] = v;
+	}
+	std::vector<uint32_t> triStart(vertexCount + 1), triList;
+	std::vector<uint8_t> touched(vertexCount);
+	struct Collapse {
+		float error;
+		uint32_t from, to;		// positions
+		uint32_t toWedge;
+	};
+	std::vector<Collapse> collapses;
+	float maxError = 0.0f;
+
+	while(tris.size() > targetIndexCount) {
+		// triangles around each position
+		std::fill(triStart.begin(), triStart.end(), 0);
+		for(uint32_t w : tris) {
+			triStart[pos[w] + 1]++;
+		}
+		for(size_t v = 0; v < vertexCount; v++) {
+			triStart[v + 1] += triStart[v];
+		}
+		triList.resize(tris.size());
+		{
+			std::vector<uint32_t> fill(triStart.begin(), triStart.end() - 1);
+			for(size_t i = 0; i < tris.size(); i++) {
+				triList[fill[pos[tris[i]]]++] = (uint32_t)(i / 3);
+			}
+		}
+
+		// best collapse of every free position, onto one of its neighbors
+		collapses.clear();
+		for(uint32_t v = 0; v < vertexCount; v++) {
+			if(locked[v] || (triStart[v] == triStart[v + 1])) {
+				continue;
+			}
+			Collapse best = {FLT_MAX, v, v, 0};
+			for(uint32_t k = triStart[v]; k < triStart[v + 1]; k++) {
+				const uint32_t *T = &tris[3 * triList[k]];
+				for(int c = 0; c < 3; c++) {
+					uint32_t u = pos[T[c]];
+					if(u == v) {
+						continue;
+					}
+					float e = (float)SimplifyError(Q[v], positions[u]);
+					if(e < best.error) {
+						best = {e, v, u, T[c]};
+					}
+				}
+			}
+			if(best.to != v) {
+				collapses.push_back(best);
+			}
+		}
+		if(collapses.empty()) {
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(),
+				  [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+		// applies the cheapest ones, with no two of them in the same neighborhood
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t triCount = tris.size();
+		size_t applied = 0;
+		for(const Collapse &C : collapses) {
+			if(triCount <= targetIndexCount) {
+				break;
+			}
+			if(touched[C.from] || touched[C.to]) {
+				continue;
+			}
+			// the triangles that stay must not flip
+			bool flips = false;
+			int removed = 0;
+			for(uint32_t k = triStart[C.from]; (k < triStart[C.from + 1]) && !flips; k++) {
+				const uint32_t *T = &tris[3 * triList[k]];
+				glm::vec3 p[3], q[3];
+				bool hasTo = false;
+				for(int c = 0; c < 3; c++) {
+					uint32_t P = pos[T[c]];
+					hasTo = hasTo || (P == C.to);
+					p[c] = positions[P];
+					q[c] = (P == C.from) ? positions[C.to] : p[c];
+				}
+				if(hasTo) {
+					removed++;
+					continue;
+				}
+				glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1);
+			}
+			if(flips) {
+				continue;
+			}
+			for(uint32_t k = triStart[C.from]; k < triStart[C.from + 1]; k++) {
+				const uint32_t *T = &tris[3 * triList[k]];
+				for(int c = 0; c < 3; c++) {
+					touched[pos[T[c]]] = 1;
+				}
+			}
+			// from is not on a seam, so all its triangles use the same wedge
+			remap[wedgeOfPos[C.from]] = C.toWedge;
+			SimplifyAdd(Q[C.to], Q[C.from]);
+			maxError = std::max(maxError, C.error);
+			triCount -= 3 * removed;
+			applied++;
+		}
+		if(applied == 0) {
+			break;
+		}
+
+		// new triangles, without the collapsed ones
+		size_t n = 0;
+		for(size_t t = 0; t < tris.size(); t += 3) {
+			uint32_t a = remap[tris[t]], b = remap[tris[t + 1]], c = remap[tris[t + 2]];
+			if((pos[a] != pos[b]) && (pos[b] != pos[c]) && (pos[a] != pos[c])) {
+				tris[n] = a; tris[n + 1] = b; tris[n + 2] = c;
+				n += 3;
+			}
+		}
+		tris.resize(n);
+		for(uint32_t w = 0; w < vertexCount; w++) {
+			remap[w] = w;
+		}
+		for(size_t i = 0; i < n; i++) {
+			wedgeOfPos[pos[tris[i]]] = tris[i];
+		}
+	}
+
+	out.assign(tris.begin(), tris.end());
+	return std::sqrt(maxError);
+}
+
+#endif
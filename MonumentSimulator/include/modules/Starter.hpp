@@ -16,6 +16,11 @@
 #include <chrono>
 #include <unordered_map>
 #include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #ifdef STARTER_IMPLEMENTATION
 // to allow splitting header and implementation
@@ -24,6 +29,15 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define SINFL_IMPLEMENTATION
 #define TINYGLTF_IMPLEMENTATION
+#define SDEFL_IMPLEMENTATION
+#define PNGWRITER_IMPLEMENTATION
+#define MGCGREADER_IMPLEMENTATION
+#define VFS_IMPLEMENTATION
+#define GLTFLOADER_IMPLEMENTATION
+#define VERTEXQUANT_IMPLEMENTATION
+#define MESHLETS_IMPLEMENTATION
+#define SIMPLIFY_IMPLEMENTATION
+#define JOBSYSTEM_IMPLEMENTATION
 #endif
 
 // GLM to support matrix operations
@@ -35,6 +49,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/transform2.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_precision.hpp>
 
 
 // to load OBJ files
@@ -53,6 +69,30 @@
 // Unzip library, to load MGCG files
 #include <sinfl.h>
 
+// Decryption and decompression of MGCG files
+#include "modules/MGCGReader.hpp"
+
+// Virtual file system, reading the assets from the bundles or the disk
+#include "modules/VFS.hpp"
+
+// glTF and glb loading, with the buffers left in the files read by the VFS
+#include "modules/GLTFLoader.hpp"
+
+// 16 bit positions, octahedral normals and tangents, and half float UVs
+#include "modules/VertexQuant.hpp"
+
+// Clusters of triangles, culled on the CPU
+#include "modules/Meshlets.hpp"
+
+// Quadric simplification, for the levels of detail of the models
+#include "modules/Simplify.hpp"
+
+// Pool of worker threads, for work split in parallel jobs
+#include "modules/JobSystem.hpp"
+
+// PNG encoder, for screenshots and recordings
+#include "modules/PNGWriter.hpp"
+
 // use GLFW to support windowing
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -128,6 +168,7 @@ struct VertexDescriptorElement {
 struct VertexComponent {
 	bool hasIt;
 	uint32_t offset;
+	VertexComponentFormat format;
 };
 
 struct VertexDescriptor {
@@ -156,8 +197,17 @@ struct VertexDescriptor {
 enum ModelType {OBJ, GLTF, MGCG};
 
 class AssetFile;
+class GeometryArena;
+
+// A level of detail of a model: a range of its indices, and its error in model units
+struct ModelLOD {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
 
 class Model {
+	friend class GeometryArena;
 	BaseProject *BP;
 	
 	VkBuffer vertexBuffer;
@@ -165,31 +215,86 @@ class Model {
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
 	VertexDescriptor *VD;
+	GeometryArena *arena = nullptr;
 
 	public:
 	glm::mat4 Wm;
+	// position of the mesh in the buffers of its GeometryArena, if any
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+	// positions in VK_FORMAT_R16G16B16A16_SNORM are dequantScale * p + dequantOffset
+	glm::vec3 dequantScale = glm::vec3(1.0f);
+	glm::vec3 dequantOffset = glm::vec3(0.0f);
+	bool hasDequant = false;
 	std::vector<unsigned char> vertices{};
 	std::vector<uint32_t> indices{};
+	// clusters of the mesh, and the ranges of indices drawn by drawMeshlets()
+	std::vector<Meshlet> meshlets{};
+	std::vector<MeshletRange> visibleRanges{};
+	// levels of detail, from the full mesh: the one drawn is chosen for each instance
+	std::vector<ModelLOD> lods{};
+	glm::vec3 lodCenter = glm::vec3(0.0f);
+	float lodRadius = 0.0f;
+	void setPositionBounds(glm::vec3 minP, glm::vec3 maxP);
 	void loadModelOBJ(std::string file);
 	void makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A);
 	static void getGLTFnodeTransforms(const tinygltf::Node *N, glm::vec3 &T, glm::vec3 &S, glm::quat &Q);
 	void makeGLTFwm(const tinygltf::Node *N);
-	void makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm);
+	void makeGLTFMesh(const GLTFModel *M, const tinygltf::Primitive *Prm);
 	void loadModelGLTF(std::string file, bool encoded);
 	void createIndexBuffer();
 	void createVertexBuffer();
-
-	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT);
-	void initFromAsset(BaseProject *bp, VertexDescriptor *VD, AssetFile *AF, std::string AN, int Mid = 0, std::string NN = "");
-	void initMesh(BaseProject *bp, VertexDescriptor *VD, bool printDebug = true);
+	void updateIndexBuffer();
+	glm::vec3 getPosition(size_t v);
+
+	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT, GeometryArena *GA = nullptr);
+	void initFromAsset(BaseProject *bp, VertexDescriptor *VD, AssetFile *AF, std::string AN, int Mid = 0, std::string NN = "",
+					   GeometryArena *GA = nullptr);
+	void initMesh(BaseProject *bp, VertexDescriptor *VD, bool printDebug = true, GeometryArena *GA = nullptr);
+	void createBuffers(GeometryArena *GA);
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer);
+
+	void buildMeshlets(int maxTriangles = 128);
+	bool cullMeshlets(const glm::mat4 &mvp, glm::vec3 eye, bool backfaces);
+	void drawMeshlets(VkCommandBuffer commandBuffer, int lod = 0);
+	uint32_t maxDraws();
+	void appendDraws(std::vector<VkDrawIndexedIndirectCommand> &draws, int lod = 0);
+	void draw(VkCommandBuffer commandBuffer, int lod = 0);
+
+	void buildLODs(int levels, float ratio = 0.5f);
+	int selectLOD(const glm::mat4 &modelView, const glm::mat4 &proj, float viewportHeight, int current,
+				  float maxPixels = 1.0f, float hysteresis = 0.2f);
+};
+
+// One vertex buffer and one index buffer for all the static models with the same
+// VertexDescriptor. Models are added by passing the arena to their init() methods,
+// and build() then creates the buffers: each model draws at its firstIndex and
+// vertexOffset, after a single bind() of the arena.
+class GeometryArena {
+	BaseProject *BP;
+	VertexDescriptor *VD;
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertexBufferMemory;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexBufferMemory;
+	std::vector<Model *> models;
+
+	public:
+	void init(BaseProject *bp, VertexDescriptor *VD);
+	void add(Model *M);
+	void build();
+	void updateIndices(Model *M);
+	bool isBuilt() {return indexBuffer != VK_NULL_HANDLE;}
+	void cleanup();
+	void bind(VkCommandBuffer commandBuffer);
 };
 
 class AssetFile {
 	friend Model;
 	
-	tinygltf::Model model;
+	GLTFModel model;
 	std::unordered_map<std::string, std::vector<const tinygltf::Primitive *>> GLTFmeshes;
 	std::unordered_map<std::string, const tinygltf::Node *> GLTFnodes;
 
@@ -202,11 +307,11 @@ class AssetFile {
 	ModelType type;
 	
 	public:
-	void initGLTF(std::string file);
+	void initGLTF(std::string file, bool encoded = false);
 	void initOBJ(std::string file);
 	void init(std::string file, ModelType MT);
 	ModelType getType() {return type;}
-	tinygltf::Model *getGLTFmodel() {return &model;}
+	GLTFModel *getGLTFmodel() {return &model;}
 	void cleanup();
 };
 
@@ -404,6 +509,31 @@ struct DescriptorSet {
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId, int currentImage);
   	void map(int currentImage, void *src, int slot);
+	// only the first size bytes, e.g. of a storage buffer sized for the worst case
+  	void map(int currentImage, void *src, int slot, size_t size);
+};
+
+// Indexed draws read by the GPU from a buffer for each swap chain image, mapped once.
+// Command buffers record draw() a single time, while the draws are rewritten every frame
+// with update(): the commands beyond the ones given are set to zero triangles.
+// Without the multiDrawIndirect feature each slot would need its own indirect draw, so
+// the draws are recorded directly instead, and update() tells when they have changed.
+struct IndirectBuffer {
+	BaseProject *BP;
+	uint32_t maxDraws;
+	bool direct = false;
+
+	std::vector<VkBuffer> buffers;
+	std::vector<VkDeviceMemory> buffersMemory;
+	std::vector<VkDrawIndexedIndirectCommand *> commands;
+	std::vector<uint32_t> used;
+	std::vector<VkDrawIndexedIndirectCommand> recorded;		// draws of draw(), when direct
+
+	void init(BaseProject *bp, uint32_t maxDraws);
+	void cleanup();
+	// true if the command buffers that call draw() must be recorded again
+	bool update(int currentImage, const std::vector<VkDrawIndexedIndirectCommand> &draws);
+	void draw(VkCommandBuffer commandBuffer, int currentImage);
 };
 
 
@@ -411,6 +541,7 @@ struct PoolSizes {
 	int uniformBlocksInPool = 0;
 	int texturesInPool = 0;
 	int setsInPool = 0;
+	int storageBlocksInPool = 0;
 };
 
 typedef void (* pNCBfunc)(VkCommandBuffer commandBuffer, int i, void *params);
@@ -435,6 +566,32 @@ struct NamedCommandBufferVersions {
 	std::vector<NamedCommandBuffer *>old;
 };
 
+const int SCREENSHOT_SLOTS = 3;
+
+enum ReadbackSlotStates {RBS_FREE, RBS_RECORDED, RBS_ENCODING};
+
+enum RecordingFormat {RF_RAW, RF_PNG, RF_Y4M};
+
+// Host visible buffer, persistently mapped, receiving a copy of a swap chain image
+struct ReadbackSlot {
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	bool coherent = true;
+	unsigned char *data = nullptr;
+	VkCommandBuffer cb = VK_NULL_HANDLE;
+	
+	// copy in progress
+	uint32_t width, height;
+	bool bgr;
+	size_t frame;		// frame in flight that performs the copy
+	std::string filename;
+	bool recording = false;
+	uint64_t seq;		// position in the recording
+	
+	std::atomic<int> state{RBS_FREE};
+};
+
 // MAIN ! 
 class BaseProject {
 	friend class VertexDescriptor;
@@ -445,6 +602,8 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend struct IndirectBuffer;
+	friend class GeometryArena;
 
 public:
 	virtual void setWindowParameters() = 0;
@@ -472,6 +631,8 @@ protected:
 	std::unordered_map<std::string, NamedCommandBufferVersions> namedCommandBuffers = {};
 	
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	// draws in a single vkCmdDrawIndexedIndirect: 1 without the multiDrawIndirect feature
+	uint32_t maxDrawIndirectCount = 1;
 	
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -618,21 +779,11 @@ protected:
 	void printQuat(const char *Name, glm::quat q);
 	
 	// to support screenshot
-	// Taken from the Sasha Willem sample by copy&paste
-	// This could be better integrated in the code, but for the moment,
-	// i cannot afford to do it, so it stays like this, even if it is awful!	
+	// The swap chain image is copied into a host buffer by a command buffer
+	// appended to the frame that renders it. The copy is surely completed when
+	// drawFrame() waits again for the same in flight fence, and the conversion
+	// to RGB and the PNG encoding are then performed by a worker thread.
 	private:
-	inline VkCommandBufferBeginInfo vks_initializers_commandBufferBeginInfo();
-	inline VkCommandBufferAllocateInfo vks_initializers_commandBufferAllocateInfo(
-		VkCommandPool commandPool, 
-		VkCommandBufferLevel level, 
-		uint32_t bufferCount);
-	VkCommandBuffer vulkanDevice_createCommandBuffer(VkCommandBufferLevel level, VkCommandPool pool, bool begin);
-	inline VkFenceCreateInfo vks_initializers_fenceCreateInfo(VkFenceCreateFlags flags = 0);
-	inline VkSubmitInfo vks_initializers_submitInfo();
-	void vulkanDevice_flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueue queue, VkCommandPool pool, bool freeCmd);	
-	inline VkMemoryAllocateInfo vks_initializers_memoryAllocateInfo();
-	inline VkImageCreateInfo vks_initializers_imageCreateInfo();
 	inline VkImageMemoryBarrier vks_initializers_imageMemoryBarrier();
 	void vks_tools_insertImageMemoryBarrier(
 		VkCommandBuffer cmdbuffer,
@@ -645,6 +796,52 @@ protected:
 		VkPipelineStageFlags dstStageMask,
 		VkImageSubresourceRange subresourceRange);
 	
+	ReadbackSlot screenshotSlots[SCREENSHOT_SLOTS];
+	std::vector<std::string> screenshotRequests = {};
+	std::thread screenshotWorker;
+	std::mutex screenshotMutex;
+	std::condition_variable screenshotCV;
+	std::deque<ReadbackSlot *> screenshotQueue = {};
+	bool screenshotWorkerQuit = false;
+	
+	void createReadbackSlot(ReadbackSlot &S, VkDeviceSize size);
+	void destroyReadbackSlot(ReadbackSlot &S);
+	bool getReadbackSwizzle(bool &bgr);
+	void recordReadbackCopy(ReadbackSlot &S, uint32_t imageIndex);
+	void captureScreenshots(std::vector<VkCommandBuffer> &buffers, uint32_t imageIndex);
+	void collectReadback(ReadbackSlot &S, size_t frame);
+	void collectReadbacks(size_t frame);
+	void encodeScreenshot(ReadbackSlot &S);
+	void screenshotWorkerLoop();
+	void cleanupReadbacks();
+	
+	// to support video recording
+	// Every Nth frame is copied like a screenshot into a pool of readback
+	// buffers, and a set of worker threads writes the frames to disk.
+	// Raw and Y4M streams are written in order, PNG files in any order.
+	// When all the buffers are busy the frame is dropped, so the renderer
+	// never waits for the disk.
+	std::vector<ReadbackSlot *> recordingSlots = {};
+	std::vector<std::thread> recordingWorkers = {};
+	std::mutex recordingMutex;
+	std::condition_variable recordingCV;
+	std::condition_variable recordingWriteCV;
+	std::deque<ReadbackSlot *> recordingQueue = {};
+	bool recordingWorkersQuit = false;
+	bool recordingActive = false;
+	bool recordingStopping = false;
+	RecordingFormat recordingFormat;
+	std::string recordingPath;
+	FILE *recordingFile = nullptr;
+	uint32_t recordingWidth, recordingHeight;
+	int recordingEvery;
+	uint64_t recordingFrameCount, recordingSeq, recordingNextWrite, recordingDropped;
+	std::atomic<int> recordingInFlight{0};	// frames copied and not yet written to disk
+	
+	void captureRecording(std::vector<VkCommandBuffer> &buffers, uint32_t imageIndex);
+	void encodeRecordedFrame(ReadbackSlot &S);
+	void recordingWorkerLoop();
+	void finishRecording(bool wait);
 	
 	// Custom define for better code readability
 	#define VK_FLAGS_NONE 0
@@ -652,8 +849,15 @@ protected:
 	#define DEFAULT_FENCE_TIMEOUT 100000000000		
 
 	public:
-	bool screenshotSaved = false;
+	std::atomic<bool> screenshotSaved{false};
+	// The image rendered in the current frame is saved: the currentBuffer
+	// parameter is kept for compatibility, but it is not used anymore
 	void saveScreenshot(const char *filename, int currentBuffer);
+	// For RF_PNG, path is the prefix of the files, otherwise it is the stream file
+	void startRecording(std::string path, RecordingFormat format = RF_Y4M, int every = 1,
+						int fps = 30, int slots = 6, int workers = 2);
+	void stopRecording();
+	bool isRecording() {return recordingActive;}
 	
 };
 
@@ -747,19 +951,14 @@ void PrintVkError( VkResult result ) {
 }
 
 std::vector<char> readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	if (!file.is_open()) {
+	VFSFile F;
+	if (!VFSRead(filename, F)) {
 		std::cout << "Failed to open: " << filename << "\n";
 		throw std::runtime_error("failed to open file!");
 	}
 	
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
-//std::cout << filename << " -> " << fileSize << " B\n";	 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	 
-	file.close();
+	std::vector<char> buffer(F.data, F.data + F.size);
+//std::cout << filename << " -> " << F.size << " B\n";	 
 	 
 	return buffer;
 }
@@ -807,6 +1006,9 @@ void BaseProject::initVulkan() {
 
 	createCommandPool();			
 	localInit();
+	// the decompression buffer is not needed after the assets have been loaded; the
+	// bundles stay mapped while the glTF buffers of the asset files point into them
+	MGCGloader.release();
 
 	createDescriptorPool();			
 	pipelinesAndDescriptorSetsInit();
@@ -1187,6 +1389,15 @@ void BaseProject::createLogicalDevice() {
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 	deviceFeatures.sampleRateShading = VK_TRUE;
 	deviceFeatures.fillModeNonSolid  = VK_TRUE;
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	if(supportedFeatures.multiDrawIndirect) {
+		VkPhysicalDeviceProperties physicalDeviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+		deviceFeatures.multiDrawIndirect = VK_TRUE;
+		maxDrawIndirectCount = physicalDeviceProperties.limits.maxDrawIndirectCount;
+	}
 	
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -1700,11 +1911,15 @@ uint32_t BaseProject::findMemoryType(uint32_t typeFilter,
 }
 
 void BaseProject::createDescriptorPool() {
-	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	std::vector<VkDescriptorPoolSize> poolSizes(2);
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	poolSizes[0].descriptorCount = static_cast<uint32_t>(DPSZs.uniformBlocksInPool * swapChainImages.size());
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	poolSizes[1].descriptorCount = static_cast<uint32_t>(DPSZs.texturesInPool * swapChainImages.size());
+	if(DPSZs.storageBlocksInPool > 0) {
+		poolSizes.push_back({VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+							 static_cast<uint32_t>(DPSZs.storageBlocksInPool * swapChainImages.size())});
+	}
 														 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1966,6 +2181,11 @@ void BaseProject::updateCommandBuffers(std::vector<VkCommandBuffer> &buffers, in
 void BaseProject::drawFrame() {
 	vkWaitForFences(device, 1, &inFlightFences[currentFrame],
 					VK_TRUE, UINT64_MAX);
+	// frames copied by the last use of this fence are now available
+	collectReadbacks(currentFrame);
+	if(recordingStopping) {
+		finishRecording(false);
+	}
 	
 	uint32_t imageIndex;
 	
@@ -1989,6 +2209,8 @@ void BaseProject::drawFrame() {
 	
 	std::vector<VkCommandBuffer> buffers = {};
 	updateCommandBuffers(buffers, imageIndex);
+	captureScreenshots(buffers, imageIndex);
+	captureRecording(buffers, imageIndex);
 	
 	VkSubmitInfo submitInfo{};
 	
@@ -2077,6 +2299,8 @@ void BaseProject::cleanup() {
 		
 	localCleanup();
 	
+	cleanupReadbacks();
+	
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
@@ -2240,124 +2464,6 @@ void BaseProject::printQuat(const char *Name, glm::quat q) {
 	std::cout << "glm::vec3 " << Name << " = glm::vec3(" << q[0] << ", " << q[1] << ", " << q[2] << ", " << q[3] << ");\n";
 }
 
-inline VkCommandBufferBeginInfo BaseProject::vks_initializers_commandBufferBeginInfo()
-{
-	VkCommandBufferBeginInfo cmdBufferBeginInfo {};
-	cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	return cmdBufferBeginInfo;
-}
-
-inline VkCommandBufferAllocateInfo BaseProject::vks_initializers_commandBufferAllocateInfo(
-	VkCommandPool commandPool, 
-	VkCommandBufferLevel level, 
-	uint32_t bufferCount)
-{
-	VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
-	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocateInfo.commandPool = commandPool;
-	commandBufferAllocateInfo.level = level;
-	commandBufferAllocateInfo.commandBufferCount = bufferCount;
-	return commandBufferAllocateInfo;
-}
-	
-VkCommandBuffer BaseProject::vulkanDevice_createCommandBuffer(VkCommandBufferLevel level, VkCommandPool pool, bool begin)
-{
-	VkResult result;
-
-	VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks_initializers_commandBufferAllocateInfo(pool, level, 1);
-	VkCommandBuffer cmdBuffer;
-	result = vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer);
-	if(result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
-	}
-	// If requested, also start recording for the new command buffer
-	if (begin)
-	{
-		VkCommandBufferBeginInfo cmdBufInfo = vks_initializers_commandBufferBeginInfo();
-		result = vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo);
-		if(result != VK_SUCCESS) {
-			PrintVkError(result);
-			throw std::runtime_error("failed to create screenshot!");
-		}
-	}
-	return cmdBuffer;
-}
-
-inline VkFenceCreateInfo BaseProject::vks_initializers_fenceCreateInfo(VkFenceCreateFlags flags)
-{
-	VkFenceCreateInfo fenceCreateInfo {};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = flags;
-	return fenceCreateInfo;
-}
-
-inline VkSubmitInfo BaseProject::vks_initializers_submitInfo()
-{
-	VkSubmitInfo submitInfo {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	return submitInfo;
-}
-
-void BaseProject::vulkanDevice_flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueue queue, VkCommandPool pool, bool freeCmd)
-{
-	VkResult result;
-
-	if (commandBuffer == VK_NULL_HANDLE)
-	{
-		return;
-	}
-
-	result = vkEndCommandBuffer(commandBuffer);
-	if(result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
-	}
-
-	VkSubmitInfo submitInfo = vks_initializers_submitInfo();
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	// Create fence to ensure that the command buffer has finished executing
-	VkFenceCreateInfo fenceInfo = vks_initializers_fenceCreateInfo(VK_FLAGS_NONE);
-	VkFence fence;
-	result = vkCreateFence(device, &fenceInfo, nullptr, &fence);
-	if(result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
-	}
-	// Submit to the queue
-	result = vkQueueSubmit(queue, 1, &submitInfo, fence);
-	if(result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
-	}
-	// Wait for the fence to signal that command buffer has finished executing
-	result = vkWaitForFences(device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
-	if(result != VK_SUCCESS) {
-		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
-	}
-	vkDestroyFence(device, fence, nullptr);
-	if (freeCmd)
-	{
-		clearCommandBuffers();
-	}
-}	
-
-inline VkMemoryAllocateInfo BaseProject::vks_initializers_memoryAllocateInfo()
-{
-	VkMemoryAllocateInfo memAllocInfo {};
-	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	return memAllocInfo;
-}
-
-inline VkImageCreateInfo BaseProject::vks_initializers_imageCreateInfo()
-{
-	VkImageCreateInfo imageCreateInfo {};
-	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	return imageCreateInfo;
-}
-
 inline VkImageMemoryBarrier BaseProject::vks_initializers_imageMemoryBarrier()
 {
 	VkImageMemoryBarrier imageMemoryBarrier {};
@@ -2396,238 +2502,609 @@ void BaseProject::vks_tools_insertImageMemoryBarrier(
 		1, &imageMemoryBarrier);
 }
 
-void BaseProject::saveScreenshot(const char *filename, int currentBuffer) {
-	VkResult result;
-	uint32_t width = swapChainExtent.width;
-	uint32_t height = swapChainExtent.height;
+// Conversion of RGBA or BGRA pixels to packed RGB
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <tmmintrin.h>
+#define STARTER_SSSE3_SWIZZLE
+
+// 16 pixels per iteration: each shuffle packs 4 pixels in 12 bytes,
+// and the four results are merged into three 16 bytes stores
+__attribute__((target("ssse3")))
+static void SwizzleToRGB_SSSE3(const unsigned char *src, unsigned char *dst, size_t &i, size_t n, bool bgr) {
+	const __m128i mask = bgr ?
+			_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) :
+			_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	for(; i + 16 <= n; i += 16) {
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4)), mask);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 + 16)), mask);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 + 32)), mask);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 + 48)), mask);
+		_mm_storeu_si128((__m128i *)(dst + i * 3),
+						 _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128((__m128i *)(dst + i * 3 + 16),
+						 _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+		_mm_storeu_si128((__m128i *)(dst + i * 3 + 32),
+						 _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+	}
+}
+#endif
+
+void SwizzleToRGB(const unsigned char *src, unsigned char *dst, size_t n, bool bgr) {
+	size_t i = 0;
+#ifdef STARTER_SSSE3_SWIZZLE
+	static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+	if(hasSSSE3) {
+		SwizzleToRGB_SSSE3(src, dst, i, n, bgr);
+	}
+#endif
+	int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+	for(; i < n; i++) {
+		dst[i * 3 + 0] = src[i * 4 + r];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + b];
+	}
+}
+
+void BaseProject::createReadbackSlot(ReadbackSlot &S, VkDeviceSize size) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	
-	screenshotSaved = false;
-	bool supportsBlit = true;
-
-
-	// Check blit support for source and destination
-	VkFormatProperties formatProps;
-
-	// Check if the device supports blitting from optimal images (the swapchain images are in optimal format)
-	vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainImageFormat, &formatProps);
-	if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT)) {
-		std::cerr << "Device does not support blitting from optimal tiled images, using copy instead of blit!" << std::endl;
-		supportsBlit = false;
-	}
-
-	// Check if the device supports blitting to linear images
-	vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProps);
-	if (!(formatProps.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
-		std::cerr << "Device does not support blitting to linear tiled images, using copy instead of blit!" << std::endl;
-		supportsBlit = false;
-	}
-
-	// Source for the copy is the last rendered swapchain image
-	VkImage srcImage = swapChainImages[currentBuffer];
-
-	// Create the linear tiled destination image to copy to and to read the memory from
-	VkImageCreateInfo imageCreateCI(vks_initializers_imageCreateInfo());
-	imageCreateCI.imageType = VK_IMAGE_TYPE_2D;
-	// Note that vkCmdBlitImage (if supported) will also do format conversions if the swapchain color format would differ
-	imageCreateCI.format = VK_FORMAT_R8G8B8A8_UNORM;
-	imageCreateCI.extent.width = width;
-	imageCreateCI.extent.height = height;
-	imageCreateCI.extent.depth = 1;
-	imageCreateCI.arrayLayers = 1;
-	imageCreateCI.mipLevels = 1;
-	imageCreateCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	imageCreateCI.samples = VK_SAMPLE_COUNT_1_BIT;
-	imageCreateCI.tiling = VK_IMAGE_TILING_LINEAR;
-	imageCreateCI.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	// Create the image
-	VkImage dstImage;
-	result = vkCreateImage(device, &imageCreateCI, nullptr, &dstImage);
-	if(result != VK_SUCCESS) {
+	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &S.buffer);
+	if (result != VK_SUCCESS) {
 		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!");
+		throw std::runtime_error("failed to create screenshot buffer!");
 	}
-	// Create memory to back up the image
+	
 	VkMemoryRequirements memRequirements;
-	VkMemoryAllocateInfo memAllocInfo(vks_initializers_memoryAllocateInfo());
-	VkDeviceMemory dstImageMemory;
-	vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-	memAllocInfo.allocationSize = memRequirements.size;
-	// Memory must be host visible to copy from
-	memAllocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	result = vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory);
-	if(result != VK_SUCCESS) {
+	vkGetBufferMemoryRequirements(device, S.buffer, &memRequirements);
+
+	// Cached memory is preferred, since the buffer is only read by the CPU
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+								   VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	int memType = -1;
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		if ((memRequirements.memoryTypeBits & (1 << i)) && 
+			(memProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+			memType = i;
+			break;
+		}
+	}
+	if(memType < 0) {
+		memType = findMemoryType(memRequirements.memoryTypeBits,
+								 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+								 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+	S.coherent = (memProperties.memoryTypes[memType].propertyFlags &
+				  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = memType;
+	
+	result = vkAllocateMemory(device, &allocInfo, nullptr, &S.memory);
+	if (result != VK_SUCCESS) {
 		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!!");
+		throw std::runtime_error("failed to allocate screenshot buffer memory!");
 	}
-	result = vkBindImageMemory(device, dstImage, dstImageMemory, 0);
-	if(result != VK_SUCCESS) {
+	vkBindBufferMemory(device, S.buffer, S.memory, 0);
+	
+	// The buffer stays mapped for its whole life
+	result = vkMapMemory(device, S.memory, 0, VK_WHOLE_SIZE, 0, (void **)&S.data);
+	if (result != VK_SUCCESS) {
 		PrintVkError(result);
-		throw std::runtime_error("failed to create screenshot!!");
+		throw std::runtime_error("failed to map screenshot buffer memory!");
 	}
+	S.size = size;
+}
 
-	// Do the actual blit from the swapchain image to our host visible destination image
-	VkCommandBuffer copyCmd = vulkanDevice_createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, commandPool, true);
+void BaseProject::destroyReadbackSlot(ReadbackSlot &S) {
+	if(S.buffer != VK_NULL_HANDLE) {
+		vkUnmapMemory(device, S.memory);
+		vkDestroyBuffer(device, S.buffer, nullptr);
+		vkFreeMemory(device, S.memory, nullptr);
+	}
+	S.buffer = VK_NULL_HANDLE;
+	S.memory = VK_NULL_HANDLE;
+	S.data = nullptr;
+	S.size = 0;
+}
 
-	// Transition destination image to transfer destination layout
-	vks_tools_insertImageMemoryBarrier(
-		copyCmd,
-		dstImage,
-		0,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+bool BaseProject::getReadbackSwizzle(bool &bgr) {
+	switch(swapChainImageFormat) {
+	  case VK_FORMAT_B8G8R8A8_SRGB:
+	  case VK_FORMAT_B8G8R8A8_UNORM:
+		bgr = true;
+		return true;
+	  case VK_FORMAT_R8G8B8A8_SRGB:
+	  case VK_FORMAT_R8G8B8A8_UNORM:
+		bgr = false;
+		return true;
+	  default:
+		std::cout << "Readback not supported for swap chain format " << swapChainImageFormat << "\n";
+		return false;
+	}
+}
+
+void BaseProject::recordReadbackCopy(ReadbackSlot &S, uint32_t imageIndex) {
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+	
+	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &S.cb);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to allocate screenshot command buffer!");
+	}
 
-	// Transition swapchain image from present to transfer source layout
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(S.cb, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording screenshot command buffer!");
+	}
+	
+	VkImage srcImage = swapChainImages[imageIndex];
+	
+	// Wait for the last render pass, and move the image to transfer source layout
 	vks_tools_insertImageMemoryBarrier(
-		copyCmd,
+		S.cb,
 		srcImage,
-		VK_ACCESS_MEMORY_READ_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 		VK_ACCESS_TRANSFER_READ_BIT,
 		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
 
-	// If source and destination support blit we'll blit as this also does automatic format conversion (e.g. from BGR to RGB)
-	if (supportsBlit)
-	{
-		// Define the region to blit (we will blit the whole swapchain image)
-		VkOffset3D blitSize;
-		blitSize.x = width;
-		blitSize.y = height;
-		blitSize.z = 1;
-		VkImageBlit imageBlitRegion{};
-		imageBlitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageBlitRegion.srcSubresource.layerCount = 1;
-		imageBlitRegion.srcOffsets[1] = blitSize;
-		imageBlitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageBlitRegion.dstSubresource.layerCount = 1;
-		imageBlitRegion.dstOffsets[1] = blitSize;
-
-		// Issue the blit command
-		vkCmdBlitImage(
-			copyCmd,
-			srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&imageBlitRegion,
-			VK_FILTER_NEAREST);
-	}
-	else
-	{
-		// Otherwise use image copy (requires us to manually flip components)
-		VkImageCopy imageCopyRegion{};
-		imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageCopyRegion.srcSubresource.layerCount = 1;
-		imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		imageCopyRegion.dstSubresource.layerCount = 1;
-		imageCopyRegion.extent.width = width;
-		imageCopyRegion.extent.height = height;
-		imageCopyRegion.extent.depth = 1;
-
-		// Issue the copy command
-		vkCmdCopyImage(
-			copyCmd,
-			srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&imageCopyRegion);
-	}
-
-	// Transition destination image to general layout, which is the required layout for mapping the image memory later on
-	vks_tools_insertImageMemoryBarrier(
-		copyCmd,
-		dstImage,
-		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_ACCESS_MEMORY_READ_BIT,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_IMAGE_LAYOUT_GENERAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {S.width, S.height, 1};
+	vkCmdCopyImageToBuffer(S.cb, srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						   S.buffer, 1, &region);
 
-	// Transition back the swap chain image after the blit is done
+	// Give the image back to the presentation engine
 	vks_tools_insertImageMemoryBarrier(
-		copyCmd,
+		S.cb,
 		srcImage,
 		VK_ACCESS_TRANSFER_READ_BIT,
-		VK_ACCESS_MEMORY_READ_BIT,
+		0,
 		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
 		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
 
-	vulkanDevice_flushCommandBuffer(copyCmd, graphicsQueue, commandPool, true);
-
-	// Get layout of the image (including row pitch)
-	VkImageSubresource subResource { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-	VkSubresourceLayout subResourceLayout;
-	vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
-
-	// Map image memory so we can start copying from it
-	const char* data;
-	vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-	data += subResourceLayout.offset;
-
-	char *pixelArray;
-	pixelArray = (char *)malloc(width * height * 3);
-	// If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
-	bool colorSwizzle = false;
-	// Check if source is BGR
-	// Note: Not complete, only contains most common and basic BGR surface formats for demonstration purposes
-	if (!supportsBlit)
-	{
-		std::vector<VkFormat> formatsBGR = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM };
-		colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), swapChainImageFormat) != formatsBGR.end());
+	// Make the copy visible to the host
+	VkBufferMemoryBarrier bufferBarrier{};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = S.buffer;
+	bufferBarrier.offset = 0;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(S.cb,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+		0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+	if (vkEndCommandBuffer(S.cb) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record screenshot command buffer!");
 	}
+}
 
-	int j = 0;
-	for (uint32_t y = 0; y < height; y++)
-	{
-		unsigned int *row = (unsigned int*)data;
-		for (uint32_t x = 0; x < width; x++)
-		{
-			if (colorSwizzle)
-			{
-				pixelArray[j++] = ((char*)row)[2];
-				pixelArray[j++] = ((char*)row)[1];
-				pixelArray[j++] = ((char*)row)[0];
-			}
-			else
-			{
-				pixelArray[j++] = ((char*)row)[0];
-				pixelArray[j++] = ((char*)row)[1];
-				pixelArray[j++] = ((char*)row)[2];
+void BaseProject::captureScreenshots(std::vector<VkCommandBuffer> &buffers, uint32_t imageIndex) {
+	if(screenshotRequests.size() == 0) {
+		return;
+	}
+	
+	bool bgr;
+	if(!getReadbackSwizzle(bgr)) {
+		screenshotRequests.clear();
+		return;
+	}
+
+	for(auto &filename : screenshotRequests) {
+		ReadbackSlot *S = nullptr;
+		for(int i = 0; i < SCREENSHOT_SLOTS; i++) {
+			if(screenshotSlots[i].state == RBS_FREE) {
+				S = &screenshotSlots[i];
+				break;
 			}
-			row++;
 		}
-		data += subResourceLayout.rowPitch;
+		if(S == nullptr) {
+			// all the buffers are still being encoded: rather than waiting, the shot is lost
+			std::cout << "Screenshot dropped, no free readback buffer: " << filename << "\n";
+			continue;
+		}
+		
+		VkDeviceSize size = (VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4;
+		if(S->size < size) {
+			destroyReadbackSlot(*S);
+			createReadbackSlot(*S, size);
+		}
+		S->width = swapChainExtent.width;
+		S->height = swapChainExtent.height;
+		S->bgr = bgr;
+		S->frame = currentFrame;
+		S->filename = filename;
+		S->recording = false;
+		
+		recordReadbackCopy(*S, imageIndex);
+		buffers.push_back(S->cb);
+		S->state = RBS_RECORDED;
 	}
-	stbi_write_png(filename, width, height, 3, pixelArray, width*3);
-	free(pixelArray);
+	screenshotRequests.clear();
+}
+
+void BaseProject::collectReadback(ReadbackSlot &S, size_t frame) {
+	if((S.state != RBS_RECORDED) || (S.frame != frame)) {
+		return;
+	}
+	vkFreeCommandBuffers(device, commandPool, 1, &S.cb);
+	S.cb = VK_NULL_HANDLE;
+	
+	if(!S.coherent) {
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = S.memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(device, 1, &range);
+	}
+	
+	S.state = RBS_ENCODING;
+	if(S.recording) {
+		{
+			std::lock_guard<std::mutex> lock(recordingMutex);
+			recordingQueue.push_back(&S);
+		}
+		recordingCV.notify_one();
+	} else {
+		if(!screenshotWorker.joinable()) {
+			screenshotWorkerQuit = false;
+			screenshotWorker = std::thread(&BaseProject::screenshotWorkerLoop, this);
+		}
+		{
+			std::lock_guard<std::mutex> lock(screenshotMutex);
+			screenshotQueue.push_back(&S);
+		}
+		screenshotCV.notify_one();
+	}
+}
 
-	std::cout << "Screenshot saved to disk" << std::endl;
+void BaseProject::collectReadbacks(size_t frame) {
+	for(int i = 0; i < SCREENSHOT_SLOTS; i++) {
+		collectReadback(screenshotSlots[i], frame);
+	}
+	for(auto S : recordingSlots) {
+		collectReadback(*S, frame);
+	}
+}
 
-	// Clean up resources
-	vkUnmapMemory(device, dstImageMemory);
-	vkFreeMemory(device, dstImageMemory, nullptr);
-	vkDestroyImage(device, dstImage, nullptr);
+void BaseProject::encodeScreenshot(ReadbackSlot &S) {
+	unsigned char *pixelArray = (unsigned char *)malloc(S.width * S.height * 3);
+	SwizzleToRGB(S.data, pixelArray, (size_t)S.width * S.height, S.bgr);
+	
+	// uses all the cores: screenshots are rare, and should be written quickly
+	if(WritePNG(S.filename.c_str(), S.width, S.height, 3, pixelArray, S.width * 3, 2, PNGF_ADAPTIVE)) {
+		std::cout << "Screenshot saved to disk: " << S.filename << std::endl;
+	} else {
+		std::cout << "Cannot write screenshot: " << S.filename << std::endl;
+	}
+	free(pixelArray);
 
+	S.state = RBS_FREE;
 	screenshotSaved = true;
+}
+
+void BaseProject::screenshotWorkerLoop() {
+	while(true) {
+		ReadbackSlot *S;
+		{
+			std::unique_lock<std::mutex> lock(screenshotMutex);
+			screenshotCV.wait(lock, [this] {
+				return screenshotWorkerQuit || (screenshotQueue.size() > 0);
+			});
+			// pending shots are written before quitting
+			if(screenshotQueue.size() == 0) {
+				return;
+			}
+			S = screenshotQueue.front();
+			screenshotQueue.pop_front();
+		}
+		encodeScreenshot(*S);
+	}
+}
+
+void BaseProject::cleanupReadbacks() {
+	// the device is idle here, so all the recorded copies are completed
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		collectReadbacks(i);
+	}
+	if(recordingActive || recordingStopping) {
+		finishRecording(true);
+	}
+	if(screenshotWorker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(screenshotMutex);
+			screenshotWorkerQuit = true;
+		}
+		screenshotCV.notify_one();
+		screenshotWorker.join();
+	}
+	for(int i = 0; i < SCREENSHOT_SLOTS; i++) {
+		destroyReadbackSlot(screenshotSlots[i]);
+	}
+}
+
+void BaseProject::saveScreenshot(const char *filename, int currentBuffer) {
+	screenshotSaved = false;
+	screenshotRequests.push_back(filename);
 }	
 
 
-// Helper classes
+// Conversion of RGBA or BGRA pixels to planar YUV 4:2:0 (BT.601, full range),
+// chroma is the average of each 2x2 block
+void ConvertToYUV420(const unsigned char *src, unsigned char *dst, int w, int h, bool bgr) {
+	int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	unsigned char *Y = dst;
+	unsigned char *U = dst + w * h;
+	unsigned char *V = U + cw * ch;
+	
+	for(int y = 0; y < h; y++) {
+		const unsigned char *row = src + (size_t)y * w * 4;
+		for(int x = 0; x < w; x++) {
+			// coefficients scaled by 2^16
+			int R = row[x * 4 + r], G = row[x * 4 + 1], B = row[x * 4 + b];
+			Y[y * w + x] = (unsigned char)((19595 * R + 38470 * G + 7471 * B + 32768) >> 16);
+		}
+	}
+	for(int y = 0; y < ch; y++) {
+		const unsigned char *row0 = src + (size_t)(2 * y) * w * 4;
+		const unsigned char *row1 = src + (size_t)std::min(2 * y + 1, h - 1) * w * 4;
+		for(int x = 0; x < cw; x++) {
+			int x0 = 2 * x * 4, x1 = std::min(2 * x + 1, w - 1) * 4;
+			int R = row0[x0 + r] + row0[x1 + r] + row1[x0 + r] + row1[x1 + r];
+			int G = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+			int B = row0[x0 + b] + row0[x1 + b] + row1[x0 + b] + row1[x1 + b];
+			// the sums are 4 times the average, hence the 2^18 scale
+			int u = (-11059 * R - 21709 * G + 32768 * B + (128 << 18) + (1 << 17)) >> 18;
+			int v = ( 32768 * R - 27439 * G -  5329 * B + (128 << 18) + (1 << 17)) >> 18;
+			U[y * cw + x] = (unsigned char)std::min(u, 255);
+			V[y * cw + x] = (unsigned char)std::min(v, 255);
+		}
+	}
+}
 
-void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptorElement> B, std::vector<VertexDescriptorElement> E) {
-	BP = bp;
-	Bindings = B;
-	Layout = E;
+void BaseProject::startRecording(std::string path, RecordingFormat format, int every,
+								 int fps, int slots, int workers) {
+	if(recordingActive || recordingStopping) {
+		std::cout << "A recording is already in progress\n";
+		return;
+	}
+	bool bgr;
+	if(!getReadbackSwizzle(bgr)) {
+		return;
+	}
+
+	recordingFormat = format;
+	recordingPath = path;
+	recordingWidth = swapChainExtent.width;
+	recordingHeight = swapChainExtent.height;
+	recordingEvery = std::max(every, 1);
+	recordingFrameCount = 0;
+	recordingSeq = 0;
+	recordingNextWrite = 0;
+	recordingDropped = 0;
+	recordingInFlight = 0;
+
+	if(format != RF_PNG) {
+		recordingFile = fopen(path.c_str(), "wb");
+		if(recordingFile == nullptr) {
+			std::cout << "Cannot open recording file: " << path << "\n";
+			return;
+		}
+		if(format == RF_Y4M) {
+			fprintf(recordingFile, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n",
+					recordingWidth, recordingHeight, fps);
+		}
+	}
+	
+	for(int i = 0; i < slots; i++) {
+		ReadbackSlot *S = new ReadbackSlot();
+		createReadbackSlot(*S, (VkDeviceSize)recordingWidth * recordingHeight * 4);
+		recordingSlots.push_back(S);
+	}
+	recordingWorkersQuit = false;
+	for(int i = 0; i < workers; i++) {
+		recordingWorkers.push_back(std::thread(&BaseProject::recordingWorkerLoop, this));
+	}
+	recordingActive = true;
+	std::cout << "Recording " << recordingWidth << "x" << recordingHeight
+			  << " every " << recordingEvery << " frames to: " << path << "\n";
+}
+
+void BaseProject::stopRecording() {
+	if(recordingActive) {
+		// the files are closed when the last frame is written (see finishRecording())
+		recordingActive = false;
+		recordingStopping = true;
+	}
+}
+
+void BaseProject::captureRecording(std::vector<VkCommandBuffer> &buffers, uint32_t imageIndex) {
+	if(!recordingActive) {
+		return;
+	}
+	if((recordingFrameCount++ % recordingEvery) != 0) {
+		return;
+	}
+	// streams cannot change size, so frames rendered after a resize are skipped
+	if((swapChainExtent.width != recordingWidth) || (swapChainExtent.height != recordingHeight)) {
+		recordingDropped++;
+		return;
+	}
+	
+	ReadbackSlot *S = nullptr;
+	for(auto RS : recordingSlots) {
+		if(RS->state == RBS_FREE) {
+			S = RS;
+			break;
+		}
+	}
+	if(S == nullptr) {
+		recordingDropped++;
+		return;
+	}
+	
+	bool bgr;
+	getReadbackSwizzle(bgr);
+	S->width = recordingWidth;
+	S->height = recordingHeight;
+	S->bgr = bgr;
+	S->frame = currentFrame;
+	S->recording = true;
+	S->seq = recordingSeq++;
+	recordingInFlight++;
+	
+	recordReadbackCopy(*S, imageIndex);
+	buffers.push_back(S->cb);
+	S->state = RBS_RECORDED;
+}
+
+void BaseProject::encodeRecordedFrame(ReadbackSlot &S) {
+	uint32_t w = S.width, h = S.height;
+	uint64_t seq = S.seq;
+	
+	if(recordingFormat == RF_PNG) {
+		unsigned char *pixelArray = (unsigned char *)malloc(w * h * 3);
+		SwizzleToRGB(S.data, pixelArray, (size_t)w * h, S.bgr);
+		S.state = RBS_FREE;
+		
+		char num[32];
+		snprintf(num, sizeof(num), "-%06llu.png", (unsigned long long)seq);
+		std::string filename = recordingPath + num;
+		// recording workers already run in parallel, one strip per frame is enough
+		if(!WritePNG(filename.c_str(), w, h, 3, pixelArray, w * 3, 1, PNGF_UP, 1)) {
+			std::cout << "Cannot write frame: " << filename << std::endl;
+		}
+		free(pixelArray);
+		recordingInFlight--;
+		return;
+	}
+	
+	// the buffer is converted, and released, before waiting for the turn to write
+	size_t frameSize;
+	unsigned char *frameData;
+	if(recordingFormat == RF_Y4M) {
+		frameSize = (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+		frameData = (unsigned char *)malloc(frameSize);
+		ConvertToYUV420(S.data, frameData, w, h, S.bgr);
+	} else {
+		frameSize = (size_t)w * h * 3;
+		frameData = (unsigned char *)malloc(frameSize);
+		SwizzleToRGB(S.data, frameData, (size_t)w * h, S.bgr);
+	}
+	S.state = RBS_FREE;
+	
+	{
+		std::unique_lock<std::mutex> lock(recordingMutex);
+		recordingWriteCV.wait(lock, [this, seq] {return recordingNextWrite == seq;});
+	}
+	if(recordingFormat == RF_Y4M) {
+		fputs("FRAME\n", recordingFile);
+	}
+	fwrite(frameData, 1, frameSize, recordingFile);
+	{
+		std::lock_guard<std::mutex> lock(recordingMutex);
+		recordingNextWrite++;
+	}
+	recordingWriteCV.notify_all();
+	free(frameData);
+	recordingInFlight--;
+}
+
+void BaseProject::recordingWorkerLoop() {
+	while(true) {
+		ReadbackSlot *S;
+		{
+			std::unique_lock<std::mutex> lock(recordingMutex);
+			recordingCV.wait(lock, [this] {
+				return recordingWorkersQuit || (recordingQueue.size() > 0);
+			});
+			if(recordingQueue.size() == 0) {
+				return;
+			}
+			// frames are taken in order, so the oldest one never waits to be written
+			S = recordingQueue.front();
+			recordingQueue.pop_front();
+		}
+		encodeRecordedFrame(*S);
+	}
+}
+
+void BaseProject::finishRecording(bool wait) {
+	// without waiting, the recording is closed only when all the frames are written:
+	// the slots are released before the write, so they cannot tell it
+	if(!wait) {
+		if(recordingInFlight > 0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(recordingMutex);
+		if(recordingQueue.size() > 0) {
+			return;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(recordingMutex);
+		recordingWorkersQuit = true;
+	}
+	recordingCV.notify_all();
+	for(auto &t : recordingWorkers) {
+		t.join();
+	}
+	recordingWorkers.clear();
+	
+	if(recordingFile != nullptr) {
+		fclose(recordingFile);
+		recordingFile = nullptr;
+	}
+	for(auto S : recordingSlots) {
+		destroyReadbackSlot(*S);
+		delete S;
+	}
+	recordingSlots.clear();
+	
+	std::cout << "Recording saved to: " << recordingPath << ", frames: " << recordingSeq
+			  << ", dropped: " << recordingDropped << "\n";
+	recordingActive = false;
+	recordingStopping = false;
+}
+
+// Helper classes
+
+void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptorElement> B, std::vector<VertexDescriptorElement> E) {
+	BP = bp;
+	Bindings = B;
+	Layout = E;
 	
 	Position.hasIt = false; Position.offset = 0;
 	Pos2D.hasIt = false; Position.offset = 0;
@@ -2637,6 +3114,8 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 	Tangent.hasIt = false; Tangent.offset = 0;
 	JointWeight.hasIt = false; JointWeight.offset = 0;
 	JointIndex.hasIt = false; JointIndex.offset = 0;
+	Position.format = Pos2D.format = Normal.format = UV.format = VCF_FLOAT;
+	Color.format = Tangent.format = JointWeight.format = JointIndex.format = VCF_FLOAT;
 	
 	if(B.size() <= 1) {	// for now, read models only with every vertex information in a single binding
 		for(int i = 0; i < E.size(); i++) {
@@ -2649,6 +3128,14 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  } else {
 					std::cout << "Vertex Position - wrong size\n";
 				  }
+				} else if(E[i].format == VK_FORMAT_R16G16B16A16_SNORM) {
+				  if(E[i].size == sizeof(glm::i16vec4)) {
+					Position.hasIt = true;
+					Position.offset = E[i].offset;
+					Position.format = VCF_SNORM16;
+				  } else {
+					std::cout << "Vertex Position - wrong size\n";
+				  }
 				} else {
 				  std::cout << "Vertex Position - wrong format\n";
 				}
@@ -2673,6 +3160,14 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  } else {
 					std::cout << "Vertex Normal - wrong size\n";
 				  }
+				} else if(E[i].format == VK_FORMAT_R16G16_SNORM) {
+				  if(E[i].size == sizeof(glm::i16vec2)) {
+					Normal.hasIt = true;
+					Normal.offset = E[i].offset;
+					Normal.format = VCF_OCT16;
+				  } else {
+					std::cout << "Vertex Normal - wrong size\n";
+				  }
 				} else {
 				  std::cout << "Vertex Normal - wrong format\n";
 				}
@@ -2685,6 +3180,14 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  } else {
 					std::cout << "Vertex UV - wrong size\n";
 				  }
+				} else if(E[i].format == VK_FORMAT_R16G16_SFLOAT) {
+				  if(E[i].size == sizeof(glm::u16vec2)) {
+					UV.hasIt = true;
+					UV.offset = E[i].offset;
+					UV.format = VCF_HALF;
+				  } else {
+					std::cout << "Vertex UV - wrong size\n";
+				  }
 				} else {
 				  std::cout << "Vertex UV - wrong format\n";
 				}
@@ -2709,6 +3212,14 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  } else {
 					std::cout << "Vertex Tangent - wrong size\n";
 				  }
+				} else if(E[i].format == VK_FORMAT_R16G16_SNORM) {
+				  if(E[i].size == sizeof(glm::i16vec2)) {
+					Tangent.hasIt = true;
+					Tangent.offset = E[i].offset;
+					Tangent.format = VCF_OCT16;
+				  } else {
+					std::cout << "Vertex Tangent - wrong size\n";
+				  }
 				} else {
 				  std::cout << "Vertex Tangent - wrong format\n";
 				}
@@ -2783,6 +3294,52 @@ std::vector<VkVertexInputAttributeDescription> VertexDescriptor::getAttributeDes
 
 
 
+// Loads a glTF or glb file, either plain or encoded as MGCG. Plain files, and the
+// external buffers they reference, are read through the VFS.
+static void LoadGLTFFile(GLTFModel *model, std::string file, bool encoded) {
+	std::string warn, err;
+	VFSFile F;
+	std::string baseDir;
+
+	if(encoded) {
+		// the decompressed content becomes the file, and it is given back to the
+		// reader if the model does not reference it
+		MGCGloader.load(file);
+		F.buffer.swap(MGCGloader.data);
+		F.data = F.buffer.data();
+		F.size = MGCGloader.size;
+		baseDir = "/";
+	} else {
+		if(!VFSRead(file, F)) {
+			throw std::runtime_error("Failed to open file: " + file);
+		}
+		size_t slash = file.find_last_of("/\\");
+		baseDir = (slash == std::string::npos) ? "" : file.substr(0, slash);
+	}
+	bool ok = GLTFLoadFromFile(model, &warn, &err, F, baseDir);
+	if(encoded && !F.buffer.empty()) {
+		F.buffer.swap(MGCGloader.data);
+	}
+	if(!ok) {
+		throw std::runtime_error(warn + err);
+	}
+}
+
+// Loads an OBJ file, and its materials, through the VFS
+static bool LoadOBJFile(tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+						std::vector<tinyobj::material_t> *materials, std::string *warn, std::string *err,
+						std::string file, const char *matpath) {
+	VFSFile F;
+	if(!VFSRead(file, F)) {
+		(*err) += "Cannot open file [" + file + "]\n";
+		return false;
+	}
+	VFSStreamBuf buf(F.data, F.size);
+	std::istream in(&buf);
+	VFSMaterialReader matReader(matpath == nullptr ? "" : matpath);
+	return tinyobj::LoadObj(attrib, shapes, materials, warn, err, &in, &matReader);
+}
+
 void AssetFile::init(std::string file, ModelType MT) {
 	type = MT;
 	
@@ -2792,6 +3349,9 @@ void AssetFile::init(std::string file, ModelType MT) {
 	if(type == GLTF) {
 		initGLTF(file);
 	}
+	if(type == MGCG) {
+		initGLTF(file, true);
+	}
 }
 
 
@@ -2812,8 +3372,8 @@ void AssetFile::initOBJ(std::string file) {
 //	}
 	
 	std::cout << "Loading Asset File: " << file << "[OBJ] - mat. path: " << (matpath == nullptr ? "<<NOPATH>>" : matpath) << "\n";	
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-						  file.c_str(), matpath)) {
+	if (!LoadOBJFile(&attrib, &shapes, &materials, &warn, &err,
+					 file, matpath)) {
 		throw std::runtime_error(warn + err);
 	}
 /*	std::cout << "Asset has: " << materials.size() << " materials\n";*/
@@ -2831,16 +3391,10 @@ void AssetFile::initOBJ(std::string file) {
 	}
 }
 
-void AssetFile::initGLTF(std::string file) {
+void AssetFile::initGLTF(std::string file, bool encoded) {
 	// GLTF assets stuff
-	tinygltf::TinyGLTF loader;
-	std::string warn, err;
-
-	std::cout << "Loading Asset File: " << file << "[GLTF]\n";	
-	if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
-					file.c_str())) {
-		throw std::runtime_error(warn + err);
-	}
+	std::cout << "Loading Asset File: " << file << (encoded ? "[MGCG]" : "[GLTF]") << "\n";	
+	LoadGLTFFile(&model, file, encoded);
 
 
 	for (const auto& mesh :  model.meshes) {
@@ -2872,9 +3426,31 @@ void AssetFile::cleanup() {
 
 
 
+void Model::setPositionBounds(glm::vec3 minP, glm::vec3 maxP) {
+	dequantOffset = (minP + maxP) * 0.5f;
+	dequantScale = (maxP - minP) * 0.5f;
+	// flat boxes still need a scale to divide by
+	for(int c = 0; c < 3; c++) {
+		if(dequantScale[c] <= 0.0f) {
+			dequantScale[c] = 1.0f;
+		}
+	}
+	hasDequant = true;
+}
+
 void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 	int mainStride = VD->Bindings[0].stride;
 	int newId = 0;
+	if((VD->Position.format == VCF_SNORM16) && !hasDequant) {
+		// all the shapes of the file share the same vertices
+		glm::vec3 minP(0.0f), maxP(0.0f);
+		for(size_t i = 0; i + 2 < A->vertices.size(); i += 3) {
+			glm::vec3 p(A->vertices[i], A->vertices[i + 1], A->vertices[i + 2]);
+			minP = (i == 0) ? p : glm::min(minP, p);
+			maxP = (i == 0) ? p : glm::max(maxP, p);
+		}
+		setPositionBounds(minP, maxP);
+	}
 	for (const auto& index : M->mesh.indices) {
 		std::vector<unsigned char> vertex(mainStride, 0);
 		glm::vec3 pos = {
@@ -2882,7 +3458,10 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			A->vertices[3 * index.vertex_index + 1],
 			A->vertices[3 * index.vertex_index + 2]
 		};
-		if(VD->Position.hasIt) {
+		if(VD->Position.hasIt && (VD->Position.format != VCF_FLOAT)) {
+			QuantEncode(VD->Position.format, &pos.x, 3, 1, 3, &vertex[VD->Position.offset], mainStride,
+						dequantOffset, dequantScale);
+		} else if(VD->Position.hasIt) {
 			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
 			*o = pos;
 		}
@@ -2901,7 +3480,10 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			A->texcoords[2 * index.texcoord_index + 0],
 			1 - A->texcoords[2 * index.texcoord_index + 1] 
 		};
-		if(VD->UV.hasIt) {
+		if(VD->UV.hasIt && (VD->UV.format != VCF_FLOAT)) {
+			QuantEncode(VD->UV.format, &texCoord.x, 2, 1, 2, &vertex[VD->UV.offset], mainStride,
+						dequantOffset, dequantScale);
+		} else if(VD->UV.hasIt) {
 			glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
 			*o = texCoord;
 		}
@@ -2911,7 +3493,10 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			A->normals[3 * index.normal_index + 1],
 			A->normals[3 * index.normal_index + 2]
 		};
-		if(VD->Normal.hasIt) {
+		if(VD->Normal.hasIt && (VD->Normal.format != VCF_FLOAT)) {
+			QuantEncode(VD->Normal.format, &norm.x, 3, 1, 3, &vertex[VD->Normal.offset], mainStride,
+						dequantOffset, dequantScale);
+		} else if(VD->Normal.hasIt) {
 			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
 			*o = norm;
 		}
@@ -2929,8 +3514,8 @@ void Model::loadModelOBJ(std::string file) {
 	std::string warn, err;
 	
 	std::cout << "Loading : " << file << "[OBJ]\n";	
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-						  file.c_str())) {
+	if (!LoadOBJFile(&attrib, &shapes, &materials, &warn, &err,
+					 file, nullptr)) {
 		throw std::runtime_error(warn + err);
 	}
 	
@@ -2946,236 +3531,76 @@ void Model::loadModelOBJ(std::string file) {
 	
 }
 
-void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
+void Model::makeGLTFMesh(const GLTFModel *M, const tinygltf::Primitive *Prm) {
 	int mainStride = VD->Bindings[0].stride;
 
-	const float *bufferPos = nullptr;
-	const float *bufferNormals = nullptr;
-	const float *bufferTangents = nullptr;
-	const float *bufferTexCoords = nullptr;
-	const glm::u8 *bufferJointIndex = nullptr;
-	const float *bufferJointWeight = nullptr;
-	
-	bool meshHasPos = false;
-	bool meshHasNorm = false;
-	bool meshHasTan = false;
-	bool meshHasUV = false;
-	bool meshHasJointIndex = false;
-	bool meshHasJointWeight = false;
-	
-	int cntPos = 0;
-	int cntNorm = 0;
-	int cntTan = 0;
-	int cntUV = 0;
-	int cntJointIndex = 0;
-	int cntJointWeight = 0;
-	int cntTot = 0;
-
-	auto pIt = Prm->attributes.find("POSITION");
-	if(pIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &posAccessor = M->accessors[pIt->second];
-		const tinygltf::BufferView &posView = M->bufferViews[posAccessor.bufferView];
-		bufferPos = reinterpret_cast<const float *>(&(M->buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
-		meshHasPos = true;
-		cntPos = posAccessor.count;
-		if(cntPos > cntTot) cntTot = cntPos;
-	} else {
-		if(VD->Position.hasIt) {
-			std::cout << "Warning: vertex layout has position, but file hasn't\n";
-		}
-	}
-	
-	auto nIt = Prm->attributes.find("NORMAL");
-	if(nIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &normAccessor = M->accessors[nIt->second];
-		const tinygltf::BufferView &normView = M->bufferViews[normAccessor.bufferView];
-		bufferNormals = reinterpret_cast<const float *>(&(M->buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
-		meshHasNorm = true;
-		cntNorm = normAccessor.count;
-		if(cntNorm > cntTot) cntTot = cntNorm;
-	} else {
-		if(VD->Normal.hasIt) {
-			std::cout << "Warning: vertex layout has normal, but file hasn't\n";
-		}
-	}
-
-	auto tIt = Prm->attributes.find("TANGENT");
-	if(tIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &tanAccessor = M->accessors[tIt->second];
-		const tinygltf::BufferView &tanView = M->bufferViews[tanAccessor.bufferView];
-		bufferTangents = reinterpret_cast<const float *>(&(M->buffers[tanView.buffer].data[tanAccessor.byteOffset + tanView.byteOffset]));
-		meshHasTan = true;
-		cntTan = tanAccessor.count;
-		if(cntTan > cntTot) cntTot = cntTan;
-	} else {
-		if(VD->Tangent.hasIt) {
-			std::cout << "Warning: vertex layout has tangent, but file hasn't\n";
-		}
-	}
-
-	auto uIt = Prm->attributes.find("TEXCOORD_0");
-	if(uIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &uvAccessor = M->accessors[uIt->second];
-		const tinygltf::BufferView &uvView = M->bufferViews[uvAccessor.bufferView];
-		bufferTexCoords = reinterpret_cast<const float *>(&(M->buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
-		meshHasUV = true;
-		cntUV = uvAccessor.count;
-		if(cntUV > cntTot) cntTot = cntUV;
-	} else {
-		if(VD->UV.hasIt) {
-			std::cout << "Warning: vertex layout has UV, but file hasn't\n";
+	// glTF attributes, and where they go in the vertex
+	struct GLTFattribute {
+		const char *name;
+		const char *label;
+		const VertexComponent &VC;
+		int comps;
+		bool integer;
+	};
+	const GLTFattribute attributes[] = {
+		{"POSITION",   "position", VD->Position,    3, false},
+		{"NORMAL",     "normal",   VD->Normal,      3, false},
+		{"TANGENT",    "tangent",  VD->Tangent,     4, false},
+		{"TEXCOORD_0", "UV",       VD->UV,          2, false},
+		{"JOINTS_0",   "Joint",    VD->JointIndex,  4, true},
+		{"WEIGHTS_0",  "Weights",  VD->JointWeight, 4, false},
+	};
+	const int nAttributes = sizeof(attributes) / sizeof(attributes[0]);
+	const tinygltf::Accessor *accessors[nAttributes];
+
+	size_t cntTot = 0;
+	for(int a = 0; a < nAttributes; a++) {
+		accessors[a] = nullptr;
+		auto it = Prm->attributes.find(attributes[a].name);
+		if(it != Prm->attributes.end()) {
+			accessors[a] = &M->accessors[it->second];
+			cntTot = std::max(cntTot, accessors[a]->count);
+		} else if(attributes[a].VC.hasIt) {
+			std::cout << "Warning: vertex layout has " << attributes[a].label << ", but file hasn't\n";
 		}
 	}
 
-	auto iIt = Prm->attributes.find("JOINTS_0");
-	if(iIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &jointAccessor = M->accessors[iIt->second];
-		const tinygltf::BufferView &jointView = M->bufferViews[jointAccessor.bufferView];
-		bufferJointIndex = reinterpret_cast<const glm::u8 *>(&(M->buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]));
-		meshHasJointIndex = true;
-		cntJointIndex = jointAccessor.count;
-		if(cntJointIndex > cntTot) cntTot = cntJointIndex;
-	} else {
-		if(VD->JointIndex.hasIt) {
-			std::cout << "Warning: vertex layout has Joint, but file hasn't\n";
-		}
-	}
-	auto wIt = Prm->attributes.find("WEIGHTS_0");
-	if(wIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &weightsAccessor = M->accessors[wIt->second];
-		const tinygltf::BufferView &weightsView = M->bufferViews[weightsAccessor.bufferView];
-		bufferJointWeight = reinterpret_cast<const float *>(&(M->buffers[weightsView.buffer].data[weightsAccessor.byteOffset + weightsView.byteOffset]));
-		meshHasJointWeight = true;
-		cntJointWeight = weightsAccessor.count;
-		if(cntJointWeight > cntTot) cntTot = cntJointWeight;
-	} else {
-		if(VD->JointWeight.hasIt) {
-			std::cout << "Warning: vertex layout has Weights, but file hasn't\n";
+	if((VD->Position.format == VCF_SNORM16) && !hasDequant && (accessors[0] != nullptr)) {
+		glm::vec3 minP, maxP;
+		GLTFaccessorBounds(M, *accessors[0], &minP.x, &maxP.x);
+		setPositionBounds(minP, maxP);
+	}
+
+	// the new vertices are appended, zero filled, and the attributes are gathered into
+	// them in blocks, that stay in the cache while all the attributes are written;
+	// compact components are gathered as floats first, and then encoded
+	const size_t blockSize = 2048;
+	std::vector<float> scratch;
+	size_t base = vertices.size() / mainStride;
+	vertices.resize((base + cntTot) * mainStride, 0);
+	for(size_t b = 0; b < cntTot; b += blockSize) {
+		unsigned char *block = vertices.data() + (base + b) * mainStride;
+		for(int a = 0; a < nAttributes; a++) {
+			const GLTFattribute &GA = attributes[a];
+			if((accessors[a] == nullptr) || !GA.VC.hasIt) {
+				continue;
+			}
+			if(GA.integer) {
+				GLTFgatherUint(M, *accessors[a], b, blockSize, block + GA.VC.offset, mainStride, GA.comps);
+			} else if(GA.VC.format == VCF_FLOAT) {
+				GLTFgatherFloat(M, *accessors[a], b, blockSize, block + GA.VC.offset, mainStride, GA.comps);
+			} else if(b < accessors[a]->count) {
+				size_t n = std::min(blockSize, accessors[a]->count - b);
+				scratch.assign(blockSize * 4, 0.0f);
+				GLTFgatherFloat(M, *accessors[a], b, n, (unsigned char *)scratch.data(), 4 * sizeof(float), GA.comps);
+				QuantEncode(GA.VC.format, scratch.data(), 4, n, GA.comps, block + GA.VC.offset, mainStride,
+							dequantOffset, dequantScale);
+			}
 		}
 	}
 
-//std::cout << "making vertex array. Stride:" << mainStride << "\n";
-//	std::unordered_map<int, bool> usedIndices;
-
-	for(int i = 0; i < cntTot; i++) {
-		std::vector<unsigned char> vertex(mainStride, 0);
-//std::cout << vertices.size() << "," << vertex.size() << "," << &vertex << " " << &vertex[0] << " ";
-//std::cout << i << "\n";
-		
-		if((i < cntPos) && meshHasPos && VD->Position.hasIt) {
-			glm::vec3 pos = {
-				bufferPos[3 * i + 0],
-				bufferPos[3 * i + 1],
-				bufferPos[3 * i + 2]
-			};
-//std::cout << "Pos: " <<	VD->Position.offset << "\n";
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
-//std::cout << "at: " << o << "\n";
-			*o = pos;
-//std::cout << "Copied: " << o->x << "\n";
-		}
-		if((i < cntNorm) && meshHasNorm && VD->Normal.hasIt) {
-			glm::vec3 normal = {
-				bufferNormals[3 * i + 0],
-				bufferNormals[3 * i + 1],
-				bufferNormals[3 * i + 2]
-			};
-//std::cout << "Nor: " <<	VD->Normal.offset << "\n";
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
-			*o = normal;
-		}
-
-		if((i < cntTan) && meshHasTan && VD->Tangent.hasIt) {
-			glm::vec4 tangent = {
-				bufferTangents[4 * i + 0],
-				bufferTangents[4 * i + 1],
-				bufferTangents[4 * i + 2],
-				bufferTangents[4 * i + 3]
-			};
-//std::cout << "Tan: " <<	VD->Tangent.offset << "\n";
-			glm::vec4 *o = (glm::vec4 *)((char*)(&vertex[0]) + VD->Tangent.offset);
-			*o = tangent;
-		}
-		
-		if((i < cntUV) && meshHasUV && VD->UV.hasIt) {
-			glm::vec2 texCoord = {
-				bufferTexCoords[2 * i + 0],
-				bufferTexCoords[2 * i + 1] 
-			};
-//std::cout << "UV : " <<	VD->UV.offset << "\n";
-			glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
-			*o = texCoord;
-		}
-
-
-		if((i < cntJointIndex) && meshHasJointIndex && VD->JointIndex.hasIt) {
-			glm::uvec4 jointIndex = {
-				(glm::uint)bufferJointIndex[4 * i + 0],
-				(glm::uint)bufferJointIndex[4 * i + 1],
-				(glm::uint)bufferJointIndex[4 * i + 2],
-				(glm::uint)bufferJointIndex[4 * i + 3]
-			};
-//std::cout << jointIndex.x << " " << jointIndex.y << " " << jointIndex.z << " " << jointIndex.w << "\t\t";
-
-//usedIndices[jointIndex.x] = true;
-//usedIndices[jointIndex.y] = true;
-//usedIndices[jointIndex.z] = true;
-//usedIndices[jointIndex.w] = true;
-
-			glm::uvec4 *o = (glm::uvec4 *)((char*)(&vertex[0]) + VD->JointIndex.offset);
-			*o = jointIndex;
-		}
-
-		if((i < cntJointWeight) && meshHasJointWeight && VD->JointWeight.hasIt) {
-			glm::vec4 jointWeight = {
-				bufferJointWeight[4 * i + 0],
-				bufferJointWeight[4 * i + 1],
-				bufferJointWeight[4 * i + 2],
-				bufferJointWeight[4 * i + 3]
-			};
-//std::cout << bufferJointWeight[4 * i + 0] << " " << bufferJointWeight[4 * i + 1] << " " << bufferJointWeight[4 * i + 2] << " " << 
-//				bufferJointWeight[4 * i + 3] << "\n";
-
-			glm::vec4 *o = (glm::vec4 *)((char*)(&vertex[0]) + VD->JointWeight.offset);
-			*o = jointWeight;
-		}
-
-//std::cout << vertices.size() << "," << vertex.size() << " Inserting\n";
-		vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-//std::cout << vertices.size() << " Inserted\n";
-	} 
-
-//std::cout << "Used indices: " << usedIndices.size() << "\n";
-//for(auto kkk: usedIndices) {
-//	std::cout << kkk.first << ", ";
-//}
-//std::cout << "\n";
-
-	const tinygltf::Accessor &accessor = M->accessors[Prm->indices];
-	const tinygltf::BufferView &bufferView = M->bufferViews[accessor.bufferView];
-	const tinygltf::Buffer &buffer = M->buffers[bufferView.buffer];
-	
-	switch(accessor.componentType) {
-		case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
-			{
-				const uint16_t *bufferIndex = reinterpret_cast<const uint16_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-				for(int i = 0; i < accessor.count; i++) {
-					indices.push_back(bufferIndex[i]);
-				}
-			}
-			break;
-		case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
-			{
-				const uint32_t *bufferIndex = reinterpret_cast<const uint32_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
-				for(int i = 0; i < accessor.count; i++) {
-					indices.push_back(bufferIndex[i]);
-				}
-			}
-			break;
-		default:
-			std::cerr << "Index component type " << accessor.componentType << " not supported!" << std::endl;
-			throw std::runtime_error("Error loading GLTF component");
-	}			
+	// indices refer to the vertices of this primitive
+	GLTFgatherIndices(M, M->accessors[Prm->indices], (uint32_t)base, indices);
 }
 
 
@@ -3223,47 +3648,29 @@ void Model::makeGLTFwm(const tinygltf::Node *N) {
 }
 
 void Model::loadModelGLTF(std::string file, bool encoded) {
-	tinygltf::Model model;
-	tinygltf::TinyGLTF loader;
-	std::string warn, err;
+	GLTFModel model;
 	
 	std::cout << "Loading : " << file << (encoded ? "[MGCG]" : "[GLTF]") << "\n";	
-	if(encoded) {
-		auto modelString = readFile(file);
-		
-		const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
-		const unsigned char iv[16] = {
-			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-			0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
-		};
-
-		// decrypt
-		unsigned long padded_size = 0;
-		std::vector<unsigned char> decrypted(modelString.size());
-
-		plusaes::decrypt_cbc((unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
-
-		int size = 0;
-		void *decomp;
-		
-		sscanf(reinterpret_cast<char *const>(&decrypted[0]), "%d", &size);
-//std::cout << decrypted.size() << ", decomp: " << size << "\n";
-//for(int i=0;i<32;i++) {
-//	std::cout << (int)decrypted[i] << "\n";
-//}
-
-		decomp = calloc(size, 1);
-		int n = sinflate(decomp, (int)size, &decrypted[16], decrypted.size()-16);
-		
-		if (!loader.LoadASCIIFromString(&model, &warn, &err, 
-						reinterpret_cast<const char *>(decomp), size, "/")) {
-			throw std::runtime_error(warn + err);
-		}
-	} else {
-		if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
-						file.c_str())) {
-			throw std::runtime_error(warn + err);
+	LoadGLTFFile(&model, file, encoded);
+
+	// a single quantization box for all the primitives merged in the model
+	if(VD->Position.format == VCF_SNORM16) {
+		bool first = true;
+		glm::vec3 minP(0.0f), maxP(0.0f);
+		for (const auto& mesh :  model.meshes) {
+			for (const auto& primitive :  mesh.primitives) {
+				auto pIt = primitive.attributes.find("POSITION");
+				if((primitive.indices < 0) || (pIt == primitive.attributes.end())) {
+					continue;
+				}
+				glm::vec3 pMin, pMax;
+				GLTFaccessorBounds(&model, model.accessors[pIt->second], &pMin.x, &pMax.x);
+				minP = first ? pMin : glm::min(minP, pMin);
+				maxP = first ? pMax : glm::max(maxP, pMax);
+				first = false;
+			}
 		}
+		setPositionBounds(minP, maxP);
 	}
 
 	for (const auto& mesh :  model.meshes) {
@@ -3316,7 +3723,44 @@ void Model::createIndexBuffer() {
 	vkUnmapMemory(BP->device, indexBufferMemory);
 }
 
-void Model::initMesh(BaseProject *bp, VertexDescriptor *vd, bool printDebug) {
+void Model::updateIndexBuffer() {
+	if(arena != nullptr) {
+		arena->updateIndices(this);
+		return;
+	}
+	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+
+	void* data;
+	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, indices.data(), (size_t) bufferSize);
+	vkUnmapMemory(BP->device, indexBufferMemory);
+}
+
+glm::vec3 Model::getPosition(size_t v) {
+	const unsigned char *p = &vertices[v * VD->Bindings[0].stride + VD->Position.offset];
+	if(VD->Position.format == VCF_SNORM16) {
+		int16_t q[3];
+		memcpy(q, p, sizeof(q));
+		glm::vec3 n(std::max(q[0] / 32767.0f, -1.0f), std::max(q[1] / 32767.0f, -1.0f),
+					std::max(q[2] / 32767.0f, -1.0f));
+		return n * dequantScale + dequantOffset;
+	}
+	glm::vec3 pos;
+	memcpy(&pos, p, sizeof(pos));
+	return pos;
+}
+
+// Models in an arena get their place in its buffers when the arena is built
+void Model::createBuffers(GeometryArena *GA) {
+	if(GA != nullptr) {
+		GA->add(this);
+	} else {
+		createVertexBuffer();
+		createIndexBuffer();
+	}
+}
+
+void Model::initMesh(BaseProject *bp, VertexDescriptor *vd, bool printDebug, GeometryArena *GA) {
 	BP = bp;
 	VD = vd;
 	int mainStride = VD->Bindings[0].stride;
@@ -3324,12 +3768,11 @@ void Model::initMesh(BaseProject *bp, VertexDescriptor *vd, bool printDebug) {
 		std::cout << "[Manual] Vertices: " << (vertices.size()/mainStride)
 				  << " Indices: " << indices.size() << "\n";
 	}
-	createVertexBuffer();
-	createIndexBuffer();
+	createBuffers(GA);
 	Wm = glm::mat4(1);
 }
 
-void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT) {
+void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT, GeometryArena *GA) {
 	BP = bp;
 	VD = vd;
 	Wm = glm::mat4(1);
@@ -3342,11 +3785,11 @@ void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelT
 		loadModelGLTF(file, true);
 	}
 	
-	createVertexBuffer();
-	createIndexBuffer();
+	createBuffers(GA);
 }
 
-void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF, std::string AN, int Mid, std::string NN) {
+void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF, std::string AN, int Mid, std::string NN,
+						  GeometryArena *GA) {
 	BP = bp;
 	VD = vd;
 	Wm = glm::mat4(1);
@@ -3397,11 +3840,14 @@ void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF,
 	    break;
 	}
 
-	createVertexBuffer();
-	createIndexBuffer();
+	createBuffers(GA);
 }
 
 void Model::cleanup() {
+	if(arena != nullptr) {
+		// the buffers belong to the arena
+		return;
+	}
    	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
    	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
 	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
@@ -3409,6 +3855,10 @@ void Model::cleanup() {
 }
 
 void Model::bind(VkCommandBuffer commandBuffer) {
+	if(arena != nullptr) {
+		arena->bind(commandBuffer);
+		return;
+	}
 	VkBuffer vertexBuffers[] = {vertexBuffer};
 	// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
 	VkDeviceSize offsets[] = {0};
@@ -3418,6 +3868,290 @@ void Model::bind(VkCommandBuffer commandBuffer) {
 							VK_INDEX_TYPE_UINT32);
 }
 
+// Splits the mesh in clusters, reordering its indices: to be called after init()
+void Model::buildMeshlets(int maxTriangles) {
+	if(!lods.empty()) {
+		std::cout << "Meshlets must be built before the levels of detail\n";
+		return;
+	}
+	if(!VD->Position.hasIt) {
+		std::cout << "Meshlets need the positions in the vertex layout\n";
+		return;
+	}
+	size_t count = vertices.size() / VD->Bindings[0].stride;
+	std::vector<glm::vec3> positions(count);
+	for(size_t v = 0; v < count; v++) {
+		positions[v] = getPosition(v);
+	}
+	MeshletBuild(positions, indices, meshlets, maxTriangles);
+	updateIndexBuffer();
+	visibleRanges.assign(1, {0, (uint32_t)indices.size()});
+	std::cout << "[Meshlets] " << meshlets.size() << " clusters of up to " << maxTriangles << " triangles\n";
+}
+
+// Culls the clusters with the frustum of mvp (and, with backfaces, the ones facing away
+// from eye), both in the space of the model. Returns true when the ranges to draw changed,
+// and command buffers using drawMeshlets() must be recorded again.
+bool Model::cullMeshlets(const glm::mat4 &mvp, glm::vec3 eye, bool backfaces) {
+	if(meshlets.empty()) {
+		return false;
+	}
+	std::vector<MeshletRange> ranges;
+	MeshletCull(meshlets, mvp, eye, backfaces, ranges);
+	bool changed = (ranges.size() != visibleRanges.size()) ||
+				   !std::equal(ranges.begin(), ranges.end(), visibleRanges.begin(),
+							   [](const MeshletRange &a, const MeshletRange &b) {
+								   return (a.firstIndex == b.firstIndex) && (a.indexCount == b.indexCount);
+							   });
+	if(changed) {
+		visibleRanges.swap(ranges);
+	}
+	return changed;
+}
+
+// Draws needed by appendDraws() in the worst case: visible ranges are separated by at
+// least one culled cluster
+uint32_t Model::maxDraws() {
+	return meshlets.empty() ? 1 : (uint32_t)(meshlets.size() + 1) / 2;
+}
+
+// The draws of drawMeshlets(), for an IndirectBuffer
+void Model::appendDraws(std::vector<VkDrawIndexedIndirectCommand> &draws, int lod) {
+	if(lod > 0) {
+		const ModelLOD &L = lods[lod];
+		draws.push_back({L.indexCount, 1, firstIndex + L.firstIndex, vertexOffset, 0});
+		return;
+	}
+	if(meshlets.empty()) {
+		uint32_t count = lods.empty() ? static_cast<uint32_t>(indices.size()) : lods[0].indexCount;
+		draws.push_back({count, 1, firstIndex, vertexOffset, 0});
+		return;
+	}
+	for(auto &R : visibleRanges) {
+		draws.push_back({R.indexCount, 1, firstIndex + R.firstIndex, vertexOffset, 0});
+	}
+}
+
+void Model::drawMeshlets(VkCommandBuffer commandBuffer, int lod) {
+	if(meshlets.empty() || (lod > 0)) {
+		draw(commandBuffer, lod);
+		return;
+	}
+	for(auto &R : visibleRanges) {
+		vkCmdDrawIndexed(commandBuffer, R.indexCount, 1, firstIndex + R.firstIndex, vertexOffset, 0);
+	}
+}
+
+// the whole mesh, after bind(), at the level of detail lod (0 is the full mesh)
+void Model::draw(VkCommandBuffer commandBuffer, int lod) {
+	if(!lods.empty()) {
+		const ModelLOD &L = lods[lod];
+		vkCmdDrawIndexed(commandBuffer, L.indexCount, 1, firstIndex + L.firstIndex, vertexOffset, 0);
+		return;
+	}
+	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, firstIndex, vertexOffset, 0);
+}
+
+// Appends to the indices up to levels - 1 simplified versions of the mesh, each with
+// ratio times the triangles of the previous one. To be called after init(), and before
+// building the arena of the model, if any.
+void Model::buildLODs(int levels, float ratio) {
+	if(!VD->Position.hasIt) {
+		std::cout << "Levels of detail need the positions in the vertex layout\n";
+		return;
+	}
+	if((arena != nullptr) && arena->isBuilt()) {
+		std::cout << "Levels of detail must be built before the geometry arena\n";
+		return;
+	}
+	size_t count = vertices.size() / VD->Bindings[0].stride;
+	std::vector<glm::vec3> positions(count);
+	glm::vec3 minP(0.0f), maxP(0.0f);
+	for(size_t v = 0; v < count; v++) {
+		positions[v] = getPosition(v);
+		minP = (v == 0) ? positions[v] : glm::min(minP, positions[v]);
+		maxP = (v == 0) ? positions[v] : glm::max(maxP, positions[v]);
+	}
+	lodCenter = (minP + maxP) * 0.5f;
+	lodRadius = glm::length(maxP - minP) * 0.5f;
+
+	lods.assign(1, {0, (uint32_t)indices.size(), 0.0f});
+	std::vector<uint32_t> lod;
+	for(int l = 1; l < levels; l++) {
+		const ModelLOD &prev = lods.back();
+		size_t target = (size_t)(prev.indexCount * ratio) / 3 * 3;
+		float error = SimplifyMesh(vertices.data(), VD->Bindings[0].stride, positions,
+								   &indices[prev.firstIndex], prev.indexCount, target, lod);
+		if(lod.size() >= prev.indexCount) {
+			// nothing left to collapse
+			break;
+		}
+		lods.push_back({(uint32_t)indices.size(), (uint32_t)lod.size(), std::max(error, prev.error)});
+		indices.insert(indices.end(), lod.begin(), lod.end());
+	}
+
+	if(arena == nullptr) {
+		vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+		vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+		createIndexBuffer();
+	}
+	std::cout << "[LOD] Triangles:";
+	for(auto &L : lods) {
+		std::cout << " " << (L.indexCount / 3);
+	}
+	std::cout << "\n";
+}
+
+// Chooses the coarsest level whose error, projected on the screen, is at most maxPixels,
+// for an instance drawn with modelView at level current in the previous frame. Coarser
+// levels are taken only below (1 - hysteresis) times maxPixels, and the current one is
+// kept up to (1 + hysteresis) times maxPixels, so that small camera movements at the
+// threshold do not switch the level at every frame. Returns the level to draw, that
+// the caller keeps for the next frame: each instance of the model has its own.
+int Model::selectLOD(const glm::mat4 &modelView, const glm::mat4 &proj, float viewportHeight, int current,
+					 float maxPixels, float hysteresis) {
+	if(lods.size() < 2) {
+		return 0;
+	}
+	current = std::max(0, std::min(current, (int)lods.size() - 1));
+	float scale = std::max(glm::length(glm::vec3(modelView[0])),
+				  std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+	glm::vec3 center = glm::vec3(modelView * glm::vec4(lodCenter, 1.0f));
+	float distance = std::max(glm::length(center) - lodRadius * scale, 1e-3f);
+	// pixels per model unit at that distance
+	float toPixels = scale * std::abs(proj[1][1]) * viewportHeight * 0.5f / distance;
+
+	int desired = 0;
+	for(int l = (int)lods.size() - 1; l > 0; l--) {
+		if(lods[l].error * toPixels <= maxPixels) {
+			desired = l;
+			break;
+		}
+	}
+	if(desired > current) {
+		if(lods[desired].error * toPixels <= maxPixels * (1.0f - hysteresis)) {
+			current = desired;
+		}
+	} else if(desired < current) {
+		if(lods[current].error * toPixels > maxPixels * (1.0f + hysteresis)) {
+			current = desired;
+		}
+	}
+	return current;
+}
+
+void GeometryArena::init(BaseProject *bp, VertexDescriptor *vd) {
+	BP = bp;
+	VD = vd;
+	models.clear();
+}
+
+// Same vertices in memory: equal strides, and the same elements with the same formats
+static bool SameVertexLayout(const VertexDescriptor *A, const VertexDescriptor *B) {
+	if(A == B) {
+		return true;
+	}
+	if((A->Bindings.size() != B->Bindings.size()) || (A->Layout.size() != B->Layout.size())) {
+		return false;
+	}
+	for(size_t i = 0; i < A->Bindings.size(); i++) {
+		if(A->Bindings[i].stride != B->Bindings[i].stride) {
+			return false;
+		}
+	}
+	for(size_t i = 0; i < A->Layout.size(); i++) {
+		const VertexDescriptorElement &a = A->Layout[i], &b = B->Layout[i];
+		if((a.binding != b.binding) || (a.location != b.location) || (a.format != b.format) ||
+		   (a.offset != b.offset) || (a.usage != b.usage)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void GeometryArena::add(Model *M) {
+	if(!SameVertexLayout(M->VD, VD)) {
+		std::cout << "Models in a geometry arena must have its vertex layout\n";
+		throw std::runtime_error("wrong vertex layout for the geometry arena");
+	}
+	M->arena = this;
+	models.push_back(M);
+}
+
+void GeometryArena::build() {
+	int stride = VD->Bindings[0].stride;
+	size_t vertexCount = 0, indexCount = 0;
+	for(Model *M : models) {
+		M->firstIndex = (uint32_t)indexCount;
+		M->vertexOffset = (int32_t)vertexCount;
+		vertexCount += M->vertices.size() / stride;
+		indexCount += M->indices.size();
+	}
+	if((vertexCount == 0) || (indexCount == 0)) {
+		return;
+	}
+
+	BP->createBuffer(vertexCount * stride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						vertexBuffer, vertexBufferMemory);
+	BP->createBuffer(indexCount * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						indexBuffer, indexBufferMemory);
+
+	void* data;
+	vkMapMemory(BP->device, vertexBufferMemory, 0, vertexCount * stride, 0, &data);
+	for(Model *M : models) {
+		memcpy((char *)data + (size_t)M->vertexOffset * stride, M->vertices.data(), M->vertices.size());
+	}
+	vkUnmapMemory(BP->device, vertexBufferMemory);
+
+	vkMapMemory(BP->device, indexBufferMemory, 0, indexCount * sizeof(uint32_t), 0, &data);
+	for(Model *M : models) {
+		memcpy((uint32_t *)data + M->firstIndex, M->indices.data(), M->indices.size() * sizeof(uint32_t));
+	}
+	vkUnmapMemory(BP->device, indexBufferMemory);
+
+	std::cout << "[Arena] Models: " << models.size() << " Vertices: " << vertexCount
+			  << " Indices: " << indexCount << "\n";
+}
+
+// after the indices of M have been reordered (e.g. by Model::buildMeshlets())
+void GeometryArena::updateIndices(Model *M) {
+	if(!isBuilt()) {
+		// not built yet: build() will copy them
+		return;
+	}
+	VkDeviceSize offset = (VkDeviceSize)M->firstIndex * sizeof(uint32_t);
+	VkDeviceSize size = M->indices.size() * sizeof(uint32_t);
+	void* data;
+	vkMapMemory(BP->device, indexBufferMemory, offset, size, 0, &data);
+	memcpy(data, M->indices.data(), (size_t)size);
+	vkUnmapMemory(BP->device, indexBufferMemory);
+}
+
+void GeometryArena::cleanup() {
+	if(vertexBuffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
+		vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+		vertexBuffer = VK_NULL_HANDLE;
+	}
+	if(indexBuffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+		vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+		indexBuffer = VK_NULL_HANDLE;
+	}
+	models.clear();
+}
+
+void GeometryArena::bind(VkCommandBuffer commandBuffer) {
+	VkBuffer vertexBuffers[] = {vertexBuffer};
+	VkDeviceSize offsets[] = {0};
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
 
 
 
@@ -3427,10 +4161,16 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt) {
 	int texWidth, texHeight, texChannels;
 	int curWidth = -1, curHeight = -1, curChannels = -1;
 	stbi_uc* pixels[maxImgs];
+	// single channel formats (e.g. distance fields) are uploaded with one byte per texel
+	int texBpp = ((Fmt == VK_FORMAT_R8_UNORM) || (Fmt == VK_FORMAT_R8_SRGB)) ? 1 : 4;
 	
+	VFSFile F;
 	for(int i = 0; i < imgs; i++) {
-	 	pixels[i] = stbi_load(files[i].c_str(), &texWidth, &texHeight,
-						&texChannels, STBI_rgb_alpha);
+		pixels[i] = nullptr;
+		if(VFSRead(files[i], F)) {
+			pixels[i] = stbi_load_from_memory(F.data, (int)F.size, &texWidth, &texHeight,
+						&texChannels, texBpp == 1 ? STBI_grey : STBI_rgb_alpha);
+		}
 		if (!pixels[i]) {
 			std::cout << "Not found: " << files[i] << "\n";
 			throw std::runtime_error("failed to load texture image!");
@@ -3451,8 +4191,8 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt) {
 		}
 	}
 	
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	VkDeviceSize totalImageSize = texWidth * texHeight * 4 * imgs;
+	VkDeviceSize imageSize = texWidth * texHeight * texBpp;
+	VkDeviceSize totalImageSize = texWidth * texHeight * texBpp * imgs;
 	mipLevels = static_cast<uint32_t>(std::floor(
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 	
@@ -4385,11 +5125,14 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		uniformBuffers[j].resize(BP->swapChainImages.size());
 		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
 //std::cout << j << " " << (DSL->Bindings[j].type) << "\n";
-		if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+		if((DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) ||
+		   (DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)) {
 //std::cout << "Uniform size: " << DSL->Bindings[j].linkSize << "\n";
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				VkDeviceSize bufferSize = DSL->Bindings[j].linkSize;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				BP->createBuffer(bufferSize,
+									 (DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) ?
+										VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
@@ -4425,7 +5168,8 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		std::vector<VkDescriptorImageInfo> imageInfo(imgInfoSize);
 		for (int j = 0; j < size; j++) {
 //std::cout << "Consdering binding " << j << "\n";	
-			if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+			if((DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) ||
+			   (DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)) {
 //std::cout << "Writing uniform buffer " << j <<"\n";			
 				bufferInfo[j].buffer = uniformBuffers[j][i];
 				bufferInfo[j].offset = 0;
@@ -4435,7 +5179,7 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 				descriptorWrites[j].dstSet = descriptorSets[i];
 				descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
 				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				descriptorWrites[j].descriptorType = DSL->Bindings[j].type;
 				descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
 				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
 			} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
@@ -4489,9 +5233,20 @@ void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId,
 }
 
 void DescriptorSet::map(int currentImage, void *src, int slot) {
+	map(currentImage, src, slot, Layout->Bindings[slot].linkSize);
+}
+
+void DescriptorSet::map(int currentImage, void *src, int slot, size_t size) {
 	void* data;
 
-	int size = Layout->Bindings[slot].linkSize;
+	if(size == 0) {
+		return;
+	}
+	if(size > (size_t)Layout->Bindings[slot].linkSize) {
+		std::cout << "Descriptor set map: " << size << " bytes in slot " << slot << ", only "
+				  << Layout->Bindings[slot].linkSize << " copied\n";
+		size = Layout->Bindings[slot].linkSize;
+	}
 
 	vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
 						size, 0, &data);
@@ -4499,4 +5254,82 @@ void DescriptorSet::map(int currentImage, void *src, int slot) {
 	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);	
 }
 
+void IndirectBuffer::init(BaseProject *bp, uint32_t maxDraws) {
+	BP = bp;
+	this->maxDraws = maxDraws;
+	direct = (BP->maxDrawIndirectCount == 1) && (maxDraws > 1);
+	recorded.clear();
+	if(direct) {
+		return;
+	}
+
+	int imgs = BP->swapChainImages.size();
+	buffers.resize(imgs);
+	buffersMemory.resize(imgs);
+	commands.resize(imgs);
+	used.assign(imgs, 0);
+
+	VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * maxDraws;
+	for(int i = 0; i < imgs; i++) {
+		BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+							VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							buffers[i], buffersMemory[i]);
+		void *data;
+		vkMapMemory(BP->device, buffersMemory[i], 0, bufferSize, 0, &data);
+		commands[i] = (VkDrawIndexedIndirectCommand *)data;
+		memset(data, 0, (size_t)bufferSize);
+	}
+}
+
+void IndirectBuffer::cleanup() {
+	for(size_t i = 0; i < buffers.size(); i++) {
+		vkUnmapMemory(BP->device, buffersMemory[i]);
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		vkFreeMemory(BP->device, buffersMemory[i], nullptr);
+	}
+	buffers.clear();
+	buffersMemory.clear();
+	commands.clear();
+}
+
+// The buffer of currentImage is not in use: drawFrame() has waited for its fence
+bool IndirectBuffer::update(int currentImage, const std::vector<VkDrawIndexedIndirectCommand> &draws) {
+	uint32_t n = (uint32_t)draws.size();
+	if(n > maxDraws) {
+		std::cout << "Indirect buffer: " << n << " draws, only " << maxDraws << " drawn\n";
+		n = maxDraws;
+	}
+	if(direct) {
+		if((recorded.size() == n) &&
+		   (memcmp(recorded.data(), draws.data(), n * sizeof(VkDrawIndexedIndirectCommand)) == 0)) {
+			return false;
+		}
+		recorded.assign(draws.begin(), draws.begin() + n);
+		return true;
+	}
+	VkDrawIndexedIndirectCommand *C = commands[currentImage];
+	memcpy(C, draws.data(), n * sizeof(VkDrawIndexedIndirectCommand));
+	if(used[currentImage] > n) {
+		memset(C + n, 0, (used[currentImage] - n) * sizeof(VkDrawIndexedIndirectCommand));
+	}
+	used[currentImage] = n;
+	return false;
+}
+
+void IndirectBuffer::draw(VkCommandBuffer commandBuffer, int currentImage) {
+	if(direct) {
+		for(auto &D : recorded) {
+			vkCmdDrawIndexed(commandBuffer, D.indexCount, D.instanceCount, D.firstIndex,
+							 D.vertexOffset, D.firstInstance);
+		}
+		return;
+	}
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	for(uint32_t first = 0; first < maxDraws; first += BP->maxDrawIndirectCount) {
+		uint32_t count = std::min(maxDraws - first, BP->maxDrawIndirectCount);
+		vkCmdDrawIndexedIndirect(commandBuffer, buffers[currentImage], first * stride, count, stride);
+	}
+}
+
 #endif
\ No newline at end of file
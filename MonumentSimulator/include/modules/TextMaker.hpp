@@ -24,6 +24,19 @@ struct Font {
 	std::vector<FontDef> faces;	
 };
 
+// Signed distance field version of a font atlas (see tools/FontSDFGen.cpp).
+// It shares the glyph table of the bitmap Font, since UVs are normalized.
+// Bold and small faces are obtained from the regular ones by moving
+// the contour and by scaling, so only the regular and italic faces are used.
+// All distances are in texels of the bitmap atlas.
+struct FontSDF {
+	std::string textureFile;
+	float spread;			// distance mapped to the [0,1] range of the atlas
+	float boldWeight;		// contour expansion for bold text
+	float strokeWidth;		// width of the stroke around the glyphs
+	glm::vec2 shadowOffset;	// displacement of the shadow
+};
+
 enum TextAlignment {TAL_LEFT, TAL_CENTER, TAL_RIGHT};
 enum TextRegistrationH {TRH_LEFT, TRH_CENTER, TRH_RIGHT};
 enum TextRegistrationV {TRV_TOP, TRV_MIDDLE, TRV_BOTTOM};
@@ -82,6 +95,13 @@ struct TextColorPushConstant {
 	alignas(16) glm::vec4 Shadow;
 };
 
+struct TextSDFPushConstant {
+	alignas(16) glm::vec4 Fill;
+	alignas(16) glm::vec4 Stroke;
+	alignas(16) glm::vec4 Shadow;
+	alignas(16) glm::vec4 Params;	// x: weight, y: stroke width, zw: shadow offset in UV
+};
+
 #ifdef TEXTMAKER_IMPLEMENTATION
 extern const Font mainFont = {
 	32, 126, 2048, 2048,
@@ -2485,8 +2505,14 @@ extern const Font mainFont = {
 {1536,1907,28,16,4,4,23}}}
 }
 };
+
+extern const FontSDF mainFontSDF = {
+	"assets/textures/FontsSDF.png",
+	16.0f, 1.5f, 1.5f, {2.0f, 2.0f}
+};
 #else
 extern const Font mainFont;
+extern const FontSDF mainFontSDF;
 #endif
 
 struct TextMaker {
@@ -2507,6 +2533,8 @@ struct TextMaker {
 	int maxTextId = 0;
 	
 	Font fnt = mainFont;
+	FontSDF fntSDF = mainFontSDF;
+	bool useSDF = false;
 	
 	bool commandBufferMustUpdate = false;
 	
@@ -2522,7 +2550,7 @@ struct TextMaker {
 			  float sx = 1.0f, float sy = 1.0f);
 	void removeText(int id);
 	void removeAllText();
-	void init(BaseProject *_BP, int sW, int sH, int so = 10000);
+	void init(BaseProject *_BP, int sW, int sH, int so = 10000, bool sdf = false);
 	void resizeScreen(int sW, int sH);
 	void createTextDescriptorSetAndVertexLayout();
  	void createTextPipeline();
@@ -2607,6 +2635,16 @@ int TextMaker::print(float x, float y, std::string Text, int id,
 	
 	fontId = (FontFace == "SS" ? 8 : (FontFace == "SR" ? 16 : 0)) +
 			 (Bold   ? 2 : 0) + (Italic ? 1 : 0) +(Small  ? 4 : 0);
+	if(useSDF) {
+		// Bold is rendered with the weight in the shader, and Small by scaling the regular face
+		int regId = fontId & ~6;
+		if(Small) {
+			float s = (float)fnt.faces[fontId].lineHeight / (float)fnt.faces[regId].lineHeight;
+			sx *= s;
+			sy *= s;
+		}
+		fontId = regId;
+	}
 
 	measureText(Text, fontId, w, h, nlines, totChars, linew, lines);
 //std::cout << id << "\n";
@@ -2630,11 +2668,12 @@ void TextMaker::removeAllText() {
 	commandBufferMustUpdate = true;
 }
 
-void TextMaker::init(BaseProject *_BP, int sW, int sH, int so) {
+void TextMaker::init(BaseProject *_BP, int sW, int sH, int so, bool sdf) {
 	BP = _BP;
 	screenW = sW;
 	screenH = sH;
 	submitOrder = so;
+	useSDF = sdf;
 
 	createTextDescriptorSetAndVertexLayout();
 	createTextPipeline();
@@ -2645,7 +2684,11 @@ void TextMaker::init(BaseProject *_BP, int sW, int sH, int so) {
 	RP.properties[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	RP.properties[1].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 
-	T.init(BP, fnt.textureFile);
+	if(useSDF) {
+		T.init(BP, fntSDF.textureFile, VK_FORMAT_R8_UNORM);
+	} else {
+		T.init(BP, fnt.textureFile);
+	}
 	
 	BP->DPSZs.texturesInPool += 2;	// Since text can be written before the old is released
 	BP->DPSZs.setsInPool += 2;		// we need twice the descriptors (old + new)
@@ -2674,8 +2717,13 @@ void TextMaker::createTextDescriptorSetAndVertexLayout() {
 
 
 void TextMaker::createTextPipeline() {
-	P.init(BP, &VD, "shaders/Text.vert.spv", "shaders/Text.frag.spv", {&DSL},
-		{{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TextColorPushConstant)}});
+	if(useSDF) {
+		P.init(BP, &VD, "shaders/Text.vert.spv", "shaders/TextSDF.frag.spv", {&DSL},
+			{{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TextSDFPushConstant)}});
+	} else {
+		P.init(BP, &VD, "shaders/Text.vert.spv", "shaders/Text.frag.spv", {&DSL},
+			{{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TextColorPushConstant)}});
+	}
 	P.setCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL);
 	P.setCullMode(VK_CULL_MODE_NONE);
 	P.setTransparency(true);
@@ -2830,17 +2878,37 @@ void TextMaker::populateCommandBuffer(VkCommandBuffer commandBuffer, int current
 	for(auto& Blk : Blocks) {
 //std::cout << Blk.second.start << " " << Blk.second.len << "\n";
 		// Sends the Push-Constant with the colors
-		TextColorPushConstant PKv;
-		PKv.Fill   = Blk.second.Fill;
-		PKv.Stroke = Blk.second.Stroke;
-		PKv.Shadow = Blk.second.Shadow;
-		vkCmdPushConstants(
-			commandBuffer,
-			P.pipelineLayout,
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			0,
-			sizeof(PKv),
-			&PKv);
+		if(useSDF) {
+			// distances are converted from atlas texels to the [0,1] range of the field
+			float dScale = 0.5f / fntSDF.spread;
+			TextSDFPushConstant PKv;
+			PKv.Fill   = Blk.second.Fill;
+			PKv.Stroke = Blk.second.Stroke;
+			PKv.Shadow = Blk.second.Shadow;
+			PKv.Params = glm::vec4((Blk.second.Bold ? fntSDF.boldWeight : 0.0f) * dScale,
+								   fntSDF.strokeWidth * dScale,
+								   fntSDF.shadowOffset.x / (float)fnt.texW,
+								   fntSDF.shadowOffset.y / (float)fnt.texH);
+			vkCmdPushConstants(
+				commandBuffer,
+				P.pipelineLayout,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(PKv),
+				&PKv);
+		} else {
+			TextColorPushConstant PKv;
+			PKv.Fill   = Blk.second.Fill;
+			PKv.Stroke = Blk.second.Stroke;
+			PKv.Shadow = Blk.second.Shadow;
+			vkCmdPushConstants(
+				commandBuffer,
+				P.pipelineLayout,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(PKv),
+				&PKv);
+		}
 				
 		vkCmdDrawIndexed(commandBuffer,
 						static_cast<uint32_t>(Blk.second.len), 1,
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <string>
 
 #define M_PI		3.14159265358979323846	/* pi */
@@ -18,6 +19,9 @@ struct UniformBufferObject {
 	alignas(16) glm::mat4 mvpMat;
 	alignas(16) glm::mat4 mMat;
 	alignas(16) glm::mat4 nMat;
+	// used only by the shaders of the compact vertices, to restore the positions
+	alignas(16) glm::vec4 dequantScale;
+	alignas(16) glm::vec4 dequantOffset;
 };
 
 struct GlobalUniformBufferObject {
@@ -32,6 +36,15 @@ struct GlobalUniformBufferObject {
 	alignas(4) float lightIntensity;
 };
 
+// Skinned models: the joint matrices of all the instances are in a single storage
+// buffer (see PBRSkin.vert), and each instance starts from its firstJoint
+struct SkinnedUniformBufferObject {
+	alignas(16) glm::mat4 mvpMat;
+	alignas(16) glm::mat4 mMat;
+	alignas(16) glm::mat4 nMat;
+	alignas(4) uint32_t firstJoint;
+};
+
 struct SkyBoxUniformBufferObject {
 	alignas(16) glm::mat4 mvpMat;
 };
@@ -50,6 +63,30 @@ struct VertexTan {
 	glm::vec4 tangent;
 };
 
+struct VertexSkinned {
+	glm::vec3 pos;
+	glm::vec2 UV;
+	glm::vec3 normal;
+	glm::vec4 tangent;
+	glm::vec4 weights;
+	glm::uvec4 joints;
+};
+
+// Compact versions of Vertex and VertexTan: 16 bit positions in the bounding box of the
+// model, half float UVs, and octahedral normals and tangents (see VertexQuant.hpp)
+struct VertexQ {
+	glm::i16vec4 pos;
+	glm::u16vec2 UV;
+	glm::i16vec2 norm;
+};
+
+struct VertexTanQ {
+	glm::i16vec4 pos;
+	glm::u16vec2 UV;
+	glm::i16vec2 normal;
+	glm::i16vec2 tangent;
+};
+
 struct skyBoxVertex {
 	glm::vec3 pos;
 	glm::vec2 UV;
@@ -0,0 +1,161 @@
+// Virtual file system, used by all the asset loaders
+//
+// Files are looked up in the MGCG bundles mounted in MGCGloader, the last mounted
+// first, and then on disk. Bundle entries packed with MGCGPack -s (stored, not
+// encrypted) are returned as views into the memory mapped bundle, without copies,
+// and the VFSFile keeps the bundle mapped even after MGCGloader.release();
+// all other files are loaded in the buffer of the VFSFile.
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <streambuf>
+
+// requires MGCGReader.hpp, tiny_obj_loader.h and tiny_gltf.h, included by Starter.hpp
+
+struct VFSFile {
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+	std::vector<unsigned char> buffer;	// content, when it is not a view into a bundle
+	std::shared_ptr<const MGCGBundle> bundle;	// the bundle it is a view into
+};
+
+bool VFSExists(const std::string &name);
+bool VFSSize(const std::string &name, size_t &size);
+bool VFSRead(const std::string &name, VFSFile &F);
+
+// read only stream on a memory block, for the loaders that use std::istream
+struct VFSStreamBuf : public std::streambuf {
+	VFSStreamBuf(const unsigned char *p, size_t n) {
+		char *c = (char *)p;
+		setg(c, c, c + n);
+	}
+};
+
+// .mtl files of OBJ models, read through the VFS
+class VFSMaterialReader : public tinyobj::MaterialReader {
+	std::string baseDir;
+  public:
+	VFSMaterialReader(const std::string &dir) : baseDir(dir) {}
+	virtual bool operator()(const std::string &matId, std::vector<tinyobj::material_t> *materials,
+							std::map<std::string, int> *matMap, std::string *warn, std::string *err);
+};
+
+// callbacks for the external buffers and images of glTF files
+tinygltf::FsCallbacks VFSgltfCallbacks();
+
+
+#ifdef VFS_IMPLEMENTATION
+
+bool VFSExists(const std::string &name) {
+	if(MGCGloader.contains(name)) {
+		return true;
+	}
+	FILE *f = fopen(name.c_str(), "rb");
+	if(f != nullptr) {
+		fclose(f);
+		return true;
+	}
+	return false;
+}
+
+bool VFSSize(const std::string &name, size_t &size) {
+	const MGCGEntry *E = MGCGloader.find(name);
+	if(E != nullptr) {
+		size = E->size;
+		return true;
+	}
+	FILE *f = fopen(name.c_str(), "rb");
+	if(f == nullptr) {
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	size = (size_t)ftell(f);
+	fclose(f);
+	return true;
+}
+
+bool VFSRead(const std::string &name, VFSFile &F) {
+	F.bundle.reset();
+	if(MGCGloader.view(name, F.data, F.size, &F.bundle)) {
+		return true;
+	}
+	if(MGCGloader.read(name, F.buffer)) {
+		F.data = F.buffer.data();
+		F.size = F.buffer.size();
+		return true;
+	}
+
+	FILE *f = fopen(name.c_str(), "rb");
+	if(f == nullptr) {
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	F.buffer.resize(fileSize);
+	size_t n = fread(F.buffer.data(), 1, fileSize, f);
+	fclose(f);
+	if(n != (size_t)fileSize) {
+		return false;
+	}
+	F.data = F.buffer.data();
+	F.size = F.buffer.size();
+	return true;
+}
+
+bool VFSMaterialReader::operator()(const std::string &matId, std::vector<tinyobj::material_t> *materials,
+								   std::map<std::string, int> *matMap, std::string *warn, std::string *err) {
+	std::string path = baseDir.empty() ? matId : baseDir + "/" + matId;
+	VFSFile F;
+	if(!VFSRead(path, F)) {
+		if(warn) {
+			(*warn) += "Material file [ " + path + " ] not found\n";
+		}
+		return false;
+	}
+	VFSStreamBuf buf(F.data, F.size);
+	std::istream in(&buf);
+	tinyobj::LoadMtl(matMap, materials, &in, warn, err);
+	return true;
+}
+
+static bool VFSgltfFileExists(const std::string &abs_filename, void *) {
+	return VFSExists(abs_filename);
+}
+
+static bool VFSgltfReadWholeFile(std::vector<unsigned char> *out, std::string *err,
+								 const std::string &filepath, void *) {
+	VFSFile F;
+	if(!VFSRead(filepath, F)) {
+		if(err) {
+			(*err) += "File open error : " + filepath + "\n";
+		}
+		return false;
+	}
+	if(F.data == F.buffer.data()) {
+		out->swap(F.buffer);
+	} else {
+		out->assign(F.data, F.data + F.size);
+	}
+	return true;
+}
+
+static bool VFSgltfGetFileSize(size_t *filesize_out, std::string *err,
+							   const std::string &filepath, void *) {
+	if(!VFSSize(filepath, *filesize_out)) {
+		if(err) {
+			(*err) += "File open error : " + filepath + "\n";
+		}
+		return false;
+	}
+	return true;
+}
+
+tinygltf::FsCallbacks VFSgltfCallbacks() {
+	tinygltf::FsCallbacks fs = {VFSgltfFileExists, tinygltf::ExpandFilePath, VFSgltfReadWholeFile,
+								tinygltf::WriteWholeFile, VFSgltfGetFileSize, nullptr};
+	return fs;
+}
+
+#endif
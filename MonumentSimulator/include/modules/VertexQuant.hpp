@@ -0,0 +1,93 @@
+// Compact vertex components
+//
+// The formats selected in a VertexDescriptor decide how the loaders store each component:
+//   POSITION  VK_FORMAT_R16G16B16A16_SNORM : 16 bits per coordinate, in the bounding box
+//                                            of the model (see Model::dequantScale)
+//   NORMAL    VK_FORMAT_R16G16_SNORM       : octahedral encoding of the unit vector
+//   TANGENT   VK_FORMAT_R16G16_SNORM       : octahedral encoding, with the sign of the
+//                                            bitangent in the sign of the second value
+//   UV        VK_FORMAT_R16G16_SFLOAT      : half floats
+// The vertex shader gets positions in [-1, 1], and has to decode normals and tangents
+// (see shaders/PhongQ.vert and shaders/PBRQ.vert).
+
+#include <cstdint>
+#include <cmath>
+
+// requires glm, with gtc/packing.hpp and gtc/type_precision.hpp, included by Starter.hpp
+
+enum VertexComponentFormat {VCF_FLOAT, VCF_SNORM16, VCF_OCT16, VCF_HALF};
+
+// octahedral encoding of a unit vector
+glm::vec2 QuantOct(glm::vec3 n);
+// Stores count elements of comps floats each, read every srcStride floats, in the format
+// F, at dst, every dstStride bytes. Positions are mapped from offset +/- scale to [-1, 1].
+void QuantEncode(VertexComponentFormat F, const float *src, int srcStride, size_t count, int comps,
+				 unsigned char *dst, int dstStride, glm::vec3 offset, glm::vec3 scale);
+
+
+#ifdef VERTEXQUANT_IMPLEMENTATION
+
+glm::vec2 QuantOct(glm::vec3 n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if(l1 == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	n /= l1;
+	glm::vec2 e(n.x, n.y);
+	if(n.z < 0.0f) {
+		e = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+					  (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+	return e;
+}
+
+static inline int16_t QuantSnorm16(float v) {
+	v = std::max(-1.0f, std::min(1.0f, v));
+	return (int16_t)std::lround(v * 32767.0f);
+}
+
+void QuantEncode(VertexComponentFormat F, const float *src, int srcStride, size_t count, int comps,
+				 unsigned char *dst, int dstStride, glm::vec3 offset, glm::vec3 scale) {
+	glm::vec3 invScale = 1.0f / scale;
+	for(size_t i = 0; i < count; i++) {
+		const float *s = src + i * srcStride;
+		unsigned char *d = dst + i * dstStride;
+		switch(F) {
+		  case VCF_SNORM16:
+			{
+				int16_t q[4] = {0, 0, 0, 0};
+				for(int c = 0; c < comps && c < 3; c++) {
+					q[c] = QuantSnorm16((s[c] - offset[c]) * invScale[c]);
+				}
+				memcpy(d, q, sizeof(q));
+			}
+			break;
+		  case VCF_OCT16:
+			{
+				glm::vec2 e = QuantOct(glm::vec3(s[0], s[1], s[2]));
+				if(comps == 4) {
+					// the second value moves to [1/32767, 1], and takes the sign of w
+					float y = std::max(e.y * 0.5f + 0.5f, 1.0f / 32767.0f);
+					e.y = (s[3] < 0.0f) ? -y : y;
+				}
+				int16_t q[2] = {QuantSnorm16(e.x), QuantSnorm16(e.y)};
+				memcpy(d, q, sizeof(q));
+			}
+			break;
+		  case VCF_HALF:
+			{
+				uint16_t h[4];
+				for(int c = 0; c < comps; c++) {
+					h[c] = glm::packHalf1x16(s[c]);
+				}
+				memcpy(d, h, comps * sizeof(uint16_t));
+			}
+			break;
+		  case VCF_FLOAT:
+			memcpy(d, s, comps * sizeof(float));
+			break;
+		}
+	}
+}
+
+#endif
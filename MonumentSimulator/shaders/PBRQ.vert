@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// PBR.vert for the compact vertices (VertexTanQ): positions are 16 bit values in the
+// bounding box of the model, normals and tangents are octahedral encoded, and the
+// bitangent sign of the tangent is the sign of its second value
+
+// UBO (set=1, binding=0)
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    mat4 mvpMat;        // proj * view * model
+    mat4 mMat;          // model matrix
+    mat4 nMat;          // inverse-transpose(model)
+    vec4 dequantScale;  // half size of the bounding box
+    vec4 dequantOffset; // center of the bounding box
+} ubo;
+
+layout(location = 0) in vec4 inPosition;  // position in [-1, 1]
+layout(location = 1) in vec2 inUV;        // coords UV
+layout(location = 2) in vec2 inNormal;    // octahedral normal
+layout(location = 3) in vec2 inTangent;   // octahedral tangent, y remapped with the sign
+
+layout(location = 0) out vec3 fragPos;      // posizione mondo
+layout(location = 1) out vec2 fragUV;       // UV
+layout(location = 2) out vec3 fragNormal;   // normale mondo
+layout(location = 3) out vec4 fragTangent;  // tangente mondo
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    vec3 pos = inPosition.xyz * ubo.dequantScale.xyz + ubo.dequantOffset.xyz;
+    vec3 normal = octDecode(inNormal);
+    float w = (inTangent.y < 0.0) ? -1.0 : 1.0;
+    vec3 tangent = octDecode(vec2(inTangent.x, abs(inTangent.y) * 2.0 - 1.0));
+
+    // We take the position in world-space
+    fragPos = (ubo.mMat * vec4(pos, 1.0)).xyz;
+
+    // We take the normal in world-space
+    fragNormal = normalize((ubo.nMat * vec4(normal, 0.0)).xyz);
+    fragTangent = vec4(normalize(mat3(ubo.mMat) * tangent), w);
+
+    // UV coordinates
+    fragUV = inUV;
+
+    // Clip‐space
+    gl_Position = ubo.mvpMat * vec4(pos, 1.0);
+}
@@ -0,0 +1,55 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Skinned variant of PBR.vert, for the same fragment shader
+
+// UBO (set=1, binding=0)
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    mat4 mvpMat;   // proj * view * model
+    mat4 mMat;     // model matrix
+    mat4 nMat;     // inverse-transpose(model)
+    uint firstJoint;  // where the joints of this instance start in the palette
+} ubo;
+
+// joint matrices (pose * inverse bind) of all the skinned instances drawn in the frame
+layout(std430, set = 2, binding = 0) readonly buffer JointPalette {
+    mat4 joints[];
+} palette;
+
+layout(location = 0) in vec3 inPosition;  // model position
+layout(location = 1) in vec2 inUV;        // coords UV
+layout(location = 2) in vec3 inNormal;    // nornal model
+layout(location = 3) in vec4 inTangent;   // model tangent (w = bitangent-sign)
+layout(location = 4) in vec4 inWeights;   // joint weights
+layout(location = 5) in uvec4 inJoints;   // joint indices, in the skin
+
+layout(location = 0) out vec3 fragPos;      // posizione mondo
+layout(location = 1) out vec2 fragUV;       // UV
+layout(location = 2) out vec3 fragNormal;   // normale mondo
+layout(location = 3) out vec4 fragTangent;  // tangente mondo
+
+void main() {
+    // blended joint matrix, in model space
+    mat4 skin = inWeights.x * palette.joints[ubo.firstJoint + inJoints.x] +
+                inWeights.y * palette.joints[ubo.firstJoint + inJoints.y] +
+                inWeights.z * palette.joints[ubo.firstJoint + inJoints.z] +
+                inWeights.w * palette.joints[ubo.firstJoint + inJoints.w];
+
+    vec4 pos = skin * vec4(inPosition, 1.0);
+    // the joints have no shear: the normals can be moved with the same matrix
+    vec3 normal = mat3(skin) * inNormal;
+    vec3 tangent = mat3(skin) * inTangent.xyz;
+
+    // We take the position in world-space
+    fragPos = (ubo.mMat * pos).xyz;
+
+    // We take the normal in world-space
+    fragNormal = normalize((ubo.nMat * vec4(normal, 0.0)).xyz);
+    fragTangent = vec4(normalize(mat3(ubo.mMat) * tangent), inTangent.w);
+
+    // UV coordinates
+    fragUV = inUV;
+
+    // Clip‐space
+    gl_Position = ubo.mvpMat * pos;
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Phong.vert for the compact vertices (VertexQ): positions are 16 bit values in the
+// bounding box of the model, and normals are octahedral encoded
+
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    mat4 mvpMat;         // proj * view * model
+    mat4 mMat;          // model matrix
+    mat4 nMat;         // (inverse transpose of model’s 3×3)
+    vec4 dequantScale;  // half size of the bounding box
+    vec4 dequantOffset; // center of the bounding box
+} ubo;
+
+layout(location = 0) in vec4 inPosition;  // position in [-1, 1]
+layout(location = 1) in vec2 inUV;        // coordinates UV
+layout(location = 2) in vec2 inNormal;    // octahedral normal
+
+layout(location = 0) out vec3 fragPos;     // position world‐space
+layout(location = 1) out vec2 fragUV;      // UV coordinates
+layout(location = 2) out vec3 fragNormal;  // normal world‐space
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    vec3 pos = inPosition.xyz * ubo.dequantScale.xyz + ubo.dequantOffset.xyz;
+
+    // We take the position in world-space
+    fragPos = (ubo.mMat * vec4(pos, 1.0)).xyz;
+
+    // We take the normal in world-space
+    fragNormal = (ubo.nMat * vec4(octDecode(inNormal), 0.0)).xyz;
+
+    // Pass the UV coordinates to the fragment shader
+    fragUV = inUV;
+
+    // Calculate the final position in clip space
+    gl_Position = ubo.mvpMat * vec4(pos, 1.0);
+}
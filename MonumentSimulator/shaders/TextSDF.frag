@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+// single channel distance field: 0.5 on the contour, greater inside the glyph
+layout(binding = 0) uniform sampler2D texSampler;
+
+layout(push_constant) uniform PushConsts {
+	vec4 FGcolor;
+	vec4 BGcolor;
+	vec4 SHcolor;
+	vec4 Params;	// x: weight, y: stroke width, zw: shadow offset
+} pushConsts;
+
+void main() {
+	float d = texture(texSampler, fragTexCoord).r + pushConsts.Params.x;
+	// half a pixel on screen, whatever the scale of the text
+	float aa = max(0.7 * fwidth(d), 0.001);
+	
+	float fill = smoothstep(0.5 - aa, 0.5 + aa, d);
+	float outer = smoothstep(0.5 - pushConsts.Params.y - aa, 0.5 - pushConsts.Params.y + aa, d);
+	
+	float s = texture(texSampler, fragTexCoord - pushConsts.Params.zw).r + pushConsts.Params.x;
+	float shadow = smoothstep(0.5 - pushConsts.Params.y - 4.0 * aa, 0.5 + aa, s) * (1.0 - outer);
+
+	outColor = fill * pushConsts.FGcolor +
+			   (outer - fill) * pushConsts.BGcolor +
+			   shadow * pushConsts.SHcolor;
+}
@@ -6,8 +6,8 @@
 #define  TEXTMAKER_IMPLEMENTATION
 #include "modules/TextMaker.hpp"
 
-#define  SCENE_IMPLEMENTATION
-#include "modules/Scene.hpp"
-
 #define ANIMATIONS_IMPLEMENTATION
 #include "modules/Animations.hpp"
+
+#define  SCENE_IMPLEMENTATION
+#include "modules/Scene.hpp"
@@ -5,9 +5,10 @@
 
 #include "modules/Starter.hpp"
 #include "modules/TextMaker.hpp"
-#include "modules/Scene.hpp"
 #include "modules/Animations.hpp"
+#include "modules/Scene.hpp"
 #include "modules/Utils.hpp"
+#include "modules/SimLoop.hpp"
 
 using namespace std;
 using namespace glm;
@@ -18,6 +19,24 @@ enum class AppState {
 	Playing
 };
 
+// --- Drone simulation, stepped at a fixed rate by a SimLoop ---
+struct DroneState {
+	glm::vec3 pos;
+	float yaw, pitch, roll;
+	float time;		// simulated time, drives the day/night cycle
+};
+
+// keys held in the last frame, one bit each
+enum DroneKey {
+	DK_YAW_LEFT = 1, DK_YAW_RIGHT = 2, DK_PITCH_UP = 4, DK_PITCH_DOWN = 8,
+	DK_ROLL_LEFT = 16, DK_ROLL_RIGHT = 32, DK_FORWARD = 64, DK_BACK = 128,
+	DK_RIGHT = 256, DK_LEFT = 512, DK_RISE = 1024, DK_SINK = 2048
+};
+
+struct DroneInput {
+	uint32_t keys;
+};
+
 // MonumentSimulator: subclass of BaseProject
 class MonumentSimulator : public BaseProject {
 protected:
@@ -50,6 +69,9 @@ protected:
 	std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
 	float totalElapsedTime = 0.0f;
 
+	// drone and clock, updated at 120 Hz on their own thread
+	SimLoop<DroneState, DroneInput> sim;
+
 	// --- Render Pass ---
 	RenderPass RP;
 
@@ -61,8 +83,15 @@ protected:
 		DSL_global;
 
 	// --- Vertex Descriptors ---
+	// Compact vertices (VertexQ and VertexTanQ) take half the memory and bandwidth of the
+	// float ones, and use the PhongQ and PBRQ vertex shaders
+	const bool compactVertices = true;
 	VertexDescriptor VD_phong, VD_pbr, VD_skyBox;
 
+	// --- Geometry arenas ---
+	// vertices and indices of the models of each vertex layout, bound once per pipeline
+	GeometryArena GA_phong, GA_pbr, GA_skyBox;
+
 	// --- Pipelines ---
 	Pipeline
 		P_phong,
@@ -88,6 +117,12 @@ protected:
 		DS_skyBox,
 		DS_global;
 
+	// --- Indirect draws ---
+	// visible clusters of the terrain, and level of detail of the drone, written every frame
+	IndirectBuffer IB_mountain, IB_drone;
+	std::vector<VkDrawIndexedIndirectCommand> drawsMountain, drawsDrone;
+	int droneLOD = 0;
+
 	// --- Uniform Buffers ---
 	UniformBufferObject
 		UBO_mountain,
@@ -166,40 +201,60 @@ protected:
 				{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1}
 		});
 
-		//Initialize vertex descriptor for Vertex { vec3 pos; vec2 UV; vec3 norm; }
-		VD_phong.init(this, {
-			// this array contains the bindings
-			// first  element : the binding number
-			// second element : the stride of this binging
-			// third  element : whether this parameter change per vertex or per instance using the corresponding Vulkan constant
-			{0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}
-		}, {
-			// this array contains the location
-			// first  element : the binding number
-			// second element : the location number
-			// third  element : the offset of this element in the memory record
-			// fourth element : the data type of the element the corresponding Vulkan constant
-			// fifth  elmenet : the size in byte of the element
-			// sixth  element : a constant defining the element usage
-			//                   POSITION - a vec3 with the position
-			//                   NORMAL   - a vec3 with the normal vector
-			//                   UV       - a vec2 with a UV coordinate
-			//                   COLOR    - a vec4 with a RGBA color
-			//                   TANGENT  - a vec4 with the tangent vector
-			//                   OTHER    - anything else
-			{0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos), sizeof(vec3), POSITION},
-			{0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, UV),  sizeof(vec2), UV},
-			{0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, norm), sizeof(vec3), NORMAL}
-		});
-
-		VD_pbr.init(this, {
-			{0, sizeof(VertexTan), VK_VERTEX_INPUT_RATE_VERTEX}
-		}, {
-			{0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, pos), sizeof(vec3), POSITION},
-			{0, 1, VK_FORMAT_R32G32_SFLOAT,   offsetof(VertexTan, UV), sizeof(vec2), UV},
-			{0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, normal), sizeof(vec3), NORMAL},
-			{0, 3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(VertexTan, tangent), sizeof(vec4), TANGENT}
-		});
+		// The formats of the compact vertices are listed in modules/VertexQuant.hpp
+		if(compactVertices) {
+			VD_phong.init(this, {
+				{0, sizeof(VertexQ), VK_VERTEX_INPUT_RATE_VERTEX}
+			}, {
+				{0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexQ, pos), sizeof(glm::i16vec4), POSITION},
+				{0, 1, VK_FORMAT_R16G16_SFLOAT, offsetof(VertexQ, UV), sizeof(glm::u16vec2), UV},
+				{0, 2, VK_FORMAT_R16G16_SNORM, offsetof(VertexQ, norm), sizeof(glm::i16vec2), NORMAL}
+			});
+
+			VD_pbr.init(this, {
+				{0, sizeof(VertexTanQ), VK_VERTEX_INPUT_RATE_VERTEX}
+			}, {
+				{0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexTanQ, pos), sizeof(glm::i16vec4), POSITION},
+				{0, 1, VK_FORMAT_R16G16_SFLOAT, offsetof(VertexTanQ, UV), sizeof(glm::u16vec2), UV},
+				{0, 2, VK_FORMAT_R16G16_SNORM, offsetof(VertexTanQ, normal), sizeof(glm::i16vec2), NORMAL},
+				{0, 3, VK_FORMAT_R16G16_SNORM, offsetof(VertexTanQ, tangent), sizeof(glm::i16vec2), TANGENT}
+			});
+		} else {
+			//Initialize vertex descriptor for Vertex { vec3 pos; vec2 UV; vec3 norm; }
+			VD_phong.init(this, {
+				// this array contains the bindings
+				// first  element : the binding number
+				// second element : the stride of this binging
+				// third  element : whether this parameter change per vertex or per instance using the corresponding Vulkan constant
+				{0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}
+			}, {
+				// this array contains the location
+				// first  element : the binding number
+				// second element : the location number
+				// third  element : the offset of this element in the memory record
+				// fourth element : the data type of the element the corresponding Vulkan constant
+				// fifth  elmenet : the size in byte of the element
+				// sixth  element : a constant defining the element usage
+				//                   POSITION - a vec3 with the position
+				//                   NORMAL   - a vec3 with the normal vector
+				//                   UV       - a vec2 with a UV coordinate
+				//                   COLOR    - a vec4 with a RGBA color
+				//                   TANGENT  - a vec4 with the tangent vector
+				//                   OTHER    - anything else
+				{0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos), sizeof(vec3), POSITION},
+				{0, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, UV),  sizeof(vec2), UV},
+				{0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, norm), sizeof(vec3), NORMAL}
+			});
+
+			VD_pbr.init(this, {
+				{0, sizeof(VertexTan), VK_VERTEX_INPUT_RATE_VERTEX}
+			}, {
+				{0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, pos), sizeof(vec3), POSITION},
+				{0, 1, VK_FORMAT_R32G32_SFLOAT,   offsetof(VertexTan, UV), sizeof(vec2), UV},
+				{0, 2, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, normal), sizeof(vec3), NORMAL},
+				{0, 3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(VertexTan, tangent), sizeof(vec4), TANGENT}
+			});
+		}
 
 		VD_skyBox.init(this, {
 			{0, sizeof(skyBoxVertex), VK_VERTEX_INPUT_RATE_VERTEX}
@@ -217,12 +272,12 @@ protected:
 		// The second parameter is the pointer to the vertex definition
 		// Third and fourth parameters are respectively the vertex and fragment shaders
 		// The last array, is a vector of pointer to the layouts of the sets that will be used in this pipeline. The first element will be set 0, and so on..
-		P_phong.init(this, &VD_phong, "shaders/Phong.vert.spv", "shaders/Phong.frag.spv", { &DSL_global, &DSL_mountain });
+		P_phong.init(this, &VD_phong, compactVertices ? "shaders/PhongQ.vert.spv" : "shaders/Phong.vert.spv", "shaders/Phong.frag.spv", { &DSL_global, &DSL_mountain });
 		P_phong.setCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL);
 		P_phong.setCullMode(VK_CULL_MODE_NONE);
 		P_phong.setPolygonMode(VK_POLYGON_MODE_FILL);
 
-		P_pbr.init(this, &VD_pbr, "shaders/PBR.vert.spv", "shaders/PBR.frag.spv", { &DSL_global, &DSL_drone });
+		P_pbr.init(this, &VD_pbr, compactVertices ? "shaders/PBRQ.vert.spv" : "shaders/PBR.vert.spv", "shaders/PBR.frag.spv", { &DSL_global, &DSL_drone });
 		P_pbr.setCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL);
 		P_pbr.setCullMode(VK_CULL_MODE_NONE);
 		P_pbr.setPolygonMode(VK_POLYGON_MODE_FILL);
@@ -232,13 +287,29 @@ protected:
 		P_skyBox.setCullMode(VK_CULL_MODE_NONE);
 		P_skyBox.setPolygonMode(VK_POLYGON_MODE_FILL);
 
+		// Assets packed with tools/MGCGPack replace the loose files, when the bundle is present
+		if(std::ifstream("assets/assets.mgcb").good()) {
+			MGCGloader.mount("assets/assets.mgcb");
+		}
+
 		// Create models
 		// The second parameter is the pointer to the vertex definition for this model
 		// The third parameter is the file name
 		// The last is a constant specifying the file type: currently only OBJ or GLTF
-		M_mountain.init(this, &VD_phong, "assets/models/snowyMountain.obj", OBJ);
-		M_drone.init(this, &VD_pbr, "assets/models/drone.gltf", GLTF);
-		M_skyBox.init(this, &VD_skyBox, "assets/models/skybox.gltf", GLTF);
+		// The optional last parameter is the geometry arena that will hold the buffers of the model
+		GA_phong.init(this, &VD_phong);
+		GA_pbr.init(this, &VD_pbr);
+		GA_skyBox.init(this, &VD_skyBox);
+		M_mountain.init(this, &VD_phong, "assets/models/snowyMountain.obj", OBJ, &GA_phong);
+		// the terrain is drawn only in the clusters seen by the camera
+		M_mountain.buildMeshlets();
+		M_drone.init(this, &VD_pbr, "assets/models/drone.gltf", GLTF, &GA_pbr);
+		// the drone gets simpler when it flies away from the camera
+		M_drone.buildLODs(4);
+		M_skyBox.init(this, &VD_skyBox, "assets/models/skybox.gltf", GLTF, &GA_skyBox);
+		GA_phong.build();
+		GA_pbr.build();
+		GA_skyBox.build();
 
 		// Create the textures
 		// The second parameter is the file name
@@ -259,12 +330,13 @@ protected:
 
 		// INIT TEXT
 		cout << "Initializing text\n";
-		menuTxt.init(this, windowWidth, windowHeight);
+		menuTxt.init(this, windowWidth, windowHeight, 10000, true);
 		cout << "Initialization completed!\n";
 
 		submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
 
 		startTime = std::chrono::high_resolution_clock::now();
+		sim.start({global_pos_drone, droneYaw, dronePitch, droneRoll, totalElapsedTime}, stepDrone, nullptr);
 
 		menuTxt.print(1.0f, 1.0f, "[ENTER] Start Simulation\n[H] Help & Controls\n[ESC] Exit\n",1,"CO",false,false,true,TAL_RIGHT,TRH_RIGHT,TRV_BOTTOM,{1.0f,0.0f,0.0f,1.0f},{0.8f,0.8f,0.0f,1.0f});
     }
@@ -305,6 +377,9 @@ protected:
 		};
 		DS_skyBox.init(this, &DSL_skyBox, tex_sky);
 
+		IB_mountain.init(this, M_mountain.maxDraws());
+		IB_drone.init(this, M_drone.maxDraws());
+
 		// INIT TEXT
 		menuTxt.pipelinesAndDescriptorSetsInit();
 	}
@@ -327,6 +402,9 @@ protected:
 		DS_drone.cleanup();
 		DS_skyBox.cleanup();
 
+		IB_mountain.cleanup();
+		IB_drone.cleanup();
+
 		// Cleanup render pass
 		RP.cleanup();
 
@@ -342,6 +420,8 @@ protected:
 	// You also have to destroy the pipelines: since they need to be rebuilt, they have two methods: .cleanup() recreates them, while .destroy() delete them completely
 	void localCleanup()
 	{
+		sim.stop();
+
 		// Cleanup textures
 		tex_mountain_baseColor.cleanup();
 		tex_mountain_normal.cleanup();
@@ -357,6 +437,9 @@ protected:
 		M_mountain.cleanup();
 		M_drone.cleanup();
 		M_skyBox.cleanup();
+		GA_phong.cleanup();
+		GA_pbr.cleanup();
+		GA_skyBox.cleanup();
 
 		// Cleanup descriptor set layouts
 		DSL_global.cleanup();
@@ -418,20 +501,20 @@ protected:
 		// to the command buffer passed in its parameter
 		// record the drawing command in the command buffer
 		M_mountain.bind(commandBuffer);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(M_mountain.indices.size()), 1, 0, 0, 0);
+		IB_mountain.draw(commandBuffer, currentImage);
 
 		P_pbr.bind(commandBuffer);
 		DS_global.bind(commandBuffer, P_pbr, 0, currentImage);
 		DS_drone.bind(commandBuffer,  P_pbr, 1, currentImage);
 		M_drone.bind(commandBuffer);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(M_drone.indices.size()), 1, 0, 0, 0);
+		IB_drone.draw(commandBuffer, currentImage);
 
 		// P_skyBox pipeline
 		P_skyBox.bind(commandBuffer);
 		DS_global.bind(commandBuffer, P_skyBox, 0, currentImage);
 		DS_skyBox.bind(commandBuffer, P_skyBox, 1, currentImage);
 		M_skyBox.bind(commandBuffer);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(M_skyBox.indices.size()), 1, 0, 0, 0);
+		M_skyBox.draw(commandBuffer);
 
 		RP.end(commandBuffer);
 	}
@@ -486,7 +569,7 @@ protected:
 			else if (showCommandsKeyboard)
 			{
 				menuTxt.removeText(1);
-				menuTxt.print(-0.95f, -0.95f, "Move with W-A-S-D | Q-E | R-F\nMove arrows to look around\nChange camera with I-O-P\nPress SPACE to take pictures\nPress C to close this text\nPress ESC to return to the menu", 1, "SS", false, true, true, TAL_LEFT, TRH_LEFT, TRV_TOP, {1.0f,0.98f,0.9f,1.0f}, {0.2f, 0.2f, 0.2f, 1.0f});
+				menuTxt.print(-0.95f, -0.95f, "Move with W-A-S-D | Q-E | R-F\nMove arrows to look around\nChange camera with I-O-P\nPress SPACE to take pictures\nPress V to record the flight\nPress C to close this text\nPress ESC to return to the menu", 1, "SS", false, true, true, TAL_LEFT, TRH_LEFT, TRV_TOP, {1.0f,0.98f,0.9f,1.0f}, {0.2f, 0.2f, 0.2f, 1.0f});
 				menuTxt.updateCommandBuffer();
 			}
 			else
@@ -538,14 +621,38 @@ protected:
 				curDebounce = 0;
 			}
 		}
+		// With [V] we start and stop recording the flight (one frame every two, in a Y4M video)
+		if(glfwGetKey(window, GLFW_KEY_V)) {
+			if(!debounce) {
+				debounce = true;
+				curDebounce = GLFW_KEY_V;
+
+				if(isRecording()) {
+					stopRecording();
+				} else {
+					static int flightIndex = 0;
+					std::string filename = "flight-" + std::to_string(flightIndex++) + ".y4m";
+					startRecording(filename, RF_Y4M, 2);
+				}
+			}
+		} else {
+			if((curDebounce == GLFW_KEY_V) && debounce) {
+				debounce = false;
+				curDebounce = 0;
+			}
+		}
 		//-----------------------------------------------------------------------------------------------------
 		//-----------------------------------------------------------------------------------------------------
-		float deltaT;
-		glm::vec3 m = glm::vec3(0.0f), r = glm::vec3(0.0f);
-		bool fire = false;
-		getSixAxis(deltaT, m, r, fire); // deltaT: time since last frame
-		totalElapsedTime += deltaT;
-		getDroneInput(window, deltaT); // update drone position and orientation
+		// the keys are read here, since GLFW can only be polled on the main thread, and
+		// the drone is drawn between the last two steps of the simulation
+		sim.setInput({getDroneInput(window)});
+		DroneState prevS, currS;
+		float alpha = sim.getStates(prevS, currS);
+		global_pos_drone = glm::mix(prevS.pos, currS.pos, alpha);
+		droneYaw   = glm::mix(prevS.yaw,   currS.yaw,   alpha);
+		dronePitch = glm::mix(prevS.pitch, currS.pitch, alpha);
+		droneRoll  = glm::mix(prevS.roll,  currS.roll,  alpha);
+		totalElapsedTime = glm::mix(prevS.time, currS.time, alpha);
 		setCameraMode(window); // set camera mode based on key presses
 
 		// proj
@@ -612,8 +719,19 @@ protected:
 		UBO_mountain.mvpMat = proj * view * model;
 		UBO_mountain.mMat   = model;
 		UBO_mountain.nMat   = glm::inverse(glm::transpose(UBO_mountain.mMat));
+		UBO_mountain.dequantScale  = glm::vec4(M_mountain.dequantScale, 0.0f);
+		UBO_mountain.dequantOffset = glm::vec4(M_mountain.dequantOffset, 0.0f);
 		DS_mountain.map(currentImage, &UBO_mountain, 0);
 
+		// the camera stays above the terrain, so its clusters facing away are hidden by the
+		// ones in front of them, even if the pipeline does not cull back faces
+		glm::vec3 eyeMountain = glm::vec3(glm::inverse(model) * glm::vec4(CamPos, 1.0f));
+		M_mountain.cullMeshlets(UBO_mountain.mvpMat, eyeMountain, true);
+		drawsMountain.clear();
+		M_mountain.appendDraws(drawsMountain);
+		// without multi draw indirect, the draws are in the command buffer
+		bool redraw = IB_mountain.update(currentImage, drawsMountain);
+
 		// UBO drone
 		// model
 		glm::mat4 modelDrone = glm::translate(glm::mat4(1.0f), global_pos_drone)
@@ -626,8 +744,18 @@ protected:
 		UBO_drone.mvpMat = proj * view * modelDrone;
 		UBO_drone.mMat = modelDrone;
 		UBO_drone.nMat = glm::inverse(glm::transpose(UBO_drone.mMat));
+		UBO_drone.dequantScale  = glm::vec4(M_drone.dequantScale, 0.0f);
+		UBO_drone.dequantOffset = glm::vec4(M_drone.dequantOffset, 0.0f);
 		DS_drone.map(currentImage, &UBO_drone, 0);
 
+		droneLOD = M_drone.selectLOD(view * modelDrone, GUBO.proj, (float)swapChainExtent.height, droneLOD);
+		drawsDrone.clear();
+		M_drone.appendDraws(drawsDrone, droneLOD);
+		redraw |= IB_drone.update(currentImage, drawsDrone);
+		if(redraw) {
+			submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
+		}
+
 		// SkyBox UBO
 		// model
 		glm::mat4 skyboxModel =
@@ -663,28 +791,47 @@ protected:
 	    if (glfwGetKey(w, GLFW_KEY_P)) { seenCenter=false; seenFollow=false; seenDrone=true;  } // 1-st
 	}
 
-	void getDroneInput(GLFWwindow* w, float deltaT) {
+	uint32_t getDroneInput(GLFWwindow* w) {
+		static const struct {int key; uint32_t bit;} map[] = {
+			{GLFW_KEY_LEFT, DK_YAW_LEFT}, {GLFW_KEY_RIGHT, DK_YAW_RIGHT},
+			{GLFW_KEY_UP, DK_PITCH_UP}, {GLFW_KEY_DOWN, DK_PITCH_DOWN},
+			{GLFW_KEY_Q, DK_ROLL_LEFT}, {GLFW_KEY_E, DK_ROLL_RIGHT},
+			{GLFW_KEY_W, DK_FORWARD}, {GLFW_KEY_S, DK_BACK},
+			{GLFW_KEY_D, DK_RIGHT}, {GLFW_KEY_A, DK_LEFT},
+			{GLFW_KEY_R, DK_RISE}, {GLFW_KEY_F, DK_SINK}
+		};
+		uint32_t keys = 0;
+		for(auto &K : map) {
+			if(glfwGetKey(w, K.key)) keys |= K.bit;
+		}
+		return keys;
+	}
+
+	// one step of the simulation, on the SimLoop thread: it must only touch S
+	static void stepDrone(DroneState &S, const DroneInput &I, float deltaT, void *params) {
 	    const float ROT_SPEED  = glm::radians(45.0f);
 	    const float MOVE_SPEED = 4.0f;
 
+		S.time += deltaT;
+
 	    // rotations
-	    if(glfwGetKey(w, GLFW_KEY_LEFT))  droneYaw   += deltaT * ROT_SPEED;
-	    if(glfwGetKey(w, GLFW_KEY_RIGHT)) droneYaw   -= deltaT * ROT_SPEED;
-	    if(glfwGetKey(w, GLFW_KEY_UP))    dronePitch += deltaT * ROT_SPEED;
-	    if(glfwGetKey(w, GLFW_KEY_DOWN))  dronePitch -= deltaT * ROT_SPEED;
-	    if(glfwGetKey(w, GLFW_KEY_Q))     droneRoll  -= deltaT * ROT_SPEED;
-	    if(glfwGetKey(w, GLFW_KEY_E))     droneRoll  += deltaT * ROT_SPEED;
+	    if(I.keys & DK_YAW_LEFT)   S.yaw   += deltaT * ROT_SPEED;
+	    if(I.keys & DK_YAW_RIGHT)  S.yaw   -= deltaT * ROT_SPEED;
+	    if(I.keys & DK_PITCH_UP)   S.pitch += deltaT * ROT_SPEED;
+	    if(I.keys & DK_PITCH_DOWN) S.pitch -= deltaT * ROT_SPEED;
+	    if(I.keys & DK_ROLL_LEFT)  S.roll  -= deltaT * ROT_SPEED;
+	    if(I.keys & DK_ROLL_RIGHT) S.roll  += deltaT * ROT_SPEED;
 
 		// traslations
-	    glm::mat4 R_yaw = glm::rotate(glm::mat4(1.0f), droneYaw, glm::vec3(0,1,0));
+	    glm::mat4 R_yaw = glm::rotate(glm::mat4(1.0f), S.yaw, glm::vec3(0,1,0));
 	    glm::vec3 forward = glm::vec3(R_yaw * glm::vec4(0,0,-1,0));
 	    glm::vec3 right   = glm::vec3(R_yaw * glm::vec4(1,0, 0,0));
-	    if(glfwGetKey(w, GLFW_KEY_W))    global_pos_drone += MOVE_SPEED * forward * deltaT;
-	    if(glfwGetKey(w, GLFW_KEY_S))    global_pos_drone -= MOVE_SPEED * forward * deltaT;
-	    if(glfwGetKey(w, GLFW_KEY_D))    global_pos_drone += MOVE_SPEED * right   * deltaT;
-	    if(glfwGetKey(w, GLFW_KEY_A))    global_pos_drone -= MOVE_SPEED * right   * deltaT;
-	    if(glfwGetKey(w, GLFW_KEY_R))    global_pos_drone += MOVE_SPEED * glm::vec3(0,1,0) * deltaT;
-	    if(glfwGetKey(w, GLFW_KEY_F))    global_pos_drone -= MOVE_SPEED * glm::vec3(0,1,0) * deltaT;
+	    if(I.keys & DK_FORWARD) S.pos += MOVE_SPEED * forward * deltaT;
+	    if(I.keys & DK_BACK)    S.pos -= MOVE_SPEED * forward * deltaT;
+	    if(I.keys & DK_RIGHT)   S.pos += MOVE_SPEED * right   * deltaT;
+	    if(I.keys & DK_LEFT)    S.pos -= MOVE_SPEED * right   * deltaT;
+	    if(I.keys & DK_RISE)    S.pos += MOVE_SPEED * glm::vec3(0,1,0) * deltaT;
+	    if(I.keys & DK_SINK)    S.pos -= MOVE_SPEED * glm::vec3(0,1,0) * deltaT;
 	}
 
 	const glm::vec3 dawnColor    = glm::vec3(0.8f, 0.4f, 0.2f);
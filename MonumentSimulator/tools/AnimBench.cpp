@@ -0,0 +1,234 @@
+// Benchmarks of the animation sampling (modules/Animations.hpp).
+//
+// Usage: AnimBench [tracks] [frames] [joints]
+//
+// Keyframe cursors: tracks (default 4000) of random keyframes at 30 per second are
+// looped at 60 fps for frames (default 600) frames, with 30, 240 and 2000 keyframes
+// each, sampled with the binary search only and with a cursor per track. The time
+// per sample is printed, and the results of the two are compared on a mix of
+// forward steps and random seeks.
+//
+// Skeleton poses: a skeleton of joints (default 64) joints plays two clips of 240
+// keyframes, with a crossfade of 0.3 s every 500 frames, for 33 times frames frames.
+// It is sampled one joint at a time by AnimBlender, and as a whole from the packed
+// clips, mixed with AnimPoseMix(); the joints per second of both are printed, with
+// the largest difference of their matrices (slerp against nlerp) outside of the
+// crossfades and during them.
+//
+// The animations run here without Vulkan, so the two pieces of Starter.hpp the
+// module refers to, AssetFile and Model::getGLTFnodeTransforms(), are replaced by
+// minimal versions; the loaders are not used.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+
+// the same GLM configuration as Starter.hpp
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform2.hpp>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE_WRITE
+#include <tiny_gltf.h>
+#include <plusaes.hpp>
+#define SINFL_IMPLEMENTATION
+#include <sinfl.h>
+#define MGCGREADER_IMPLEMENTATION
+#include "modules/MGCGReader.hpp"
+#define VFS_IMPLEMENTATION
+#include "modules/VFS.hpp"
+#define GLTFLOADER_IMPLEMENTATION
+#include "modules/GLTFLoader.hpp"
+#define JOBSYSTEM_IMPLEMENTATION
+#include "modules/JobSystem.hpp"
+
+enum ModelType {OBJ, GLTF, MGCG};
+
+class AssetFile {
+  public:
+	GLTFModel model;
+	ModelType getType() {return GLTF;}
+	GLTFModel *getGLTFmodel() {return &model;}
+};
+
+class Model {
+  public:
+	static void getGLTFnodeTransforms(const tinygltf::Node *N, glm::vec3 &T, glm::vec3 &S, glm::quat &Q) {
+		T = N->translation.size() ? glm::vec3(N->translation[0], N->translation[1], N->translation[2]) : glm::vec3(0);
+		Q = N->rotation.size() ? glm::quat(N->rotation[3], N->rotation[0], N->rotation[1], N->rotation[2]) :
+								 glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		S = N->scale.size() ? glm::vec3(N->scale[0], N->scale[1], N->scale[2]) : glm::vec3(1);
+	}
+};
+
+#define ANIMATIONS_IMPLEMENTATION
+#include "modules/Animations.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+// the results of the timed loops go here, so that they are not optimized away
+static volatile float benchSink;
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static glm::quat randomRotation(std::mt19937 &rng) {
+	std::uniform_real_distribution<float> U(-1.0f, 1.0f);
+	return glm::normalize(glm::quat(U(rng), U(rng), U(rng), U(rng)));
+}
+
+// a track of keys keyframes at 30 per second, with random translations and rotations
+static void randomTrack(AnimTrack &A, int keys, std::mt19937 &rng) {
+	std::uniform_real_distribution<float> U(-1.0f, 1.0f);
+	A.nKeyFrames = keys;
+	A.Frames.clear();
+	for(int k = 0; k < keys; k++) {
+		A.Frames.push_back({k / 30.0f, glm::vec3(U(rng), U(rng), U(rng)), randomRotation(rng), glm::vec3(1.0f)});
+	}
+}
+
+static void benchCursors(int nTracks, int frames, std::mt19937 &rng) {
+	std::cout << "Keyframe cursors: " << nTracks << " tracks looped at 60 fps, " << frames << " frames\n";
+	for(int keys : {30, 240, 2000}) {
+		std::vector<AnimTrack> tracks(nTracks);
+		for(auto &A : tracks) {
+			randomTrack(A, keys, rng);
+		}
+
+		double ns[2];
+		for(int cached = 0; cached < 2; cached++) {
+			std::vector<int> cursors(nTracks, -1);
+			float t = 0.0f;
+			Clock::time_point start = Clock::now();
+			for(int f = 0; f < frames; f++, t += 1.0f / 60.0f) {
+				for(int i = 0; i < nTracks; i++) {
+					benchSink = tracks[i].Sample(t, 0, -1, true, cached ? &cursors[i] : nullptr)[3][0];
+				}
+			}
+			ns[cached] = elapsedMs(start) * 1e6 / ((double)frames * nTracks);
+		}
+
+		// a cursor gives the result of the search, whatever it points to
+		std::vector<int> cursors(nTracks, -1);
+		std::uniform_real_distribution<float> seek(0.0f, keys / 15.0f);
+		float maxDiff = 0.0f;
+		for(int i = 0; i < 200000; i++) {
+			int tr = i % nTracks;
+			float t = (i % 7 == 0) ? seek(rng) : (i / nTracks) / 45.0f;
+			glm::mat4 a = tracks[tr].Sample(t, 0, -1, true);
+			glm::mat4 b = tracks[tr].Sample(t, 0, -1, true, &cursors[tr]);
+			for(int c = 0; c < 4; c++) {
+				maxDiff = std::max(maxDiff, glm::length(a[c] - b[c]));
+			}
+		}
+
+		std::cout << std::fixed << std::setprecision(1) << "  " << std::setw(4) << keys << " keys: search "
+				  << std::setw(6) << ns[0] << " ns/sample, cursor " << std::setw(6) << ns[1]
+				  << " ns/sample, max difference " << std::scientific << std::setprecision(1) << maxDiff << "\n";
+	}
+}
+
+static void benchPoses(int nJoints, int frames, std::mt19937 &rng) {
+	const int keys = 240, nClips = 2;
+	std::uniform_real_distribution<float> U(-1.0f, 1.0f);
+
+	// tracks of each joint in the two clips, with smooth rotations and random signs
+	std::vector<std::vector<AnimTrack *>> jointTracks(nJoints);
+	std::vector<AnimClip> clips(nClips);
+	for(int c = 0; c < nClips; c++) {
+		std::vector<AnimTrack *> tracks;
+		for(int j = 0; j < nJoints; j++) {
+			AnimTrack *A = new AnimTrack();
+			A->nKeyFrames = keys;
+			glm::quat q = randomRotation(rng);
+			for(int k = 0; k < keys; k++) {
+				q = glm::normalize(q * glm::quat(glm::vec3(U(rng), U(rng), U(rng)) * 0.1f));
+				A->Frames.push_back({k / 30.0f, glm::vec3(U(rng), U(rng), U(rng)), (U(rng) < 0.0f) ? -q : q,
+									 glm::vec3(1.0f + 0.1f * U(rng))});
+			}
+			jointTracks[j].push_back(A);
+			tracks.push_back(A);
+		}
+		clips[c].init(tracks);
+	}
+
+	AnimBlender AB;
+	AB.init({{0, -1, 0.0f, 0}, {0, -1, 0.0f, 1}});
+	std::vector<glm::mat4> perJoint(nJoints), packed(nJoints);
+	AnimPose pA, pB;
+	double msJoint = 0.0, msPacked = 0.0;
+	float maxDiff[2] = {0.0f, 0.0f};	// outside of crossfades, during them
+	for(int f = 0; f < frames; f++) {
+		if(f % 500 == 0) {
+			AB.Start(AB.cur ^ 1, 0.3f);
+		}
+		Clock::time_point start = Clock::now();
+		for(int j = 0; j < nJoints; j++) {
+			perJoint[j] = AB.Sample(&jointTracks[j], j);
+		}
+		msJoint += elapsedMs(start);
+
+		start = Clock::now();
+		AnimBlendSegment &C = AB.segments[AB.cur];
+		clips[C.clip].Sample(pA, C.t, C.st, C.en, AB.getCursor(nJoints, AB.cur));
+		if(AB.blending) {
+			AnimBlendSegment &P = AB.segments[AB.prev];
+			clips[P.clip].Sample(pB, P.t, P.st, P.en, AB.getCursor(nJoints, AB.prev));
+			AnimPoseMix(pA.data.data(), pB.data.data(), 1.0f - AB.blendPos / AB.blendTime, pA.data.data(), pA.stride);
+		}
+		for(int j = 0; j < nJoints; j++) {
+			packed[j] = pA.getMatrix(j);
+		}
+		msPacked += elapsedMs(start);
+
+		for(int j = 0; j < nJoints; j++) {
+			for(int c = 0; c < 4; c++) {
+				float d = glm::length(perJoint[j][c] - packed[j][c]);
+				maxDiff[AB.blending] = std::max(maxDiff[AB.blending], d);
+			}
+		}
+		AB.Advance(1.0f / 60.0f);
+	}
+	for(auto &T : jointTracks) {
+		for(AnimTrack *A : T) {
+			delete A;
+		}
+	}
+
+	double joints = (double)nJoints * frames;
+	std::cout << "Skeleton poses: " << nJoints << " joints, " << keys << " keys, " << frames << " frames";
+#ifdef ANIM_SSE2_POSE
+	std::cout << ", SSE2";
+#endif
+	std::cout << "\n" << std::fixed << std::setprecision(1)
+			  << "  per joint (AnimBlender)  " << std::setw(6) << joints / msJoint * 1e-3 << " M joints/s\n"
+			  << "  packed clips             " << std::setw(6) << joints / msPacked * 1e-3 << " M joints/s\n"
+			  << "  max matrix difference    " << std::scientific << std::setprecision(1) << maxDiff[0]
+			  << ", in crossfades " << maxDiff[1] << "\n";
+}
+
+int main(int argc, char *argv[]) {
+	int nTracks = argc > 1 ? std::max(1, atoi(argv[1])) : 4000;
+	int frames = argc > 2 ? std::max(1, atoi(argv[2])) : 600;
+	int nJoints = argc > 3 ? std::max(1, atoi(argv[3])) : 64;
+	std::mt19937 rng(1);
+
+	benchCursors(nTracks, frames, rng);
+	benchPoses(nJoints, 33 * frames, rng);
+	return 0;
+}
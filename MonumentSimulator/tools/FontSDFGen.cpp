@@ -0,0 +1,142 @@
+// Offline generator of the signed distance field version of the font atlas.
+//
+// Usage: FontSDFGen [input.png] [output.png] [downsample] [spread]
+//
+// The fill coverage of the bitmap atlas (red channel of Fonts.png) is
+// thresholded, and the exact euclidean distance to the glyph contour is
+// computed for every texel (Felzenszwalb & Huttenlocher separable transform).
+// The distance is then averaged over blocks of downsample x downsample texels
+// and stored in a single channel PNG, where 128 is the contour, values above
+// are inside the glyph and spread is the distance (in output texels) that
+// maps to 0 and 255.
+// Since the glyph table of TextMaker uses normalized UVs, the output atlas
+// can have any size without changing the font definition.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+
+static const float INF = 1e20f;
+
+// 1D squared distance transform of f[0..n-1] into d[0..n-1]
+// v, z are work buffers of size n and n+1
+static void edt1D(const float *f, float *d, int *v, float *z, int n) {
+	int k = 0;
+	v[0] = 0;
+	z[0] = -INF;
+	z[1] = INF;
+	for(int q = 1; q < n; q++) {
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		while(s <= z[k]) {
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = INF;
+	}
+	k = 0;
+	for(int q = 0; q < n; q++) {
+		while(z[k+1] < q) {
+			k++;
+		}
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+// 2D squared distance transform, in place: grid contains 0 on the seed texels
+// and INF everywhere else
+static void edt2D(std::vector<float> &grid, int w, int h) {
+	int n = std::max(w, h);
+	std::vector<float> f(n), d(n), z(n + 1);
+	std::vector<int> v(n);
+
+	for(int x = 0; x < w; x++) {
+		for(int y = 0; y < h; y++) {
+			f[y] = grid[y * w + x];
+		}
+		edt1D(f.data(), d.data(), v.data(), z.data(), h);
+		for(int y = 0; y < h; y++) {
+			grid[y * w + x] = d[y];
+		}
+	}
+	for(int y = 0; y < h; y++) {
+		edt1D(&grid[y * w], d.data(), v.data(), z.data(), w);
+		for(int x = 0; x < w; x++) {
+			grid[y * w + x] = d[x];
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	std::string inFile  = argc > 1 ? argv[1] : "assets/textures/Fonts.png";
+	std::string outFile = argc > 2 ? argv[2] : "assets/textures/FontsSDF.png";
+	int downsample = argc > 3 ? atoi(argv[3]) : 2;
+	float spread   = argc > 4 ? (float)atof(argv[4]) : 8.0f;
+
+	if((downsample < 1) || (spread <= 0.0f)) {
+		std::cout << "Usage: " << argv[0] << " [input.png] [output.png] [downsample] [spread]\n";
+		return 1;
+	}
+
+	int w, h, ch;
+	stbi_uc *pixels = stbi_load(inFile.c_str(), &w, &h, &ch, STBI_rgb_alpha);
+	if(!pixels) {
+		std::cout << "Not found: " << inFile << "\n";
+		return 1;
+	}
+	std::cout << inFile << " -> size: " << w << "x" << h << ", ch: " << ch << "\n";
+
+	// distance of outside texels from the glyphs, and of inside texels from the background
+	std::vector<float> dOut(w * h), dIn(w * h);
+	for(int i = 0; i < w * h; i++) {
+		bool inside = pixels[i * 4] >= 128;
+		dOut[i] = inside ? 0.0f : INF;
+		dIn[i]  = inside ? INF : 0.0f;
+	}
+	stbi_image_free(pixels);
+
+	edt2D(dOut, w, h);
+	edt2D(dIn, w, h);
+
+	// signed distance, positive inside, with the contour placed half a texel
+	// between the last inside and the first outside texel centers
+	std::vector<float> sd(w * h);
+	for(int i = 0; i < w * h; i++) {
+		sd[i] = dOut[i] > 0.0f ? 0.5f - std::sqrt(dOut[i]) : std::sqrt(dIn[i]) - 0.5f;
+	}
+
+	int ow = w / downsample, oh = h / downsample;
+	std::vector<unsigned char> out(ow * oh);
+	float norm = 1.0f / (float)(downsample * downsample * downsample);
+	for(int y = 0; y < oh; y++) {
+		for(int x = 0; x < ow; x++) {
+			float acc = 0.0f;
+			for(int j = 0; j < downsample; j++) {
+				for(int i = 0; i < downsample; i++) {
+					acc += sd[(y * downsample + j) * w + x * downsample + i];
+				}
+			}
+			// average, and conversion from input to output texels
+			float d = acc * norm;
+			float v = 0.5f + 0.5f * d / spread;
+			v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+			out[y * ow + x] = (unsigned char)std::lround(v * 255.0f);
+		}
+	}
+
+	if(!stbi_write_png(outFile.c_str(), ow, oh, 1, out.data(), ow)) {
+		std::cout << "Cannot write: " << outFile << "\n";
+		return 1;
+	}
+	std::cout << outFile << " <- size: " << ow << "x" << oh << ", spread: " << spread << "\n";
+	return 0;
+}
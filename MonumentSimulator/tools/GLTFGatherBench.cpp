@@ -0,0 +1,233 @@
+// Benchmark of the glTF attribute gather (modules/GLTFLoader.hpp), as used by
+// Model::makeGLTFMesh().
+//
+// Usage: GLTFGatherBench [vertices] [repetitions]
+//
+// A mesh with the given number of vertices (default one million) and three indices
+// per vertex is built in memory twice: with tightly packed float accessors, and with
+// a single interleaved view of normalized shorts and bytes (KHR_mesh_quantization).
+// Both are gathered into the PBR vertex layout (position, normal, UV, tangent: 48
+// bytes) in blocks of 2048 vertices, like makeGLTFMesh() does. The float mesh is also
+// converted the way the loader did before, with a vector per vertex appended to the
+// output, and the two outputs are compared. The best time of the repetitions is
+// printed; it includes the first touch of the vertex array.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE_WRITE
+#include <tiny_gltf.h>
+#include <plusaes.hpp>
+#define SINFL_IMPLEMENTATION
+#include <sinfl.h>
+#define MGCGREADER_IMPLEMENTATION
+#include "modules/MGCGReader.hpp"
+#define VFS_IMPLEMENTATION
+#include "modules/VFS.hpp"
+#define GLTFLOADER_IMPLEMENTATION
+#include "modules/GLTFLoader.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// the attributes of the PBR layout: glTF name, components, offset in the vertex
+struct BenchAttribute {
+	const char *name;
+	int comps;
+	int offset;
+};
+static const BenchAttribute PBRattributes[] = {
+	{"POSITION",   3, 0},
+	{"NORMAL",     3, 12},
+	{"TEXCOORD_0", 2, 24},
+	{"TANGENT",    4, 32},
+};
+static const int PBRstride = 48;
+
+// appends a buffer view and an accessor on it to the model, returns the accessor
+static int addAccessor(GLTFModel &M, size_t offset, size_t length, int stride,
+					   int componentType, int type, size_t count, bool normalized) {
+	tinygltf::BufferView V;
+	V.buffer = 0;
+	V.byteOffset = offset;
+	V.byteLength = length;
+	V.byteStride = stride;
+	M.bufferViews.push_back(V);
+	tinygltf::Accessor A;
+	A.bufferView = M.bufferViews.size() - 1;
+	A.componentType = componentType;
+	A.type = type;
+	A.count = count;
+	A.normalized = normalized;
+	M.accessors.push_back(A);
+	return M.accessors.size() - 1;
+}
+
+static void setBuffer(GLTFModel &M, const std::vector<unsigned char> &data) {
+	M.buffers.resize(1);
+	M.bufferData = {data.data()};
+	M.bufferSize = {data.size()};
+}
+
+static int typeOf(int comps) {
+	return comps == 2 ? TINYGLTF_TYPE_VEC2 : (comps == 3 ? TINYGLTF_TYPE_VEC3 : TINYGLTF_TYPE_VEC4);
+}
+
+// float attributes, each in its own view, and 32 bit indices
+static void makeFloatMesh(GLTFModel &M, std::vector<unsigned char> &data, size_t nv, std::mt19937 &rng) {
+	std::uniform_real_distribution<float> U(-1.0f, 1.0f);
+	tinygltf::Primitive P;
+	for(auto &A : PBRattributes) {
+		size_t offset = data.size(), length = nv * A.comps * sizeof(float);
+		data.resize(offset + length);
+		float *f = (float *)(data.data() + offset);
+		for(size_t i = 0; i < nv * A.comps; i++) {
+			f[i] = U(rng);
+		}
+		P.attributes[A.name] = addAccessor(M, offset, length, 0, TINYGLTF_COMPONENT_TYPE_FLOAT,
+											typeOf(A.comps), nv, false);
+	}
+	size_t offset = data.size();
+	data.resize(offset + nv * 3 * sizeof(uint32_t));
+	uint32_t *idx = (uint32_t *)(data.data() + offset);
+	for(size_t i = 0; i < nv * 3; i++) {
+		idx[i] = (uint32_t)((i * 7) % nv);
+	}
+	P.indices = addAccessor(M, offset, nv * 3 * sizeof(uint32_t), 0, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+							TINYGLTF_TYPE_SCALAR, nv * 3, false);
+	M.meshes.resize(1);
+	M.meshes[0].primitives.push_back(P);
+	setBuffer(M, data);
+}
+
+// one interleaved view: short positions, byte normals, unsigned short UVs and byte
+// tangents (24 bytes per vertex), all normalized, and 16 bit indices
+static void makeQuantizedMesh(GLTFModel &M, std::vector<unsigned char> &data, size_t nv, std::mt19937 &rng) {
+	const int stride = 24;
+	data.resize(nv * stride);
+	for(auto &b : data) {
+		b = (unsigned char)rng();
+	}
+	tinygltf::Primitive P;
+	P.attributes["POSITION"] = addAccessor(M, 0, nv * stride, stride, TINYGLTF_COMPONENT_TYPE_SHORT,
+										   TINYGLTF_TYPE_VEC3, nv, true);
+	P.attributes["NORMAL"] = addAccessor(M, 8, nv * stride - 8, stride, TINYGLTF_COMPONENT_TYPE_BYTE,
+										 TINYGLTF_TYPE_VEC3, nv, true);
+	P.attributes["TEXCOORD_0"] = addAccessor(M, 12, nv * stride - 12, stride, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+											 TINYGLTF_TYPE_VEC2, nv, true);
+	P.attributes["TANGENT"] = addAccessor(M, 16, nv * stride - 16, stride, TINYGLTF_COMPONENT_TYPE_BYTE,
+										  TINYGLTF_TYPE_VEC4, nv, true);
+	size_t offset = data.size();
+	data.resize(offset + nv * 3 * sizeof(uint16_t));
+	uint16_t *idx = (uint16_t *)(data.data() + offset);
+	for(size_t i = 0; i < nv * 3; i++) {
+		idx[i] = (uint16_t)((i * 7) % std::min(nv, (size_t)65536));
+	}
+	P.indices = addAccessor(M, offset, nv * 3 * sizeof(uint16_t), 0, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+							TINYGLTF_TYPE_SCALAR, nv * 3, false);
+	M.meshes.resize(1);
+	M.meshes[0].primitives.push_back(P);
+	setBuffer(M, data);
+}
+
+// the conversion of makeGLTFMesh(), with the layout above
+static void gatherBlocked(const GLTFModel &M, const tinygltf::Primitive &P,
+						  std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices) {
+	const size_t blockSize = 2048;
+	size_t count = M.accessors[P.attributes.at("POSITION")].count;
+	vertices.clear();
+	vertices.resize(count * PBRstride, 0);
+	for(size_t b = 0; b < count; b += blockSize) {
+		unsigned char *block = vertices.data() + b * PBRstride;
+		for(auto &A : PBRattributes) {
+			GLTFgatherFloat(&M, M.accessors[P.attributes.at(A.name)], b, blockSize, block + A.offset,
+							PBRstride, A.comps);
+		}
+	}
+	indices.clear();
+	GLTFgatherIndices(&M, M.accessors[P.indices], 0, indices);
+}
+
+// the conversion before the gather functions: tightly packed floats only, and a
+// vector for each vertex
+static void gatherPerVertex(const GLTFModel &M, const tinygltf::Primitive &P,
+							std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices) {
+	const float *src[4];
+	for(int a = 0; a < 4; a++) {
+		src[a] = (const float *)M.accessorData(M.accessors[P.attributes.at(PBRattributes[a].name)]);
+	}
+	size_t count = M.accessors[P.attributes.at("POSITION")].count;
+	vertices.clear();
+	for(size_t i = 0; i < count; i++) {
+		std::vector<unsigned char> vertex(PBRstride, 0);
+		for(int a = 0; a < 4; a++) {
+			memcpy(&vertex[PBRattributes[a].offset], src[a] + i * PBRattributes[a].comps,
+				   PBRattributes[a].comps * sizeof(float));
+		}
+		vertices.insert(vertices.end(), vertex.begin(), vertex.end());
+	}
+	const tinygltf::Accessor &IA = M.accessors[P.indices];
+	const uint32_t *idx = (const uint32_t *)M.accessorData(IA);
+	indices.clear();
+	for(size_t i = 0; i < IA.count; i++) {
+		indices.push_back(idx[i]);
+	}
+}
+
+typedef void (* pGather)(const GLTFModel &M, const tinygltf::Primitive &P,
+						 std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices);
+
+static double bestOf(int reps, pGather gather, const GLTFModel &M,
+					 std::vector<unsigned char> &vertices, std::vector<uint32_t> &indices) {
+	double best = 1e30;
+	for(int r = 0; r < reps; r++) {
+		// a new vector each time, so that the page faults of the output are counted
+		std::vector<unsigned char>().swap(vertices);
+		Clock::time_point start = Clock::now();
+		gather(M, M.meshes[0].primitives[0], vertices, indices);
+		best = std::min(best, elapsedMs(start));
+	}
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	size_t nv = argc > 1 ? (size_t)std::max(1, atoi(argv[1])) : 1000000;
+	int reps = argc > 2 ? std::max(1, atoi(argv[2])) : 5;
+	std::mt19937 rng(1234);
+
+	GLTFModel floatMesh, quantMesh;
+	std::vector<unsigned char> floatData, quantData;
+	makeFloatMesh(floatMesh, floatData, nv, rng);
+	makeQuantizedMesh(quantMesh, quantData, nv, rng);
+
+	std::vector<unsigned char> vOld, vNew, vQuant;
+	std::vector<uint32_t> iOld, iNew, iQuant;
+	double tOld = bestOf(reps, gatherPerVertex, floatMesh, vOld, iOld);
+	double tNew = bestOf(reps, gatherBlocked, floatMesh, vNew, iNew);
+	double tQuant = bestOf(reps, gatherBlocked, quantMesh, vQuant, iQuant);
+	bool same = (vOld == vNew) && (iOld == iNew);
+
+	std::cout << nv << " vertices, " << nv * 3 << " indices, " << PBRstride << " bytes per vertex, best of "
+			  << reps << "\n" << std::fixed << std::setprecision(1);
+	std::cout << "  per vertex, float input      " << std::setw(8) << tOld << " ms\n";
+	std::cout << "  gather, float input          " << std::setw(8) << tNew << " ms  "
+			  << (same ? "same output" : "DIFFERENT OUTPUT") << "\n";
+	std::cout << "  gather, quantized interleaved" << std::setw(8) << tQuant << " ms\n";
+#ifdef GLTF_SSE2_GATHER
+	std::cout << "  (SSE2 conversion of the quantized components)\n";
+#endif
+	return same ? 0 : 1;
+}
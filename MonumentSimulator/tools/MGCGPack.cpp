@@ -0,0 +1,254 @@
+// Offline packer of MGCG files and bundles.
+//
+// Usage: MGCGPack [-k key] [-i iv] [-l level] [-n] [-s] output input...
+//
+// With an output ending in .mgcg and a single input, writes an MGCG file, that
+// can be loaded as a model or asset file of type MGCG. Otherwise writes a bundle
+// with all the inputs (see modules/MGCGReader.hpp for the layout), to be mounted
+// with MGCGloader.mount(): files are then looked up with the same path given here.
+//
+// -k key    : AES key, of 16, 24 or 32 characters (default: MGCG_DEFAULT_KEY)
+// -i iv     : initialization vector, as 32 hexadecimal digits (default: MGCG_DEFAULT_IV,
+//             000102...0F). Files and bundles packed with another key or IV can only
+//             be read after setting MGCGloader.key and MGCGloader.iv to the same
+//             values, before the first load() or mount()
+// -l level  : deflate level, from 0 to 8 (default 8)
+// -n        : bundle entries are compressed, but not encrypted
+// -s        : bundle entries are stored as they are, and once the bundle is mounted
+//             the VFS returns them as views into the mapped file, without copies
+//
+// Entries that do not get smaller (e.g. JPEG and PNG images) are stored uncompressed.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+
+#include <plusaes.hpp>
+#define SINFL_IMPLEMENTATION
+#include <sinfl.h>
+#define MGCGREADER_IMPLEMENTATION
+#include "modules/MGCGReader.hpp"
+
+// the PNG writer compressor closes deflate blocks before sdefl overflows its
+// sequence buffer, which sdeflate() does not do
+#define SDEFL_IMPLEMENTATION
+#define PNGWRITER_IMPLEMENTATION
+#include "modules/PNGWriter.hpp"
+
+struct Entry {
+	std::string name;
+	std::vector<unsigned char> blob;
+	uint32_t size;
+	uint32_t flags;
+	uint64_t offset;
+};
+
+static bool readInput(const std::string &file, std::vector<unsigned char> &data) {
+	std::ifstream in(file, std::ios::binary | std::ios::ate);
+	if(!in.is_open()) {
+		return false;
+	}
+	data.resize((size_t)in.tellg());
+	in.seekg(0);
+	in.read((char *)data.data(), data.size());
+	return in.good() || in.eof();
+}
+
+// MGCG layout: uncompressed size as a decimal string in 16 bytes, then the deflate stream
+static std::vector<unsigned char> compress(const std::vector<unsigned char> &data, int level) {
+	std::vector<unsigned char> out(16 + sdefl_bound((int)data.size()) + 5, 0);
+	snprintf((char *)out.data(), 16, "%d", (int)data.size());
+	struct sdefl *sd = (struct sdefl *)calloc(1, sizeof(struct sdefl));
+	int n = PNGdeflateStrip(sd, &out[16], data.data(), (int)data.size(), level, true);
+	free(sd);
+	out.resize(16 + n);
+	return out;
+}
+
+static std::vector<unsigned char> encrypt(const std::vector<unsigned char> &data,
+										  const std::vector<unsigned char> &key, const unsigned char iv[16]) {
+	std::vector<unsigned char> out(plusaes::get_padded_encrypted_size(data.size()));
+	unsigned char blockIV[16];
+	memcpy(blockIV, iv, 16);
+	plusaes::encrypt_cbc(data.data(), data.size(), key.data(), key.size(),
+						 &blockIV, out.data(), out.size(), true);
+	return out;
+}
+
+static void put32(std::vector<unsigned char> &out, uint32_t v) {
+	for(int i = 0; i < 4; i++) {
+		out.push_back((unsigned char)(v >> (8 * i)));
+	}
+}
+
+static bool parseIV(const char *s, unsigned char iv[16]) {
+	if(strlen(s) != 32) {
+		return false;
+	}
+	for(int i = 0; i < 16; i++) {
+		char hex[3] = {s[2 * i], s[2 * i + 1], '\0'};
+		char *end;
+		iv[i] = (unsigned char)strtol(hex, &end, 16);
+		if(*end != '\0') {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int usage(const char *prog) {
+	std::cout << "Usage: " << prog << " [-k key] [-i iv] [-l level] [-n] [-s] output input...\n"
+			  << "Files packed with -k or -i need MGCGloader.key and MGCGloader.iv to be set\n"
+			  << "to the same values before they are loaded or mounted\n";
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	std::string keyString = MGCG_DEFAULT_KEY;
+	unsigned char iv[16];
+	memcpy(iv, MGCG_DEFAULT_IV, 16);
+	int level = SDEFL_LVL_MAX;
+	bool encrypted = true;
+	bool compressed = true;
+
+	int a = 1;
+	for(; (a < argc) && (argv[a][0] == '-'); a++) {
+		std::string opt = argv[a];
+		if((opt == "-k") && (a + 1 < argc)) {
+			keyString = argv[++a];
+		} else if((opt == "-i") && (a + 1 < argc)) {
+			if(!parseIV(argv[++a], iv)) {
+				std::cout << "The IV must be 32 hexadecimal digits\n";
+				return 1;
+			}
+		} else if((opt == "-l") && (a + 1 < argc)) {
+			level = std::max(SDEFL_LVL_MIN, std::min(atoi(argv[++a]), SDEFL_LVL_MAX));
+		} else if(opt == "-n") {
+			encrypted = false;
+		} else if(opt == "-s") {
+			encrypted = false;
+			compressed = false;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if(argc - a < 2) {
+		return usage(argv[0]);
+	}
+	if((keyString.size() != 16) && (keyString.size() != 24) && (keyString.size() != 32)) {
+		std::cout << "The key must be 16, 24 or 32 characters long\n";
+		return 1;
+	}
+	std::vector<unsigned char> key(keyString.begin(), keyString.end());
+	std::string outFile = argv[a++];
+
+	// single MGCG file
+	if((outFile.size() > 5) && (outFile.compare(outFile.size() - 5, 5, ".mgcg") == 0)) {
+		if(argc - a != 1) {
+			std::cout << "An MGCG file contains a single input\n";
+			return 1;
+		}
+		std::vector<unsigned char> data;
+		if(!readInput(argv[a], data)) {
+			std::cout << "Not found: " << argv[a] << "\n";
+			return 1;
+		}
+		std::vector<unsigned char> enc = encrypt(compress(data, level), key, iv);
+		std::ofstream out(outFile, std::ios::binary);
+		out.write((const char *)enc.data(), enc.size());
+		if(!out.good()) {
+			std::cout << "Cannot write: " << outFile << "\n";
+			return 1;
+		}
+		std::cout << argv[a] << " (" << data.size() << ") -> " << outFile << " (" << enc.size() << ")\n";
+		return 0;
+	}
+
+	// bundle
+	std::vector<Entry> entries;
+	for(; a < argc; a++) {
+		Entry E;
+		std::vector<unsigned char> data;
+		if(!readInput(argv[a], data)) {
+			std::cout << "Not found: " << argv[a] << "\n";
+			return 1;
+		}
+		E.name = MGCGReader::normalize(argv[a]);
+		E.size = (uint32_t)data.size();
+		E.flags = 0;
+		std::vector<unsigned char> packed;
+		if(compressed) {
+			packed = compress(data, level);
+		}
+		if(compressed && (packed.size() < data.size())) {
+			E.blob.swap(packed);
+			E.flags |= MGCGF_COMPRESSED;
+		} else {
+			E.blob.swap(data);
+		}
+		if(encrypted) {
+			unsigned char entryIV[16];
+			memcpy(entryIV, iv, 16);
+			uint32_t index = (uint32_t)entries.size();
+			for(int i = 0; i < 4; i++) {
+				entryIV[12 + i] ^= (unsigned char)(index >> (8 * i));
+			}
+			E.blob = encrypt(E.blob, key, entryIV);
+			E.flags |= MGCGF_ENCRYPTED;
+		}
+		std::cout << E.name << " (" << E.size << ") -> " << E.blob.size()
+				  << ((E.flags & MGCGF_COMPRESSED) ? "" : " [stored]") << "\n";
+		entries.push_back(std::move(E));
+	}
+
+	std::vector<unsigned char> toc;
+	for(auto &E : entries) {
+		put32(toc, 0);
+		put32(toc, 0);
+		put32(toc, (uint32_t)E.blob.size());
+		put32(toc, E.size);
+		put32(toc, E.flags);
+		put32(toc, (uint32_t)E.name.size());
+		toc.insert(toc.end(), E.name.begin(), E.name.end());
+	}
+	// blobs start aligned to 16 bytes, and the offsets are patched in the table
+	uint64_t offset = (16 + toc.size() + 15) & ~(uint64_t)15;
+	size_t pos = 0;
+	for(auto &E : entries) {
+		E.offset = offset;
+		for(int i = 0; i < 8; i++) {
+			toc[pos + i] = (unsigned char)(offset >> (8 * i));
+		}
+		pos += 24 + E.name.size();
+		offset = (offset + E.blob.size() + 15) & ~(uint64_t)15;
+	}
+
+	std::vector<unsigned char> header;
+	header.insert(header.end(), {'M', 'G', 'C', 'B'});
+	put32(header, MGCG_BUNDLE_VERSION);
+	put32(header, (uint32_t)entries.size());
+	put32(header, (uint32_t)toc.size());
+
+	std::ofstream out(outFile, std::ios::binary);
+	out.write((const char *)header.data(), header.size());
+	out.write((const char *)toc.data(), toc.size());
+	uint64_t written = header.size() + toc.size();
+	static const char zeros[16] = {0};
+	for(auto &E : entries) {
+		out.write(zeros, E.offset - written);
+		out.write((const char *)E.blob.data(), E.blob.size());
+		written = E.offset + E.blob.size();
+	}
+	if(!out.good()) {
+		std::cout << "Cannot write: " << outFile << "\n";
+		return 1;
+	}
+	std::cout << outFile << " <- " << entries.size() << " files, " << written << " bytes\n";
+	return 0;
+}
@@ -0,0 +1,117 @@
+// Benchmark of the PNG writer (modules/PNGWriter.hpp) against stbi_write_png.
+//
+// Usage: PNGBench [input image] [repetitions] [threads]
+//
+// The input (by default the sky texture) is rescaled to 1280x720 and 3840x2160, and
+// a darkened rectangle is drawn over it, like the flat areas of a user interface.
+// Each frame is then encoded with stbi_write_png and with the levels and filters used
+// by screenshots and recordings; the best time of the repetitions is printed with the
+// size of the output. Every PNG is decoded back with stb_image, and compared with the
+// frame. The last row uses the given number of threads (0 for all the cores).
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+#define SDEFL_IMPLEMENTATION
+#define PNGWRITER_IMPLEMENTATION
+#include "modules/PNGWriter.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct EncoderConfig {
+	const char *name;
+	int level;
+	PNGFilter filter;
+	int threads;
+};
+
+static void printRow(const char *name, double ms, size_t bytes, bool ok) {
+	std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1)
+			  << std::setw(8) << ms << " ms " << std::setw(10) << bytes / 1024 << " KB  "
+			  << (ok ? "ok" : "MISMATCH") << "\n";
+}
+
+static bool decodesTo(const unsigned char *png, size_t len, const std::vector<unsigned char> &img, int w, int h) {
+	int dw, dh, dc;
+	unsigned char *d = stbi_load_from_memory(png, (int)len, &dw, &dh, &dc, 3);
+	bool ok = (d != nullptr) && (dw == w) && (dh == h) && (memcmp(d, img.data(), img.size()) == 0);
+	stbi_image_free(d);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	std::string inFile = argc > 1 ? argv[1] : "assets/textures/Sky_diffuse.jpeg";
+	int reps = argc > 2 ? std::max(1, atoi(argv[2])) : 3;
+	int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+	int sw, sh, sc;
+	stbi_uc *src = stbi_load(inFile.c_str(), &sw, &sh, &sc, 3);
+	if(!src) {
+		std::cout << "Not found: " << inFile << "\n";
+		return 1;
+	}
+
+	const int sizes[2][2] = {{1280, 720}, {3840, 2160}};
+	const EncoderConfig configs[] = {
+		{"level 1, Up",         1, PNGF_UP,       1},	// recordings
+		{"level 1, adaptive",   1, PNGF_ADAPTIVE, 1},
+		{"level 2, adaptive",   2, PNGF_ADAPTIVE, 1},	// screenshots, on one thread
+		{"level 5, adaptive",   5, PNGF_ADAPTIVE, 1},
+		{"level 2, adaptive MT", 2, PNGF_ADAPTIVE, threads},
+	};
+
+	for(auto &size : sizes) {
+		int w = size[0], h = size[1];
+		std::vector<unsigned char> img((size_t)w * h * 3);
+		for(int y = 0; y < h; y++) {
+			for(int x = 0; x < w; x++) {
+				memcpy(&img[((size_t)y * w + x) * 3], &src[((size_t)(y * sh / h) * sw + x * sw / w) * 3], 3);
+			}
+		}
+		for(int y = h / 10; y < h / 4; y++) {
+			for(int x = w / 10; x < w / 3; x++) {
+				unsigned char *p = &img[((size_t)y * w + x) * 3];
+				p[0] = p[0] / 4 + 20;
+				p[1] = p[1] / 4 + 20;
+				p[2] = p[2] / 4 + 30;
+			}
+		}
+		std::cout << w << "x" << h << ", best of " << reps << "\n";
+
+		double best = 1e30;
+		int len = 0;
+		bool ok = false;
+		for(int r = 0; r < reps; r++) {
+			Clock::time_point start = Clock::now();
+			unsigned char *png = stbi_write_png_to_mem(img.data(), w * 3, w, h, 3, &len);
+			best = std::min(best, elapsedMs(start));
+			ok = decodesTo(png, len, img, w, h);
+			STBIW_FREE(png);
+		}
+		printRow("stbi_write_png", best, len, ok);
+
+		for(auto &C : configs) {
+			std::vector<unsigned char> out;
+			best = 1e30;
+			for(int r = 0; r < reps; r++) {
+				Clock::time_point start = Clock::now();
+				EncodePNG(out, w, h, 3, img.data(), w * 3, C.level, C.filter, C.threads);
+				best = std::min(best, elapsedMs(start));
+			}
+			printRow(C.name, best, out.size(), decodesTo(out.data(), out.size(), img, w, h));
+		}
+	}
+	stbi_image_free(src);
+	return 0;
+}